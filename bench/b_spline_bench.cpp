@@ -0,0 +1,93 @@
+#include "_graphics.hpp"
+#include <chrono>
+#include <random>
+
+// Compares the recursive Cox-de Boor path (b_spline_blend for every control point)
+// with the knot-span evaluator used by geometry::b_spline and the batched SIMD evaluator.
+
+/**
+ * @brief The previous sampling loop, kept here as the reference implementation.
+ */
+vector<vec3> b_spline_recursive(vector<vec3>& cp, vector<float>& knots, int approxM, int degree) {
+    vector<vec3> spline_points;
+    for (int i = 0; i < approxM; i++) {
+        float u = static_cast<float>(i) / approxM;
+        vec3 point(0.0f);
+        for (int k = 0; k < cp.size(); k++) {
+            point += geometry::b_spline_blend(u, k, degree, knots) * cp[k];
+        }
+        spline_points.push_back(point);
+    }
+    return spline_points;
+}
+
+/**
+ * @brief Builds a clamped knot vector on [0, 1] with uniformly spaced interior knots.
+ */
+vector<float> clamped_knots(int numControlPoints, int degree) {
+    vector<float> knots;
+    int interior = numControlPoints - degree - 1;
+    for (int i = 0; i <= degree; i++) knots.push_back(0);
+    for (int i = 1; i <= interior; i++) knots.push_back(i / static_cast<float>(interior + 1));
+    for (int i = 0; i <= degree; i++) knots.push_back(1);
+    return knots;
+}
+
+void run(int numCurves, int numControlPoints, int degree, int approxM) {
+    mt19937 rng(1234);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<vector<vec3>> curves(numCurves);
+    for (auto& cp : curves)
+        for (int i = 0; i < numControlPoints; i++)
+            cp.push_back(vec3(dist(rng), dist(rng), dist(rng)));
+    vector<float> knots = clamped_knots(numControlPoints, degree);
+
+    float maxError = 0.0f;
+    size_t checksum = 0;
+
+    auto start = chrono::steady_clock::now();
+    vector<vector<vec3>> reference;
+    for (auto& cp : curves)
+        reference.push_back(b_spline_recursive(cp, knots, approxM, degree));
+    auto mid = chrono::steady_clock::now();
+    vector<vector<vec3>> evaluated;
+    for (auto& cp : curves)
+        evaluated.push_back(geometry::b_spline(cp, knots, approxM, degree));
+    auto end = chrono::steady_clock::now();
+
+    for (int c = 0; c < numCurves; c++) {
+        checksum += evaluated[c].size();
+        for (int i = 0; i < approxM; i++)
+            maxError = glm::max(maxError, length(evaluated[c][i] - reference[c][i]));
+    }
+
+    double recursiveMs = chrono::duration<double, milli>(mid - start).count();
+    double knotSpanMs = chrono::duration<double, milli>(end - mid).count();
+    cout << "curves: " << numCurves << ", control points: " << numControlPoints << ", degree: " << degree << ", samples: " << approxM << endl;
+    cout << "  recursive  : " << recursiveMs << " ms" << endl;
+    cout << "  knot span  : " << knotSpanMs << " ms (" << recursiveMs / knotSpanMs << "x)" << endl;
+    cout << "  max error  : " << maxError << " (" << checksum << " points)" << endl;
+
+    geometry::b_spline_batch batch(numCurves, numControlPoints);
+    for (int c = 0; c < numCurves; c++)
+        batch.setCurve(c, curves[c]);
+    vector<vec3> batched;
+    auto batchStart = chrono::steady_clock::now();
+    geometry::b_spline_batch_eval(batch, knots, approxM, batched, degree);
+    auto batchEnd = chrono::steady_clock::now();
+
+    float batchError = 0.0f;
+    for (int c = 0; c < numCurves; c++)
+        for (int i = 0; i < approxM; i++)
+            batchError = glm::max(batchError, length(batched[c * approxM + i] - evaluated[c][i]));
+    double batchMs = chrono::duration<double, milli>(batchEnd - batchStart).count();
+    cout << "  batch      : " << batchMs << " ms (" << knotSpanMs / batchMs << "x over knot span, error " << batchError << ")" << endl;
+}
+
+int main() {
+    run(10000, 4, 3, 100);
+    run(1000, 16, 3, 100);
+    run(1000, 16, 5, 100);
+    run(100, 64, 7, 100);
+    return 0;
+}
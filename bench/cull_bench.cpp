@@ -0,0 +1,119 @@
+#include "_culling.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// Compares culling::instance_set::cull with a brute force test of every instance box against the frustum,
+// on a field of grass blades like the one of main.cpp seen from several directions.
+
+/**
+ * @brief Instances scattered over a square field, turned around the up axis and scaled like grass blades.
+ */
+vector<mat4> grass_field(int count, float halfSize, mt19937& rng) {
+    uniform_real_distribution<float> position(-halfSize, halfSize);
+    uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    uniform_real_distribution<float> scale(0.5f, 1.5f);
+    vector<mat4> transforms(count);
+    for (mat4& m : transforms) {
+        m = translate(mat4(1.0f), vec3(position(rng), 0.0f, position(rng)));
+        m = rotate(m, angle(rng), vec3(0, 1, 0));
+        m = glm::scale(m, vec3(scale(rng)));
+    }
+    return transforms;
+}
+
+/**
+ * @brief The distance of a box to the closest frustum plane it is outside of, negative when it is outside.
+ */
+float plane_margin(const culling::frustum& f, const vec3& center, const vec3& extent) {
+    float margin = INFINITY;
+    for (const vec4& plane : f.planes) {
+        margin = glm::min(margin, dot(vec3(plane), center) + plane.w + dot(abs(vec3(plane)), extent));
+    }
+    return margin;
+}
+
+bool run(int count) {
+    mt19937 rng(1234);
+    const float halfSize = 50.0f;
+    const vector<mat4> transforms = grass_field(count, halfSize, rng);
+    const vec3 localMin(-0.05f, 0.0f, -0.05f), localMax(0.05f, 1.0f, 0.05f);
+
+    culling::instance_set set;
+    auto buildStart = chrono::steady_clock::now();
+    set.build(transforms, localMin, localMax);
+    auto buildEnd = chrono::steady_clock::now();
+
+    // the boxes of the brute force test, transformed the same way as instance_set::build
+    const vec3 localCenter = 0.5f * (localMax + localMin);
+    const vec3 localExtent = 0.5f * (localMax - localMin);
+    vector<vec3> centers(count), extents(count);
+    for (int i = 0; i < count; i++) {
+        const mat4& m = transforms[i];
+        centers[i] = vec3(m * vec4(localCenter, 1.0f));
+        extents[i] = abs(vec3(m[0])) * localExtent.x + abs(vec3(m[1])) * localExtent.y + abs(vec3(m[2])) * localExtent.z;
+    }
+
+    const int views = 16;
+    const int repeats = 20;
+    const mat4 projection = perspective(radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    double cullMs = 0.0, bruteMs = 0.0;
+    size_t visibleTotal = 0, bruteTotal = 0, mismatches = 0;
+    vector<unsigned int> visible;
+    vector<char> seen(count);
+    for (int v = 0; v < views; v++) {
+        const float angle = 6.2831853f * v / views;
+        const vec3 eye(0.0f, 2.0f, 0.0f);
+        const mat4 view = lookAt(eye, eye + vec3(cos(angle), -0.2f, sin(angle)), vec3(0, 1, 0));
+        const culling::frustum f = culling::frustum::from_matrix(projection * view);
+
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++) {
+            set.cull(f, visible);
+        }
+        auto mid = chrono::steady_clock::now();
+        size_t bruteCount = 0;
+        for (int r = 0; r < repeats; r++) {
+            bruteCount = 0;
+            for (int i = 0; i < count; i++) {
+                if (f.test(centers[i], extents[i]) != culling::frustum::OUTSIDE) bruteCount++;
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        cullMs += chrono::duration<double, milli>(mid - start).count() / repeats;
+        bruteMs += chrono::duration<double, milli>(end - mid).count() / repeats;
+        visibleTotal += visible.size();
+        bruteTotal += bruteCount;
+
+        fill(seen.begin(), seen.end(), 0);
+        for (unsigned int instance : visible) {
+            seen[instance] = 1;
+        }
+        for (int i = 0; i < count; i++) {
+            const bool expected = f.test(centers[i], extents[i]) != culling::frustum::OUTSIDE;
+            // the SSE kernel sums in another order, boxes touching a plane may go either way
+            if (expected != (seen[i] != 0) && fabs(plane_margin(f, centers[i], extents[i])) > 1e-4f) {
+                mismatches++;
+            }
+        }
+    }
+
+    cout << "instances: " << count << ", build: " << chrono::duration<double, milli>(buildEnd - buildStart).count() << " ms" << endl;
+    cout << "  cull        : " << cullMs / views << " ms per view" << endl;
+    cout << "  brute force : " << bruteMs / views << " ms per view (" << bruteMs / cullMs << "x)" << endl;
+    cout << "  visible     : " << visibleTotal / views << " per view (brute force " << bruteTotal / views << "), mismatches: " << mismatches << endl;
+    return mismatches == 0;
+}
+
+int main() {
+    // the grass of main.cpp, then twice as many
+    const bool ok = run(50000) && run(100000);
+    if (!ok) {
+        cout << "FAILED, the culled set differs from the brute force set" << endl;
+        return 1;
+    }
+    return 0;
+}
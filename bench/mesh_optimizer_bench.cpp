@@ -0,0 +1,95 @@
+#include "_graphics.hpp"
+#include <algorithm>
+#include <random>
+#include <tuple>
+
+// Prints the post transform cache efficiency of the primitive meshes before and after geometry::optimize_mesh,
+// starting from a shuffled order of their triangles and vertices, and checks that the same triangles are drawn.
+
+typedef tuple<float, float, float, float, float, float, float, float> vertex_key;
+typedef array<vertex_key, 3> triangle_key;
+
+/**
+ * @brief The triangles of a mesh by the attributes of their vertices, starting from their smallest vertex so
+ * that the winding is kept but not the first vertex.
+ */
+vector<triangle_key> triangle_set(const geometry::mesh& m) {
+    vector<triangle_key> triangles;
+    for (size_t i = 0; i + 2 < m.indices.size(); i += 3) {
+        triangle_key t;
+        for (int k = 0; k < 3; k++) {
+            const unsigned int v = m.indices[i + k];
+            t[k] = vertex_key(m.vertices[v].x, m.vertices[v].y, m.vertices[v].z,
+                m.normals[v].x, m.normals[v].y, m.normals[v].z, m.uvs[v].x, m.uvs[v].y);
+        }
+        rotate(t.begin(), min_element(t.begin(), t.end()), t.end());
+        triangles.push_back(t);
+    }
+    sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+/**
+ * @brief Shuffles the triangles and renumbers the vertices at random, the order of a mesh nobody optimized.
+ */
+void shuffle_mesh(geometry::mesh& m, mt19937& rng) {
+    vector<unsigned int> order(m.indices.size() / 3);
+    for (size_t t = 0; t < order.size(); t++) {
+        order[t] = t;
+    }
+    shuffle(order.begin(), order.end(), rng);
+    vector<unsigned int> remap(m.vertices.size());
+    for (size_t v = 0; v < remap.size(); v++) {
+        remap[v] = v;
+    }
+    shuffle(remap.begin(), remap.end(), rng);
+
+    vector<unsigned int> indices;
+    for (unsigned int t : order) {
+        for (int k = 0; k < 3; k++) {
+            indices.push_back(remap[m.indices[t * 3 + k]]);
+        }
+    }
+    m.indices.swap(indices);
+    mesh_optimizer::remap_vertices(m.vertices, remap);
+    mesh_optimizer::remap_vertices(m.normals, remap);
+    mesh_optimizer::remap_vertices(m.uvs, remap);
+}
+
+void print(const char* label, const mesh_optimizer::cache_stats& stats) {
+    cout << "  " << label << ": ACMR " << stats.acmr << ", ATVR " << stats.atvr << endl;
+}
+
+bool run(const char* name, geometry::mesh m, mt19937& rng) {
+    const mesh_optimizer::cache_stats generated = mesh_optimizer::analyze_vertex_cache(m.indices, 0, m.indices.size(), m.vertices.size());
+    shuffle_mesh(m, rng);
+    const vector<triangle_key> expected = triangle_set(m);
+    const pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> stats = geometry::optimize_mesh(m);
+    const bool same = triangle_set(m) == expected;
+
+    cout << name << ": " << stats.first.triangles << " triangles, " << stats.first.uniqueVertices << " vertices" << endl;
+    print("shuffled ", stats.first);
+    print("optimized", stats.second);
+    print("generated", generated);
+    if (!same) {
+        cout << "  the optimized mesh draws other triangles" << endl;
+    }
+    if (stats.second.acmr > stats.first.acmr) {
+        cout << "  the optimized mesh transforms more vertices" << endl;
+    }
+    return same && stats.second.acmr <= stats.first.acmr;
+}
+
+int main() {
+    mt19937 rng(1234);
+    bool ok = true;
+    ok = run("uv sphere", geometry::uv_sphere_mesh(vec3(0.0f), 1.0f, geometry::DETAIL_HIGH), rng) && ok;
+    ok = run("icosphere", geometry::icosphere_mesh(vec3(0.0f), 1.0f, geometry::DETAIL_HIGH), rng) && ok;
+    ok = run("cube", geometry::cube_mesh(vec3(0.0f), 1.0f, geometry::DETAIL_HIGH), rng) && ok;
+    ok = run("plane", geometry::plane_mesh(vec3(0.0f), vec2(1.0f), geometry::DETAIL_HIGH), rng) && ok;
+    if (!ok) {
+        cout << "FAILED" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "_occlusion.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <random>
+
+// Rasterises a wall turned around the view axis and checks culling::occlusion_buffer::occluded() for boxes in
+// front of it, behind it and straddling its edges: a box may only be reported hidden when all of it projects
+// inside the wall, wherever the pixels fall.
+
+const float WALL_DEPTH = 10.0f;
+const float WALL_HALF_SIZE = 3.0f;
+const float WALL_ANGLE = 0.5f;
+
+/**
+ * @brief The corners of the wall, a square facing the camera at z = -WALL_DEPTH.
+ */
+vector<vec3> wall_corners() {
+    vector<vec3> corners;
+    for (int k = 0; k < 4; k++) {
+        const float angle = WALL_ANGLE + 1.5707963f * k;
+        corners.push_back(vec3(1.4142136f * WALL_HALF_SIZE * cos(angle), 1.4142136f * WALL_HALF_SIZE * sin(angle), -WALL_DEPTH));
+    }
+    return corners;
+}
+
+/**
+ * @brief The pixel coordinates of a point, the same mapping as the occlusion buffer.
+ */
+vec2 to_pixels(const mat4& viewProjection, const vec3& p, const culling::occlusion_buffer& buffer) {
+    const vec4 clip = viewProjection * vec4(p, 1.0f);
+    return vec2((clip.x / clip.w * 0.5f + 0.5f) * buffer.getWidth(), (clip.y / clip.w * 0.5f + 0.5f) * buffer.getHeight());
+}
+
+/**
+ * @brief Returns whether every corner of a box projects inside the wall, which is then hidden if it is behind.
+ */
+bool inside_wall(const mat4& viewProjection, const vec3& min, const vec3& max, const culling::occlusion_buffer& buffer) {
+    const vector<vec3> wall = wall_corners();
+    vec2 polygon[4];
+    for (int k = 0; k < 4; k++) {
+        polygon[k] = to_pixels(viewProjection, wall[k], buffer);
+    }
+    for (int corner = 0; corner < 8; corner++) {
+        const vec3 p((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+        const vec2 q = to_pixels(viewProjection, p, buffer);
+        for (int k = 0; k < 4; k++) {
+            const vec2 a = polygon[k], b = polygon[(k + 1) % 4];
+            // the corners go counterclockwise, with a tolerance for the rounding of the rasteriser
+            if ((b.x - a.x) * (q.y - a.y) - (b.y - a.y) * (q.x - a.x) < -1e-3f * length(b - a)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    culling::occlusion_buffer buffer;
+    const mat4 viewProjection = perspective(radians(60.0f), 2.0f, 0.1f, 100.0f)
+        * lookAt(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+    const vector<vec3> wall = wall_corners();
+    const vector<unsigned int> indices { 0, 1, 2, 0, 2, 3 };
+    buffer.begin(viewProjection);
+    buffer.addOccluder(wall, indices, 0, indices.size(), mat4(1.0f));
+    buffer.end();
+
+    int failures = 0;
+    auto expect = [&](const char* label, const vec3& center, float halfSize, bool hidden) {
+        if (buffer.occluded(center - vec3(halfSize), center + vec3(halfSize)) != hidden) {
+            cout << label << ": expected " << (hidden ? "hidden" : "visible") << endl;
+            failures++;
+        }
+    };
+    // the box behind the center also covers the diagonal shared by the two triangles of the wall
+    expect("in front", vec3(0.0f, 0.0f, -5.0f), 0.5f, false);
+    expect("behind", vec3(0.0f, 0.0f, -2.0f * WALL_DEPTH), 0.5f, true);
+    const vec3 edgeMiddle = 0.5f * (wall[0] + wall[1]);
+    expect("straddling an edge", 2.0f * edgeMiddle, 0.5f, false);
+    expect("beside", vec3(3.0f * edgeMiddle.x, 3.0f * edgeMiddle.y, -2.0f * WALL_DEPTH), 0.5f, false);
+
+    // random boxes, a hidden box must project inside the wall and be behind it
+    mt19937 rng(1234);
+    uniform_real_distribution<float> lateral(-8.0f, 8.0f);
+    uniform_real_distribution<float> size(0.05f, 1.0f);
+    uniform_real_distribution<float> behind(-3.0f * WALL_DEPTH, -1.2f * WALL_DEPTH);
+    uniform_real_distribution<float> before(-0.9f * WALL_DEPTH, -0.2f * WALL_DEPTH);
+    int hidden = 0, wrong = 0;
+    const int count = 100000;
+    for (int i = 0; i < count; i++) {
+        const bool back = i % 2 == 0;
+        const vec3 center(lateral(rng), lateral(rng), back ? behind(rng) : before(rng));
+        const float halfSize = size(rng);
+        const vec3 min = center - vec3(halfSize), max = center + vec3(halfSize);
+        if (buffer.occluded(min, max)) {
+            hidden++;
+            if (!back || max.z > -WALL_DEPTH || !inside_wall(viewProjection, min, max, buffer)) wrong++;
+        }
+    }
+    cout << "primitives: " << buffer.getPrimitiveCount() << ", random boxes: " << count << ", hidden: " << hidden
+        << ", hidden but visible: " << wrong << endl;
+    failures += wrong;
+    if (hidden == 0) {
+        cout << "no random box is hidden" << endl;
+        failures++;
+    }
+    if (failures > 0) {
+        cout << "FAILED" << endl;
+        return 1;
+    }
+    return 0;
+}
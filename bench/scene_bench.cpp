@@ -0,0 +1,168 @@
+#include "_scene.hpp"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+// Compares the frustum, box and ray queries of the scene hierarchy with brute force tests of every object box,
+// before and after refit(), and times the frustum query against the linear scan.
+// The geometry buffers of the objects need a GL context, e.g. LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./bench/scene_bench
+
+/**
+ * @brief The same slab test as the scene, returns the entry distance or INFINITY if the box is missed.
+ */
+float ray_box(const vec3& origin, const vec3& inverseDirection, const bounding_box& box, float maxDistance) {
+    if (box.isEmpty()) {
+        return INFINITY;
+    }
+    const vec3 t0 = (box.getMin() - origin) * inverseDirection;
+    const vec3 t1 = (box.getMax() - origin) * inverseDirection;
+    const vec3 tNear = min(t0, t1);
+    const vec3 tFar = max(t0, t1);
+    const float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+    const float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+    return enter <= exit ? enter : INFINITY;
+}
+
+/**
+ * @brief Places every object at a random position and size in a cube of the given half size.
+ */
+void scatter(vector<scene_obj*>& objects, float halfSize, mt19937& rng) {
+    uniform_real_distribution<float> position(-halfSize, halfSize);
+    uniform_real_distribution<float> size(0.1f, 2.0f);
+    for (scene_obj* obj : objects) {
+        obj->setModel(glm::scale(glm::translate(mat4(1.0f), vec3(position(rng), position(rng), position(rng))), vec3(size(rng), size(rng), size(rng))));
+    }
+}
+
+struct comparison {
+    size_t queries = 0;
+    size_t found = 0;
+    size_t mismatches = 0;
+    double sceneMs = 0.0;
+    double linearMs = 0.0;
+};
+
+/**
+ * @brief Runs every query type on the scene and on a linear scan of the objects, counting the differing results.
+ */
+comparison compare(scene& s, vector<scene_obj*>& objects, float halfSize, mt19937& rng) {
+    comparison c;
+    uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    vector<scene_obj*> result, expected;
+    const mat4 projection = perspective(radians(45.0f), 16.0f / 9.0f, 0.1f, 2.0f * halfSize);
+    for (int q = 0; q < 64; q++) {
+        const vec3 eye = halfSize * vec3(unit(rng), unit(rng), unit(rng));
+        const vec3 front = vec3(unit(rng), unit(rng), unit(rng));
+        const culling::frustum f = culling::frustum::from_matrix(projection * lookAt(eye, eye + front, vec3(0, 1, 0)));
+
+        auto start = chrono::steady_clock::now();
+        s.queryFrustum(f, result);
+        auto mid = chrono::steady_clock::now();
+        expected.clear();
+        for (scene_obj* obj : objects) {
+            const bounding_box& box = obj->worldBoundingBox();
+            if (!box.isEmpty() && f.test(box.getCenter(), box.getExtent()) != culling::frustum::OUTSIDE) expected.push_back(obj);
+        }
+        auto end = chrono::steady_clock::now();
+        c.sceneMs += chrono::duration<double, milli>(mid - start).count();
+        c.linearMs += chrono::duration<double, milli>(end - mid).count();
+        c.mismatches += result != expected;
+        c.found += result.size();
+        c.queries++;
+
+        const vec3 corner = halfSize * vec3(unit(rng), unit(rng), unit(rng));
+        const bounding_box region(corner, corner + 0.2f * halfSize * vec3(1.0f));
+        s.queryBox(region, result);
+        expected.clear();
+        for (scene_obj* obj : objects) {
+            if (obj->worldBoundingBox().intersects(region)) expected.push_back(obj);
+        }
+        c.mismatches += result != expected;
+
+        const vec3 direction = vec3(unit(rng), unit(rng), unit(rng));
+        const float maxDistance = q % 2 ? INFINITY : halfSize;
+        s.queryRay(eye, direction, result, maxDistance);
+        vector<pair<float, int>> hits;
+        for (size_t i = 0; i < objects.size(); i++) {
+            const float distance = ray_box(eye, 1.0f / direction, objects[i]->worldBoundingBox(), maxDistance);
+            if (distance != INFINITY) hits.push_back({ distance, static_cast<int>(i) });
+        }
+        sort(hits.begin(), hits.end());
+        expected.clear();
+        for (auto& hit : hits) {
+            expected.push_back(objects[hit.second]);
+        }
+        c.mismatches += result != expected;
+    }
+    return c;
+}
+
+void report(const char* label, const comparison& c) {
+    cout << "  " << label << ": frustum " << c.sceneMs / c.queries << " ms per query, linear " << c.linearMs / c.queries
+        << " ms (" << c.linearMs / c.sceneMs << "x), " << c.found / c.queries << " objects per query, mismatches: " << c.mismatches << endl;
+}
+
+bool run(int count) {
+    mt19937 rng(1234);
+    const float halfSize = 100.0f;
+    vector<vec3> cube;
+    for (int corner = 0; corner < 8; corner++) {
+        cube.push_back(vec3(corner & 1 ? 0.5f : -0.5f, corner & 2 ? 0.5f : -0.5f, corner & 4 ? 0.5f : -0.5f));
+    }
+    vector<scene_obj*> objects;
+    scene s;
+    for (int i = 0; i < count; i++) {
+        scene_obj* obj = new scene_obj();
+        // every 100th object has no geometry and an empty box
+        if (i % 100 != 0) {
+            obj->gb->setVertices(cube);
+        }
+        objects.push_back(obj);
+        s.add(obj);
+    }
+    scatter(objects, halfSize, rng);
+
+    auto start = chrono::steady_clock::now();
+    s.build();
+    auto end = chrono::steady_clock::now();
+    cout << "objects: " << count << ", build: " << chrono::duration<double, milli>(end - start).count() << " ms" << endl;
+    const comparison built = compare(s, objects, halfSize, rng);
+    report("built  ", built);
+
+    scatter(objects, halfSize, rng);
+    s.refit();
+    const comparison refitted = compare(s, objects, halfSize, rng);
+    report("refit  ", refitted);
+
+    for (scene_obj* obj : objects) {
+        delete obj;
+    }
+    return built.mismatches == 0 && refitted.mismatches == 0;
+}
+
+int main() {
+    if (!glfwInit()) {
+        cout << "There was an issue loading glfw.." << endl;
+        return 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* pWindowHandle = glfwCreateWindow(64, 64, "scene_bench", nullptr, nullptr);
+    if (!pWindowHandle) {
+        cout << "There was an issue initializing glfw window!" << endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(pWindowHandle);
+
+    const bool ok = run(2000) && run(20000);
+    glfwTerminate();
+    if (!ok) {
+        cout << "FAILED, the scene queries differ from the brute force results" << endl;
+        return 1;
+    }
+    return 0;
+}
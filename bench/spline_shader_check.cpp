@@ -0,0 +1,93 @@
+#include "_graphics.hpp"
+#include <random>
+
+// Checks that shaders/vertex_shader_spline.glsl produces the same points as geometry::b_spline.
+// The curve points are captured with transform feedback, so nothing has to be presented on screen and the
+// check runs headless, e.g. under Mesa llvmpipe: LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./bench/spline_shader_check
+
+const char* VERTEX_SHADER_PATH_SPLINE = "shaders/vertex_shader_spline.glsl";
+const char* FRAGMENT_SHADER_PATH = "shaders/fragment_shader.glsl";
+
+int main() {
+    if (!glfwInit()) {
+        cout << "There was an issue loading glfw.." << endl;
+        return 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* pWindowHandle = glfwCreateWindow(64, 64, "spline_shader_check", nullptr, nullptr);
+    if (!pWindowHandle) {
+        cout << "There was an issue initializing glfw window!" << endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(pWindowHandle);
+    cout << "renderer: " << glGetString(GL_RENDERER) << endl;
+
+    const int numCurves = 1000;
+    const int approxM = 100;
+    vector<float> knots{ 0, 0, 0, 0, 1, 1, 1, 1 };
+    mt19937 rng(42);
+    uniform_real_distribution<float> dist(-5.0f, 5.0f);
+    vector<array<vec3, 4>> controls(numCurves);
+    for (auto& cp : controls)
+        for (auto& point : cp)
+            point = vec3(dist(rng), dist(rng), dist(rng));
+
+    float maxError = 0.0f;
+    {
+        shader_program sp;
+        sp.load(VERTEX_SHADER_PATH_SPLINE, FRAGMENT_SHADER_PATH);
+        sp.setTransformFeedbackVaryings({ "FragPos" });
+        sp.attach();
+
+        spline_geometry_buffer buffer(approxM);
+        buffer.drawMode = GL_POINTS;
+        buffer.setControlPoints(controls);
+        buffer.setShaderProgram(&sp);
+        buffer.updateBuffers();
+
+        GLuint feedback;
+        glGenBuffers(1, &feedback);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, feedback);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, numCurves * approxM * sizeof(vec3), nullptr, GL_STATIC_READ);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, feedback);
+
+        sp.use();
+        sp.setUniform("mModel", mat4(1.0f));
+        sp.setUniform("mView", mat4(1.0f));
+        sp.setUniform("mProjection", mat4(1.0f));
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBeginTransformFeedback(GL_POINTS);
+        buffer.draw();
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        const vec3* captured = static_cast<const vec3*>(glMapBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, numCurves * approxM * sizeof(vec3), GL_MAP_READ_BIT));
+        if (!captured) {
+            cout << "Failed to read back the transform feedback buffer" << endl;
+            glfwTerminate();
+            return 1;
+        }
+        for (int c = 0; c < numCurves; c++) {
+            vector<vec3> expected = geometry::b_spline({ controls[c][0], controls[c][1], controls[c][2], controls[c][3] }, knots, approxM);
+            for (int i = 0; i < approxM; i++)
+                maxError = glm::max(maxError, length(captured[c * approxM + i] - expected[i]));
+        }
+        glUnmapBuffer(GL_TRANSFORM_FEEDBACK_BUFFER);
+        glDeleteBuffers(1, &feedback);
+    }
+    glfwTerminate();
+
+    const float tolerance = 1e-4f;
+    cout << numCurves << " curves x " << approxM << " points, max error: " << maxError << endl;
+    if (maxError > tolerance) {
+        cout << "FAILED, error is above " << tolerance << endl;
+        return 1;
+    }
+    cout << "OK" << endl;
+    return 0;
+}
@@ -1,6 +1,9 @@
 #define GL_SILENCE_DEPRECATION
 #include "_graphics.hpp"
 #include "_camera.hpp"
+#include "_scene.hpp"
+#include "_program_cache.hpp"
+#include "_shader_watcher.hpp"
 #include <glm/gtx/quaternion.hpp>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -20,6 +23,26 @@ const char* FRAGMENT_SHADER_PATH = "shaders/fragment_shader.glsl";
 const char* VERTEX_SHADER_PATH_TEXTURED = "shaders/vertex_shader_textured.glsl";
 const char* FRAGMENT_SHADER_PATH_TEXTURED = "shaders/fragment_shader_textured.glsl";
 
+const char* VERTEX_SHADER_PATH_SPLINE = "shaders/vertex_shader_spline.glsl";
+
+// Evaluate the grass blades in the vertex shader from per instance control points, toggled from the menu
+bool gpuSplines = false;
+// Frustum culling of the grass instances, toggled from the menu
+bool cullInstances = true;
+// Coarser tessellations of the far grass blades, toggled from the menu
+bool grassLod = true;
+// Skip the objects and grass chunks hidden behind the occluders, toggled from the menu
+bool occlusionCulling = true;
+size_t visibleInstances = 0, totalInstances = 0;
+vector<size_t> grassLodCounts;
+render_queue::statistics renderStats;
+gl_state::statistics glStats;
+geometry_batch::statistics batchStats;
+buffer_arena::statistics arenaStats;
+stream_buffer::statistics grassStreamStats;
+program_cache::statistics programStats;
+shader_watcher::statistics reloadStats;
+
 
 
 /**
@@ -63,15 +86,15 @@ GLFWwindow* make_win() {
 }
 
 void gl_enable() {
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_PROGRAM_POINT_SIZE);
-    glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_POLYGON_SMOOTH);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_MULTISAMPLE);
-    glEnable(GL_TEXTURE_2D);
+    gl_state::enable(GL_DEPTH_TEST);
+    gl_state::enable(GL_PROGRAM_POINT_SIZE);
+    gl_state::enable(GL_LINE_SMOOTH);
+    gl_state::enable(GL_POLYGON_SMOOTH);
+    gl_state::enable(GL_BLEND);
+    gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gl_state::enable(GL_CULL_FACE);
+    gl_state::enable(GL_MULTISAMPLE);
+    gl_state::enable(GL_TEXTURE_2D);
 }
 
 
@@ -107,42 +130,126 @@ void showMenu() {
             }
             ImGui::EndMenu();
         }
+        if (ImGui::BeginMenu("Rendering")) {
+            ImGui::MenuItem("Frustum culling", nullptr, &cullInstances);
+            ImGui::MenuItem("Grass LOD", nullptr, &grassLod);
+            ImGui::MenuItem("Occlusion culling", nullptr, &occlusionCulling);
+            ImGui::MenuItem("GPU grass splines", nullptr, &gpuSplines);
+            ImGui::EndMenu();
+        }
+        ImGui::Text("Grass %zu / %zu", visibleInstances, totalInstances);
+        for (size_t level = 0; level < grassLodCounts.size(); level++) {
+            ImGui::Text("LOD %zu: %zu", level, grassLodCounts[level]);
+        }
+        ImGui::Text("Draws %zu, programs %zu, textures %zu", renderStats.draws, renderStats.programChanges, renderStats.textureChanges);
+        ImGui::Text("GL state calls %zu, elided %zu", glStats.calls, glStats.elided);
+        ImGui::Text("Batched objects %zu, multi draws %zu", batchStats.objects, batchStats.draws);
+        ImGui::Text("Geometry arena %zu / %zu KB, %zu blocks", arenaStats.used >> 10, arenaStats.capacity >> 10, arenaStats.blocks);
+        ImGui::Text("Grass stream writes %zu, waits %zu", grassStreamStats.writes, grassStreamStats.waits);
+        ImGui::Text("Programs compiled %zu, from binaries %zu, shared %zu", programStats.compiled, programStats.binaries, programStats.shared);
+        ImGui::Text("Shader reloads %zu, failed %zu", reloadStats.reloads, reloadStats.failures);
         ImGui::End();
     }
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-vector<unsigned int> getIndices(vector<vec3>& vertices) {
-    const size_t n = vertices.size();
-    vector<unsigned int> indices;
-    for (int i = 0; i < n; i++)
-        indices.push_back(i);
-    return indices;
+/**
+ * @brief Welds duplicated vertices of unindexed geometry and returns the index buffer drawing the same primitives.
+ */
+vector<unsigned int> getIndices(vector<vec3>& vertices, vector<vec3>& colors, vector<vec3>& normals) {
+    return mesh_optimizer::weld_vertices(vertices, &colors, &normals);
 }
 
 
 class spline : public scene_obj {
 public:
+    /**
+     * @param tolerance Chord error in world units used for adaptive tessellation, 0 samples a fixed 100 points.
+     * @param lods Coarser tessellations as { distance from which they are used, number of segments }, by increasing distance.
+     * @param arena Optional arena storing the vertices and indices.
+     */
     spline(
         shader_program* shader,
         array<vec3, 4> controls,
         vector<mat4> instances = { mat4(1.0f) },
-        vec3 color = { 0,0,0 }
+        vec3 color = { 0,0,0 },
+        float tolerance = 0.0f,
+        vector<pair<float, int>> lods = {},
+        buffer_arena* arena = nullptr
     ) {
         this->gb = new instanced_geometry_buffer();
         instanced_geometry_buffer& buffer = *static_cast<instanced_geometry_buffer*>(this->gb);
         vector<float> knots { 0, 0, 0, 0, 1, 1, 1, 1};
-        vector<vec3> vertices = geometry::b_spline({ controls[0], controls[1], controls[2], controls[3] }, knots, 100);
-        vector<unsigned int> indices = getIndices(vertices);
-        vector<vec3> colors = { indices.size(), color };
-        vector<vec3> normals = { indices.size(), normalize(vec3(0, 1, 1)) };
+        vector<vec3> cp { controls[0], controls[1], controls[2], controls[3] };
+        vector<vec3> vertices = tolerance > 0
+            ? geometry::b_spline_adaptive(cp, knots, tolerance)
+            : geometry::b_spline(cp, knots, 100);
+        // every level of detail is a line strip after the previous ones in the same buffers
+        vector<lod_level> levels { lod_level({ { GL_LINE_STRIP, /* start */ 0, /* count */ vertices.size() } }, INFINITY) };
+        for (auto& lod : lods) {
+            levels.back().maxDistance = lod.first;
+            const size_t start = vertices.size();
+            for (int i = 0; i <= lod.second; i++) {
+                vertices.push_back(geometry::b_spline_point(cp, knots, i / static_cast<float>(lod.second)));
+            }
+            levels.push_back(lod_level({ { GL_LINE_STRIP, start, vertices.size() - start } }, INFINITY));
+        }
+        vector<vec3> colors = { vertices.size(), color };
+        vector<vec3> normals = { vertices.size(), normalize(vec3(0, 1, 1)) };
+        vector<unsigned int> indices = getIndices(vertices, colors, normals);
         buffer.setVertices(vertices);
         buffer.setIndices(indices);
         buffer.setColors(colors);
         buffer.setNormals(normals);
+        // culling and the levels of detail rewrite the instances every frame
+        buffer.setStreaming(true);
         buffer.setTransformations(instances);
-        buffer.setDrawPatterns(vector<DrawPattern> { { GL_LINE_STRIP, /* start */ 0, /* count */ indices.size()} });
+        // packed colors and normals, the positions stay float: the blade sits at z = -3 where the half float
+        // spacing (~0.002) is larger than the tessellation tolerance
+        vertex_format::vertex_layout layout = vertex_format::vertex_layout::packed();
+        layout.position = vertex_format::POSITION_FLOAT;
+        buffer.setVertexLayout(layout);
+        buffer.setDrawPatterns(levels[0].drawPatterns);
+        buffer.setBufferArena(arena);
+        buffer.setShaderProgram(shader);
+        buffer.bindVertexArray();
+        shader->attach();
+        buffer.updateBuffers();
+        this->levels = levels;
+        setLod(true);
+    }
+
+    /**
+     * @brief Enables or disables the coarser tessellations.
+     */
+    void setLod(bool enabled) {
+        enabled = enabled && levels.size() > 1;
+        if (enabled != lod) {
+            static_cast<instanced_geometry_buffer*>(this->gb)->setLodLevels(enabled ? levels : vector<lod_level>());
+            lod = enabled;
+        }
+    }
+
+private:
+    vector<lod_level> levels;
+    bool lod = false;
+};
+
+
+/**
+ * @brief Instanced clamped cubic splines evaluated in the vertex shader, only the control points of every instance are uploaded.
+ */
+class spline_gpu : public scene_obj {
+public:
+    spline_gpu(
+        shader_program* shader,
+        vector<array<vec3, 4>> controls,
+        vec3 color = { 0,0,0 }
+    ) {
+        this->gb = new spline_geometry_buffer(100, color);
+        spline_geometry_buffer& buffer = *static_cast<spline_geometry_buffer*>(this->gb);
+        buffer.setControlPoints(controls);
         buffer.setShaderProgram(shader);
         buffer.bindVertexArray();
         shader->attach();
@@ -157,7 +264,8 @@ public:
         shader_program* shader,
         array<float, 4> bounds,
         vector<mat4> instances = { mat4(1.0f) },
-        vec3 color = { 0,0,0 }
+        vec3 color = { 0,0,0 },
+        buffer_arena* arena = nullptr
     ) {
         this->gb = new instanced_geometry_buffer();
         instanced_geometry_buffer& buffer = *static_cast<instanced_geometry_buffer*>(this->gb);
@@ -172,15 +280,18 @@ public:
         vertices.push_back(vec3(bounds[1], 0, bounds[3]));
         vertices.push_back(vec3(bounds[1], 0, bounds[2]));
 
-        vector<unsigned int> indices = getIndices(vertices);
-        vector<vec3> colors = { indices.size(), color };
-        vector<vec3> normals = { indices.size(), normalize(vec3(0, 1, 0)) };
+        vector<vec3> colors = { vertices.size(), color };
+        vector<vec3> normals = { vertices.size(), normalize(vec3(0, 1, 0)) };
+        vector<unsigned int> indices = getIndices(vertices, colors, normals);
         buffer.setVertices(vertices);
         buffer.setIndices(indices);
         buffer.setColors(colors);
         buffer.setNormals(normals);
         buffer.setTransformations(instances);
+        buffer.setVertexLayout(vertex_format::vertex_layout::packed());
         buffer.setDrawPatterns(vector<DrawPattern> { { GL_TRIANGLES, /* start */ 0, /* count */ indices.size()} });
+        buffer.optimize();
+        buffer.setBufferArena(arena);
         buffer.setShaderProgram(shader);
         buffer.bindVertexArray();
         shader->attach();
@@ -229,22 +340,26 @@ int main() {
     initMenu(pWindowHandle);
     glClearColor(135 / 255.0f, 206 / 255.0f, 235 / 255.0f, 1.0f);
 
-    shader_program shader;
-    shader_program shader2;
-
-    shader_program shader_textured;
-
-    shader_textured.load(VERTEX_SHADER_PATH_TEXTURED, FRAGMENT_SHADER_PATH_TEXTURED);
-    shader2.load(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH);
-    shader.load(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH);
+    // programs of the same sources are shared, and linked from the binaries of the previous run when possible
+    program_cache programs;
+    shader_program& shader = *programs.get(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH);
+    shader_program& shader_spline = *programs.get(VERTEX_SHADER_PATH_SPLINE, FRAGMENT_SHADER_PATH);
+    // edited shaders are swapped in while the scene keeps running, a shader that does not link is ignored
+    shader_watcher watcher;
+    watcher.watch(&shader, VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH);
+    watcher.watch(&shader_spline, VERTEX_SHADER_PATH_SPLINE, FRAGMENT_SHADER_PATH);
 
     light_props light_scene{ DIRECTIONAL_LIGHT, vec3(0 ,10 ,-5), vec3(1,1,1), 0.8f, 1.0, 0.5 };
 
-    material_props material{ 1, 1 ,1 };
     vector<light_props> lights {light_scene};
+    // read by every program from the shared Lights block
+    uniform_buffer lightsBuffer;
 
 
 
+    // the vertices and indices of the objects share a few large buffers
+    buffer_arena geometryArena;
+
     vector<mat4> instances;
     halton_2d H;
     for (int i = 0; i < 50000; i++) {
@@ -256,13 +371,38 @@ int main() {
             translate(mat4(1.0f), 5.0f * vec3(Next[0], 0, -Next[1]))
         );
     }
-    spline spline_grass{
-         &shader,
-         /* controls*/
-        { vec3(0,-1,-3),vec3(-0.05,-0.95,-3),vec3(0.1,-0.85,-3), vec3(0,-0.75, -3)  },
+    array<vec3, 4> blade { vec3(0,-1,-3),vec3(-0.05,-0.95,-3),vec3(0.1,-0.85,-3), vec3(0,-0.75, -3) };
+    totalInstances = instances.size();
+    // the grass is built both as tessellated splines and as control points evaluated by the vertex shader,
+    // the menu switches the one in the scene
+    spline* cpuGrass = new spline{
+        &shader,
+        /* controls*/
+        blade,
         /* instances*/
         instances,
         /* color */
+        {0,0.4,0},
+        /* tolerance */
+        0.0005f,
+        /* lods: 8 segments from 4 units, 4 segments from 8 units */
+        { { 4.0f, 8 }, { 8.0f, 4 } },
+        /* arena */
+        &geometryArena
+    };
+    // bake every instance translation into its own control points
+    vector<array<vec3, 4>> blades;
+    for (mat4& instance : instances) {
+        array<vec3, 4> controls;
+        for (int i = 0; i < 4; i++)
+            controls[i] = vec3(instance * vec4(blade[i], 1.0f));
+        blades.push_back(controls);
+    }
+    spline_gpu* gpuGrass = new spline_gpu{
+        &shader_spline,
+        /* controls */
+        blades,
+        /* color */
         {0,0.4,0}
     };
 
@@ -273,8 +413,24 @@ int main() {
         /* instances */
         { translate(mat4(1.0f),{0,-1,0}) },
         /* color */
-        { 0.5, 0.5, 0.5 }
+        { 0.5, 0.5, 0.5 },
+        /* arena */
+        &geometryArena
     };
+    // the grass is drawn over the floor
+    cpuGrass->depthTest = false;
+    gpuGrass->depthTest = false;
+    scene_obj* spline_grass = gpuSplines ? static_cast<scene_obj*>(gpuGrass) : cpuGrass;
+
+    // the floor hides everything below it
+    floor.occluder = true;
+    // static, drawn from the shared buffers of the scene
+    floor.batched = true;
+    culling::occlusion_buffer occlusion;
+
+    scene objects;
+    objects.add(&floor);
+    objects.add(spline_grass);
 
 
 
@@ -284,30 +440,61 @@ int main() {
     camera.setPosition({ 0, 3, 3});
     camera.setPitch(-22.0f);
     while (!glfwWindowShouldClose(pWindowHandle)) {
-        glEnable(GL_DEPTH_TEST);
+        gl_state::reset_statistics();
+        gl_state::enable(GL_DEPTH_TEST);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glfwPollEvents();
+        watcher.update();
 
         // Process camera movement
         camera.processMovement(pWindowHandle);
 
         // Render the scene
+        lightsBuffer.update(uniform_blocks::lights(lights, camera.getFront()));
+        lightsBuffer.bind(uniform_blocks::LIGHTS_BINDING);
         shader.use();
-        shader.setLights(lights, material, camera.getFront());
-        shader.setUniform("mView", camera.getViewMatrix());
-        shader.setUniform("mProjection", camera.getProjectionMatrix());
-        floor.draw();
-        glDisable(GL_DEPTH_TEST);
-        spline_grass.draw();
+        shader.setUniform(shader.getCommonUniforms().view, camera.getViewMatrix());
+        shader.setUniform(shader.getCommonUniforms().projection, camera.getProjectionMatrix());
+        scene_obj* shownGrass = gpuSplines ? static_cast<scene_obj*>(gpuGrass) : cpuGrass;
+        if (shownGrass != spline_grass) {
+            objects.remove(spline_grass);
+            objects.add(shownGrass);
+            spline_grass = shownGrass;
+        }
+        if (gpuSplines) {
+            shader_spline.use();
+            shader_spline.setUniform(shader_spline.getCommonUniforms().view, camera.getViewMatrix());
+            shader_spline.setUniform(shader_spline.getCommonUniforms().projection, camera.getProjectionMatrix());
+        }
+        instanced_geometry_buffer* grass = dynamic_cast<instanced_geometry_buffer*>(spline_grass->gb);
+        if (grass) {
+            grass->setCulling(cullInstances);
+        }
+        cpuGrass->setLod(grassLod);
+        objects.setOcclusion(occlusionCulling ? &occlusion : nullptr);
+        objects.draw(camera.getViewProjectionMatrix(), camera.getPosition());
+        visibleInstances = grass ? grass->getVisibleCount() : totalInstances;
+        grassLodCounts = grass ? grass->getLodCounts() : vector<size_t>();
+        grassStreamStats = grass ? grass->getStreamStatistics() : stream_buffer::statistics();
+        renderStats = objects.getRenderQueue().getStatistics();
+        batchStats = objects.getBatchStatistics();
+        arenaStats = geometryArena.getStatistics();
+        glStats = gl_state::get_statistics();
+        programStats = programs.getStatistics();
+        reloadStats = watcher.getStatistics();
 
 
 
         showMenu();
+        // ImGui sets the state with direct OpenGL calls
+        gl_state::invalidate();
 
         glfwSwapBuffers(pWindowHandle);
     }
 
 
+    delete cpuGrass;
+    delete gpuGrass;
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
@@ -38,10 +38,15 @@ struct material_props {
 
 out vec4 FragOutColor;
 
-uniform light_props lights[MAX_LIGHTS];
-uniform int numLights;
-uniform material_props material;
-uniform vec3 viewPos;  
+// std140 blocks shared by every program, see uniform_blocks in _graphics.hpp
+layout(std140) uniform Lights {
+    light_props lights[MAX_LIGHTS];
+    int numLights;
+    vec3 viewPos;
+};
+layout(std140) uniform Material {
+    material_props material;
+};  
 uniform sampler2D textureSampler;
 
 vec3 ambient(light_props light) {
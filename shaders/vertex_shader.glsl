@@ -11,12 +11,25 @@ uniform mat4 mModel;
 uniform mat4 mView;
 uniform mat4 mProjection;
 
+// vertex_format::NORMAL_ENCODING_*, 1 = octahedral normals packed in vNormal.xy
+uniform int normalEncoding;
+
+vec3 decodeNormal(vec3 n) {
+    if (normalEncoding == 1) {
+        vec3 v = vec3(n.xy, 1.0f - abs(n.x) - abs(n.y));
+        float t = max(-v.z, 0.0f);
+        v.xy += vec2(v.x >= 0.0f ? -t : t, v.y >= 0.0f ? -t : t);
+        return normalize(v);
+    }
+    return n;
+}
+
 
 void main(void) {
     gl_Position = mProjection * mView *  mModel * vec4(vPos,1.0f);
     FragPos = vec3(mModel * vec4(vPos, 1.0f));
     FragColor = vColor;
-    FragNormal = transpose(inverse(mat3(mModel))) * vNormal;
+    FragNormal = transpose(inverse(mat3(mModel))) * decodeNormal(vNormal);
     gl_PointSize = 10.0f;
 
 }
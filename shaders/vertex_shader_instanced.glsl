@@ -13,11 +13,52 @@ uniform mat4 mModel;
 uniform mat4 mView;
 uniform mat4 mProjection;
 
+// vertex_format::INSTANCE_*, how the instance transformation is stored in the instanceTransform columns
+uniform int instanceFormat;
+
+mat4 instanceMatrix() {
+    if (instanceFormat == 0) {
+        return instanceTransform;
+    }
+    // compact formats: column 0 = (translation, scale), column 1 = yaw or rotation quaternion
+    vec3 t = instanceTransform[0].xyz;
+    float s = instanceFormat == 1 ? 1.0f : instanceTransform[0].w;
+    mat3 R = mat3(1.0f);
+    if (instanceFormat == 2) {
+        float c = cos(instanceTransform[1].x);
+        float sn = sin(instanceTransform[1].x);
+        R = mat3(c, 0.0f, -sn, 0.0f, 1.0f, 0.0f, sn, 0.0f, c);
+    }
+    else if (instanceFormat == 3) {
+        vec4 q = instanceTransform[1];
+        R = mat3(
+            1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.w * q.z), 2.0f * (q.x * q.z - q.w * q.y),
+            2.0f * (q.x * q.y - q.w * q.z), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.w * q.x),
+            2.0f * (q.x * q.z + q.w * q.y), 2.0f * (q.y * q.z - q.w * q.x), 1.0f - 2.0f * (q.x * q.x + q.y * q.y)
+        );
+    }
+    return mat4(vec4(s * R[0], 0.0f), vec4(s * R[1], 0.0f), vec4(s * R[2], 0.0f), vec4(t, 1.0f));
+}
+
+// vertex_format::NORMAL_ENCODING_*, 1 = octahedral normals packed in vNormal.xy
+uniform int normalEncoding;
+
+vec3 decodeNormal(vec3 n) {
+    if (normalEncoding == 1) {
+        vec3 v = vec3(n.xy, 1.0f - abs(n.x) - abs(n.y));
+        float t = max(-v.z, 0.0f);
+        v.xy += vec2(v.x >= 0.0f ? -t : t, v.y >= 0.0f ? -t : t);
+        return normalize(v);
+    }
+    return n;
+}
+
 
 void main(void) {
-    gl_Position = mProjection * mView * mModel * instanceTransform * vec4(vPos, 1.0f);
-    FragPos = vec3(mModel * instanceTransform * vec4(vPos, 1.0f));
+    mat4 instance = instanceMatrix();
+    gl_Position = mProjection * mView * mModel * instance * vec4(vPos, 1.0f);
+    FragPos = vec3(mModel * instance * vec4(vPos, 1.0f));
     FragColor = vColor;
-    FragNormal = transpose(inverse(mat3(mModel * instanceTransform))) * vNormal;
+    FragNormal = transpose(inverse(mat3(mModel * instance))) * decodeNormal(vNormal);
     gl_PointSize = 5.0f;
 }
@@ -0,0 +1,34 @@
+#version 330 core
+// per instance control points of a clamped cubic B-spline (knots 0 0 0 0 1 1 1 1)
+layout (location = 0) in vec3 cp0;
+layout (location = 1) in vec3 cp1;
+layout (location = 2) in vec3 cp2;
+layout (location = 3) in vec3 cp3;
+
+out vec3 FragColor;
+out vec3 FragNormal;
+out vec3 FragPos;
+
+uniform mat4 mModel;
+uniform mat4 mView;
+uniform mat4 mProjection;
+
+uniform int approxM;
+uniform vec3 splineColor;
+uniform vec3 splineNormal;
+
+
+void main(void) {
+    // same parameters as geometry::b_spline, u = i / approxM
+    float u = float(gl_VertexID) / float(approxM);
+    float s = 1.0f - u;
+    // on a single clamped span the cubic B-spline basis is the Bernstein basis
+    vec4 B = vec4(s * s * s, 3.0f * s * s * u, 3.0f * s * u * u, u * u * u);
+    vec3 vPos = B.x * cp0 + B.y * cp1 + B.z * cp2 + B.w * cp3;
+
+    gl_Position = mProjection * mView * mModel * vec4(vPos, 1.0f);
+    FragPos = vec3(mModel * vec4(vPos, 1.0f));
+    FragColor = splineColor;
+    FragNormal = transpose(inverse(mat3(mModel))) * splineNormal;
+    gl_PointSize = 5.0f;
+}
@@ -0,0 +1,201 @@
+#include "_buffer_arena.hpp"
+#include "_gl_state.hpp"
+#include <algorithm>
+
+const buffer_arena::handle buffer_arena::INVALID_HANDLE;
+const size_t buffer_arena::ALIGNMENT;
+
+static size_t align_size(size_t size) {
+    return std::max<size_t>(1, (size + buffer_arena::ALIGNMENT - 1) / buffer_arena::ALIGNMENT) * buffer_arena::ALIGNMENT;
+}
+
+buffer_arena::buffer_arena(size_t blockSize, GLenum usage) : blockSize(align_size(blockSize)), usage(usage) {}
+
+buffer_arena::~buffer_arena() {
+    for (block& b : blocks) {
+        gl_state::delete_buffers(1, &b.buffer);
+    }
+}
+
+size_t buffer_arena::addBlock(size_t capacity) {
+    block b;
+    glGenBuffers(1, &b.buffer);
+    b.capacity = capacity;
+    b.freeRanges[0] = capacity;
+    gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, b.buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, usage);
+    blocks.push_back(b);
+    return blocks.size() - 1;
+}
+
+bool buffer_arena::takeRange(size_t blockIndex, size_t size, size_t& offset) {
+    map<size_t, size_t>& ranges = blocks[blockIndex].freeRanges;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+        if (it->second < size) {
+            continue;
+        }
+        offset = it->first;
+        const size_t remaining = it->second - size;
+        ranges.erase(it);
+        if (remaining > 0) {
+            ranges[offset + size] = remaining;
+        }
+        return true;
+    }
+    return false;
+}
+
+buffer_arena::handle buffer_arena::allocate(size_t size) {
+    size = align_size(size);
+    allocation a;
+    a.size = size;
+    a.live = true;
+    bool found = false;
+    for (size_t b = 0; b < blocks.size() && !found; b++) {
+        if (takeRange(b, size, a.offset)) {
+            a.block = b;
+            found = true;
+        }
+    }
+    if (!found) {
+        a.block = addBlock(std::max(blockSize, size));
+        takeRange(a.block, size, a.offset);
+    }
+    if (!freeHandles.empty()) {
+        const handle h = freeHandles.back();
+        freeHandles.pop_back();
+        allocations[h] = a;
+        return h;
+    }
+    allocations.push_back(a);
+    return allocations.size() - 1;
+}
+
+void buffer_arena::free(handle h) {
+    if (h >= allocations.size() || !allocations[h].live) {
+        return;
+    }
+    allocation& a = allocations[h];
+    a.live = false;
+    freeHandles.push_back(h);
+    map<size_t, size_t>& ranges = blocks[a.block].freeRanges;
+    size_t offset = a.offset, size = a.size;
+    // merge with the free ranges just after and just before
+    auto next = ranges.lower_bound(offset);
+    if (next != ranges.end() && next->first == offset + size) {
+        size += next->second;
+        next = ranges.erase(next);
+    }
+    if (next != ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            ranges.erase(previous);
+        }
+    }
+    ranges[offset] = size;
+}
+
+buffer_arena::handle buffer_arena::reallocate(handle h, size_t size) {
+    if (h != INVALID_HANDLE && h < allocations.size() && allocations[h].live && allocations[h].size >= align_size(size)) {
+        return h;
+    }
+    free(h);
+    return allocate(size);
+}
+
+void buffer_arena::upload(handle h, const void* data, size_t size) {
+    const allocation& a = allocations[h];
+    gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, blocks[a.block].buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, a.offset, std::min(size, a.size), data);
+}
+
+GLuint buffer_arena::buffer(handle h) const {
+    return blocks[allocations[h].block].buffer;
+}
+
+size_t buffer_arena::offset(handle h) const {
+    return allocations[h].offset;
+}
+
+size_t buffer_arena::size(handle h) const {
+    return allocations[h].size;
+}
+
+bool buffer_arena::defragment() {
+    // live allocations in the order of their blocks and offsets
+    vector<handle> live;
+    size_t sharedUsed = 0, dedicatedBlocks = 0;
+    for (handle h = 0; h < allocations.size(); h++) {
+        if (!allocations[h].live) continue;
+        live.push_back(h);
+        if (allocations[h].size > blockSize) dedicatedBlocks++;
+        else sharedUsed += allocations[h].size;
+    }
+    bool packed = blocks.size() <= dedicatedBlocks + (sharedUsed + blockSize - 1) / blockSize;
+    for (const block& b : blocks) {
+        // packed blocks have at most one free range, at their end
+        packed = packed && (b.freeRanges.empty()
+            || (b.freeRanges.size() == 1 && b.freeRanges.begin()->first + b.freeRanges.begin()->second == b.capacity));
+    }
+    if (packed) {
+        return false;
+    }
+    sort(live.begin(), live.end(), [&](handle x, handle y) {
+        const allocation& a = allocations[x];
+        const allocation& b = allocations[y];
+        return a.block != b.block ? a.block < b.block : a.offset < b.offset;
+    });
+
+    // copy the ranges one after the other into new blocks, ranges of the same buffer must not overlap in
+    // glCopyBufferSubData so the old blocks are never written
+    vector<block> oldBlocks;
+    oldBlocks.swap(blocks);
+    size_t current = ~size_t(0), end = 0;
+    for (handle h : live) {
+        allocation& a = allocations[h];
+        if (current == ~size_t(0) || a.size > blocks[current].capacity - end) {
+            current = addBlock(std::max(blockSize, a.size));
+            end = 0;
+        }
+        gl_state::bind_buffer(GL_COPY_READ_BUFFER, oldBlocks[a.block].buffer);
+        gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, blocks[current].buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a.offset, end, a.size);
+        a.block = current;
+        a.offset = end;
+        end += a.size;
+        blocks[current].freeRanges.clear();
+        if (end < blocks[current].capacity) {
+            blocks[current].freeRanges[end] = blocks[current].capacity - end;
+        }
+    }
+    for (block& b : oldBlocks) {
+        gl_state::delete_buffers(1, &b.buffer);
+    }
+    generation++;
+    return true;
+}
+
+unsigned int buffer_arena::getGeneration() const {
+    return generation;
+}
+
+buffer_arena::statistics buffer_arena::getStatistics() const {
+    statistics stats;
+    stats.blocks = blocks.size();
+    for (const block& b : blocks) {
+        stats.capacity += b.capacity;
+        stats.freeRanges += b.freeRanges.size();
+        for (const auto& range : b.freeRanges) {
+            stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+        }
+    }
+    for (const allocation& a : allocations) {
+        if (a.live) {
+            stats.used += a.size;
+            stats.allocations++;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,113 @@
+#ifndef _BUFFER_ARENA
+#define _BUFFER_ARENA
+#include <cstddef>
+#include <map>
+#include <vector>
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
+using namespace std;
+
+/**
+ * @brief A few large GL buffers sub-allocated to many small vertex and index streams.
+ *
+ * Every block is one GL buffer of blockSize bytes with a free list of ranges sorted by offset: allocate() takes the
+ * lowest range that fits, free() gives the range back and merges it with its free neighbours. Streams larger than
+ * a block get a block of their own. Creating and destroying geometry then only updates the free lists, the driver
+ * sees a handful of buffer allocations.
+ *
+ * Allocations are referenced by handles, their buffer and offset change when defragment() packs the blocks, which
+ * increments the generation so that users can detect it and point their vertex arrays at the new ranges.
+ */
+class buffer_arena {
+public:
+    typedef size_t handle;
+    static const handle INVALID_HANDLE = ~size_t(0);
+    /**
+     * @brief Every allocation starts at a multiple of this, enough for the alignment of any vertex attribute.
+     */
+    static const size_t ALIGNMENT = 16;
+
+    struct statistics {
+        size_t blocks = 0;
+        size_t capacity = 0;        /**< Bytes of all blocks. */
+        size_t used = 0;            /**< Bytes of the live allocations, including alignment padding. */
+        size_t allocations = 0;
+        size_t freeRanges = 0;
+        size_t largestFreeRange = 0;
+    };
+
+    /**
+     * @param blockSize The size of the GL buffers, in bytes.
+     * @param usage The usage hint of the GL buffers.
+     */
+    buffer_arena(size_t blockSize = 4 << 20, GLenum usage = GL_STATIC_DRAW);
+    ~buffer_arena();
+
+    /**
+     * @brief Reserves a range of at least size bytes.
+     */
+    handle allocate(size_t size);
+    /**
+     * @brief Gives a range back to the arena, the handle may be returned by a later allocate().
+     */
+    void free(handle h);
+    /**
+     * @brief Returns a range of at least size bytes: the range of h if it is large enough, otherwise h is freed and a new range returned.
+     */
+    handle reallocate(handle h, size_t size);
+    /**
+     * @brief Writes data at the start of a range.
+     */
+    void upload(handle h, const void* data, size_t size);
+
+    GLuint buffer(handle h) const;
+    size_t offset(handle h) const;
+    size_t size(handle h) const;
+
+    /**
+     * @brief Packs the live ranges into as few blocks as possible if the free space is fragmented.
+     *
+     * The ranges are copied in order with glCopyBufferSubData into new GL buffers, the old ones are deleted.
+     * Blocks left empty by free() are only released here.
+     *
+     * @return Whether the ranges moved, the generation is then incremented.
+     */
+    bool defragment();
+    /**
+     * @brief Returns a counter incremented every time ranges move.
+     */
+    unsigned int getGeneration() const;
+    statistics getStatistics() const;
+
+private:
+    struct block {
+        GLuint buffer;
+        size_t capacity;
+        map<size_t, size_t> freeRanges;     /**< Free ranges as offset -> size, never adjacent. */
+    };
+    struct allocation {
+        size_t block;
+        size_t offset;
+        size_t size;
+        bool live;
+    };
+
+    size_t blockSize;
+    GLenum usage;
+    vector<block> blocks;
+    vector<allocation> allocations;
+    vector<handle> freeHandles;
+    unsigned int generation = 0;
+
+    size_t addBlock(size_t capacity);
+    /**
+     * @brief Takes size bytes from the lowest free range of a block that fits them.
+     */
+    bool takeRange(size_t blockIndex, size_t size, size_t& offset);
+};
+
+#endif
@@ -14,6 +14,7 @@ Camera::Camera(
 
 mat4 Camera::getProjectionMatrix() { return  perspective(radians(FOV), aspect, near, far); }
 mat4 Camera::getViewMatrix() { return lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp); }
+mat4 Camera::getViewProjectionMatrix() { return getProjectionMatrix() * getViewMatrix(); }
 
 void Camera::setPosition(vec3 position) { this->cameraPosition = position; }
 void Camera::setFront(vec3 front) { this->cameraFront = front; }
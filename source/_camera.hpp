@@ -22,6 +22,10 @@ public:
 
     mat4 getProjectionMatrix();
     mat4 getViewMatrix();
+    /**
+     * @brief Returns the combined projection * view matrix, taking world space points to clip space.
+     */
+    mat4 getViewProjectionMatrix();
 
     void setPosition(vec3 position);
     void setFront(vec3 front);
@@ -0,0 +1,188 @@
+#include "_culling.hpp"
+#include "_parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace culling {
+
+    frustum frustum::from_matrix(const mat4& clipFromSpace) {
+        // rows of the matrix, glm is column major
+        vec4 row[4];
+        for (int i = 0; i < 4; i++) {
+            row[i] = vec4(clipFromSpace[0][i], clipFromSpace[1][i], clipFromSpace[2][i], clipFromSpace[3][i]);
+        }
+        // -w <= x, y, z <= w
+        frustum f;
+        f.planes[0] = row[3] + row[0];
+        f.planes[1] = row[3] - row[0];
+        f.planes[2] = row[3] + row[1];
+        f.planes[3] = row[3] - row[1];
+        f.planes[4] = row[3] + row[2];
+        f.planes[5] = row[3] - row[2];
+        for (vec4& plane : f.planes) {
+            const float norm = length(vec3(plane));
+            if (norm > 0.0f) plane = plane / norm;
+        }
+        return f;
+    }
+
+    frustum::result frustum::test(const vec3& center, const vec3& extent) const {
+        result r = INSIDE;
+        for (const vec4& plane : planes) {
+            const float distance = dot(vec3(plane), center) + plane.w;
+            const float radius = dot(abs(vec3(plane)), extent);
+            if (distance + radius < 0.0f) {
+                return OUTSIDE;
+            }
+            if (distance - radius < 0.0f) {
+                r = INTERSECTS;
+            }
+        }
+        return r;
+    }
+
+    static uint32_t spread_bits(uint32_t x) {
+        // 10 bits to every third bit
+        x &= 0x3FF;
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x << 8)) & 0x0300F00F;
+        x = (x | (x << 4)) & 0x030C30C3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
+    void instance_set::build(const vector<mat4>& transforms, const vec3& localMin, const vec3& localMax) {
+        const size_t n = transforms.size();
+        const vec3 localCenter = 0.5f * (localMax + localMin);
+        const vec3 localExtent = 0.5f * (localMax - localMin);
+
+        // transformed box: center moves with the matrix, the extent grows with the absolute values of the basis
+        vector<vec3> centers(n), extents(n);
+        vec3 lo(INFINITY), hi(-INFINITY);
+        for (size_t i = 0; i < n; i++) {
+            const mat4& m = transforms[i];
+            centers[i] = vec3(m * vec4(localCenter, 1.0f));
+            extents[i] = abs(vec3(m[0])) * localExtent.x + abs(vec3(m[1])) * localExtent.y + abs(vec3(m[2])) * localExtent.z;
+            lo = min(lo, centers[i]);
+            hi = max(hi, centers[i]);
+        }
+
+        // sort along a Morton curve so that the chunks are spatially compact
+        const vec3 range = max(hi - lo, vec3(1e-6f));
+        vector<pair<uint32_t, unsigned int>> keys(n);
+        for (size_t i = 0; i < n; i++) {
+            const vec3 cell = (centers[i] - lo) / range * 1023.0f;
+            keys[i] = { spread_bits(static_cast<uint32_t>(cell.x)) | (spread_bits(static_cast<uint32_t>(cell.y)) << 1) | (spread_bits(static_cast<uint32_t>(cell.z)) << 2),
+                static_cast<unsigned int>(i) };
+        }
+        sort(keys.begin(), keys.end());
+
+        order.resize(n);
+        centerX.resize(n); centerY.resize(n); centerZ.resize(n);
+        extentX.resize(n); extentY.resize(n); extentZ.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            const unsigned int instance = keys[i].second;
+            order[i] = instance;
+            centerX[i] = centers[instance].x; centerY[i] = centers[instance].y; centerZ[i] = centers[instance].z;
+            extentX[i] = extents[instance].x; extentY[i] = extents[instance].y; extentZ[i] = extents[instance].z;
+        }
+
+        const size_t chunks = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        chunkCenter.resize(chunks);
+        chunkExtent.resize(chunks);
+        for (size_t c = 0; c < chunks; c++) {
+            vec3 chunkMin(INFINITY), chunkMax(-INFINITY);
+            for (size_t i = c * CHUNK_SIZE; i < std::min(n, (c + 1) * CHUNK_SIZE); i++) {
+                const vec3 center(centerX[i], centerY[i], centerZ[i]);
+                const vec3 extent(extentX[i], extentY[i], extentZ[i]);
+                chunkMin = min(chunkMin, center - extent);
+                chunkMax = max(chunkMax, center + extent);
+            }
+            chunkCenter[c] = 0.5f * (chunkMax + chunkMin);
+            chunkExtent[c] = 0.5f * (chunkMax - chunkMin);
+        }
+    }
+
+    size_t instance_set::size() const {
+        return order.size();
+    }
+
+    size_t instance_set::cull(const frustum& f, vector<unsigned int>& visible, const occlusion_test& occluded) const {
+        const size_t n = order.size();
+        const int chunks = static_cast<int>(chunkCenter.size());
+        // every chunk writes its visible instances to its own slots, compacted afterwards
+        visible.resize(n);
+        vector<unsigned int> counts(chunks);
+
+        parallel_for(0, chunks, [&](int chunkBegin, int chunkEnd) {
+#if defined(__SSE2__)
+            __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+            for (int p = 0; p < 6; p++) {
+                const vec4& plane = f.planes[p];
+                nx[p] = _mm_set1_ps(plane.x); ny[p] = _mm_set1_ps(plane.y); nz[p] = _mm_set1_ps(plane.z); nw[p] = _mm_set1_ps(plane.w);
+                ax[p] = _mm_set1_ps(fabsf(plane.x)); ay[p] = _mm_set1_ps(fabsf(plane.y)); az[p] = _mm_set1_ps(fabsf(plane.z));
+            }
+            const __m128 zero = _mm_setzero_ps();
+#endif
+            for (int c = chunkBegin; c < chunkEnd; c++) {
+                const size_t begin = static_cast<size_t>(c) * CHUNK_SIZE;
+                const size_t end = std::min(n, begin + CHUNK_SIZE);
+                unsigned int* out = visible.data() + begin;
+                unsigned int count = 0;
+
+                const frustum::result chunkResult = f.test(chunkCenter[c], chunkExtent[c]);
+                if (chunkResult == frustum::OUTSIDE
+                    || (occluded && occluded(chunkCenter[c] - chunkExtent[c], chunkCenter[c] + chunkExtent[c]))) {
+                    counts[c] = 0;
+                    continue;
+                }
+                if (chunkResult == frustum::INSIDE) {
+                    std::copy(order.begin() + begin, order.begin() + end, out);
+                    counts[c] = static_cast<unsigned int>(end - begin);
+                    continue;
+                }
+
+                size_t i = begin;
+#if defined(__SSE2__)
+                for (; i + 4 <= end; i += 4) {
+                    const __m128 x = _mm_loadu_ps(&centerX[i]), y = _mm_loadu_ps(&centerY[i]), z = _mm_loadu_ps(&centerZ[i]);
+                    const __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+                    __m128 outside = zero;
+                    for (int p = 0; p < 6; p++) {
+                        const __m128 distance = _mm_add_ps(
+                            _mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)),
+                            _mm_add_ps(_mm_mul_ps(nz[p], z), nw[p]));
+                        const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+                        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+                    }
+                    const int inside = ~_mm_movemask_ps(outside) & 0xF;
+                    for (int k = 0; k < 4; k++) {
+                        if (inside & (1 << k)) out[count++] = order[i + k];
+                    }
+                }
+#endif
+                for (; i < end; i++) {
+                    const vec3 center(centerX[i], centerY[i], centerZ[i]);
+                    const vec3 extent(extentX[i], extentY[i], extentZ[i]);
+                    if (f.test(center, extent) != frustum::OUTSIDE) out[count++] = order[i];
+                }
+                counts[c] = count;
+            }
+        }, 16);
+
+        size_t total = 0;
+        for (int c = 0; c < chunks; c++) {
+            const size_t begin = static_cast<size_t>(c) * CHUNK_SIZE;
+            if (total != begin) {
+                std::copy(visible.begin() + begin, visible.begin() + begin + counts[c], visible.begin() + total);
+            }
+            total += counts[c];
+        }
+        visible.resize(total);
+        return total;
+    }
+}
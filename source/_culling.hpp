@@ -0,0 +1,86 @@
+#ifndef _CULLING
+#define _CULLING
+#include <vector>
+#include <functional>
+#include <glm/glm.hpp>
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief Visibility tests of axis aligned boxes against a view frustum.
+ *
+ * The boxes and the frustum only have to be in the same space: instanced geometry keeps its instance boxes in
+ * object space and builds the frustum from projection * view * model, so the boxes never need to be moved
+ * when the object moves.
+ */
+namespace culling {
+
+    /**
+     * @brief The 6 planes of a view frustum, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for every plane.
+     */
+    struct frustum {
+        enum result { OUTSIDE, INTERSECTS, INSIDE };
+
+        vec4 planes[6];
+
+        /**
+         * @brief Extracts the frustum planes of a clip space matrix.
+         *
+         * @param clipFromSpace Matrix taking points of the space of the tested boxes to clip space, e.g. projection * view * model.
+         */
+        static frustum from_matrix(const mat4& clipFromSpace);
+
+        /**
+         * @brief Classifies a box given by its center and half extent.
+         */
+        result test(const vec3& center, const vec3& extent) const;
+    };
+
+    /**
+     * @brief Optional occlusion test of a box given by its minimum and maximum, returns true if the box is hidden.
+     */
+    typedef function<bool(const vec3& min, const vec3& max)> occlusion_test;
+
+    /**
+     * @brief The bounding boxes of a set of instances, arranged for hierarchical culling.
+     *
+     * The boxes are sorted along a Morton curve of their centers and grouped in chunks of CHUNK_SIZE boxes.
+     * Chunks outside the frustum are skipped and chunks completely inside are accepted without looking at
+     * their boxes, only the boxes of the chunks on the frustum boundary are tested, 4 at a time with SSE.
+     */
+    class instance_set {
+    public:
+        static const int CHUNK_SIZE = 64;
+
+        /**
+         * @brief Computes the bounding box of every transformed instance of a local box.
+         *
+         * @param transforms The instance transformations.
+         * @param localMin Minimum of the box of the instanced geometry.
+         * @param localMax Maximum of the box of the instanced geometry.
+         */
+        void build(const vector<mat4>& transforms, const vec3& localMin, const vec3& localMax);
+
+        /**
+         * @brief Collects the instances intersecting the frustum, on multiple threads.
+         *
+         * @param f The frustum, in the space of the instance boxes.
+         * @param visible Receives the indices of the visible instances into the transforms given to build(), in the
+         * Morton order of their boxes rather than in the order of the transforms, which keeps neighbours together.
+         * @param occluded Optional occlusion test applied to the chunks intersecting the frustum.
+         * @return The number of visible instances.
+         */
+        size_t cull(const frustum& f, vector<unsigned int>& visible, const occlusion_test& occluded = nullptr) const;
+
+        size_t size() const;
+
+    private:
+        // boxes as center / half extent in structure of arrays, in Morton order
+        vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+        // index of the instance of every box
+        vector<unsigned int> order;
+        vector<vec3> chunkCenter, chunkExtent;
+    };
+}
+
+#endif
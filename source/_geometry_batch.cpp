@@ -0,0 +1,202 @@
+#include "_geometry_batch.hpp"
+#include <algorithm>
+
+vertex_format::vertex_layout geometry_batch::default_layout() {
+    vertex_format::vertex_layout layout = vertex_format::vertex_layout::packed();
+    layout.position = vertex_format::POSITION_FLOAT;
+    return layout;
+}
+
+geometry_batch::geometry_batch(const vertex_format::vertex_layout& layout) {
+    buffer.sp = nullptr;
+    buffer.setVertexLayout(layout);
+    firstRange.push_back(0);
+}
+
+bool geometry_batch::is_strip(GLenum drawMode) {
+    return drawMode == GL_LINE_STRIP || drawMode == GL_LINE_LOOP || drawMode == GL_TRIANGLE_STRIP || drawMode == GL_TRIANGLE_FAN;
+}
+
+bool geometry_batch::accepts(const scene_obj* obj) {
+    // spline buffers evaluate their vertices in the shader and textured buffers need their own texture
+    return obj->gb && obj->gb->sp
+        && !dynamic_cast<const spline_geometry_buffer*>(obj->gb)
+        && !obj->getTexture();
+}
+
+bool geometry_batch::compatible(const scene_obj* obj) const {
+    if (!accepts(obj)) {
+        return false;
+    }
+    if (objects.empty()) {
+        return true;
+    }
+    scene_obj* first = objects.front();
+    const material_props& a = first->getMaterialProperties();
+    const material_props& b = obj->getMaterialProperties();
+    return first->gb->sp == obj->gb->sp
+        && first->depthTest == obj->depthTest
+        && a.ambientStrength == b.ambientStrength
+        && a.diffuseStrength == b.diffuseStrength
+        && a.specularStrength == b.specularStrength;
+}
+
+size_t geometry_batch::add(scene_obj* obj) {
+    if (!compatible(obj)) {
+        throw std::invalid_argument("The object cannot share the geometry batch.");
+    }
+    geometry_buffer* gb = obj->gb;
+    vector<mat4> models { obj->getModel() };
+    if (instanced_geometry_buffer* igb = dynamic_cast<instanced_geometry_buffer*>(gb)) {
+        models.clear();
+        for (const mat4& instance : igb->getTransformations()) {
+            models.push_back(obj->getModel() * instance);
+        }
+    }
+
+    // the indices of lists are shared by every copy of the vertices
+    const size_t indexStart = buffer.indices.size();
+    if (any_of(gb->drawPatterns.begin(), gb->drawPatterns.end(), [](const DrawPattern& p) { return !is_strip(p.drawMode); })) {
+        buffer.indices.insert(buffer.indices.end(), gb->indices.begin(), gb->indices.end());
+        buffer.primitiveRestart = buffer.primitiveRestart || gb->primitiveRestart;
+    }
+
+    const size_t vertexCount = gb->vertices.size();
+    const GLint firstVertex = static_cast<GLint>(buffer.vertices.size());
+    // the strips of every copy are rebased on the first copy, to be joined into one run per draw mode
+    vector<pair<GLenum, vector<vector<unsigned int>>>> strips;
+    for (const mat4& model : models) {
+        const GLint baseVertex = static_cast<GLint>(buffer.vertices.size());
+        const mat3 normalMatrix = transpose(inverse(mat3(model)));
+        for (size_t i = 0; i < vertexCount; i++) {
+            buffer.vertices.push_back(vec3(model * vec4(gb->vertices[i], 1.0f)));
+            buffer.colors.push_back(i < gb->colors.size() ? gb->colors[i] : vec3(0.0f));
+            buffer.normals.push_back(i < gb->normals.size() ? normalize(normalMatrix * gb->normals[i]) : vec3(0.0f));
+        }
+        for (const DrawPattern& pattern : gb->drawPatterns) {
+            if (!is_strip(pattern.drawMode)) {
+                ranges.push_back({ pattern.drawMode, indexStart + pattern.start, static_cast<GLsizei>(pattern.count), baseVertex });
+                continue;
+            }
+            auto joined = std::find_if(strips.begin(), strips.end(), [&](const pair<GLenum, vector<vector<unsigned int>>>& s) { return s.first == pattern.drawMode; });
+            if (joined == strips.end()) {
+                strips.push_back({ pattern.drawMode, {} });
+                joined = strips.end() - 1;
+            }
+            vector<unsigned int> strip(gb->indices.begin() + pattern.start, gb->indices.begin() + pattern.start + pattern.count);
+            for (unsigned int& index : strip) {
+                if (index != mesh_optimizer::RESTART_INDEX) index += baseVertex - firstVertex;
+            }
+            joined->second.push_back(strip);
+        }
+    }
+    for (auto& joined : strips) {
+        const vector<unsigned int> indices = mesh_optimizer::join_strips(joined.second);
+        ranges.push_back({ joined.first, buffer.indices.size(), static_cast<GLsizei>(indices.size()), firstVertex });
+        buffer.indices.insert(buffer.indices.end(), indices.begin(), indices.end());
+        buffer.primitiveRestart = true;
+    }
+    objects.push_back(obj);
+    firstRange.push_back(ranges.size());
+    return objects.size() - 1;
+}
+
+void geometry_batch::upload() {
+    if (objects.empty()) {
+        return;
+    }
+    buffer.sp = objects.front()->gb->sp;
+    buffer.bindVertexArray();
+    buffer.updateBuffers();
+}
+
+void geometry_batch::draw() {
+    vector<size_t> slots(objects.size());
+    for (size_t slot = 0; slot < slots.size(); slot++) {
+        slots[slot] = slot;
+    }
+    draw(slots);
+}
+
+void geometry_batch::submit(size_t slot) {
+    const size_t indexSize = buffer.indexSize();
+    for (size_t r = firstRange[slot]; r < firstRange[slot + 1]; r++) {
+        const range& pattern = ranges[r];
+        auto call = std::find_if(calls.begin(), calls.end(), [&](const multi_draw& c) { return c.drawMode == pattern.drawMode; });
+        if (call == calls.end()) {
+            calls.push_back(multi_draw());
+            call = calls.end() - 1;
+            call->drawMode = pattern.drawMode;
+        }
+        call->counts.push_back(pattern.count);
+        call->offsets.push_back((const void*)(pattern.start * indexSize));
+        call->baseVertices.push_back(pattern.baseVertex);
+        stats.patterns++;
+    }
+}
+
+void geometry_batch::draw(const vector<size_t>& slots) {
+    stats = statistics();
+    for (multi_draw& call : calls) {
+        call.counts.clear();
+        call.offsets.clear();
+        call.baseVertices.clear();
+    }
+    for (size_t slot : slots) {
+        if (slot < objects.size()) {
+            submit(slot);
+            stats.objects++;
+        }
+    }
+    if (stats.patterns == 0) {
+        return;
+    }
+
+    const scene_obj* first = objects.front();
+    if (first->depthTest) {
+        gl_state::enable(GL_DEPTH_TEST);
+    }
+    else {
+        gl_state::disable(GL_DEPTH_TEST);
+    }
+    shader_program* sp = buffer.sp;
+    sp->use();
+    first->applyMaterial();
+    const shader_program::common_uniforms& uniforms = sp->getCommonUniforms();
+    sp->setUniform(uniforms.model, mat4(1.0f));
+    sp->setUniform(uniforms.normalEncoding, buffer.layout.normalEncoding());
+    // the vertices are in world space, instanced shaders read an identity transform from the disabled instance attribute
+    const GLint instanceLocation = sp->getAttributeLayout().instanceTransform;
+    if (instanceLocation >= 0) {
+        sp->setUniform(uniforms.instanceFormat, static_cast<int>(vertex_format::INSTANCE_MAT4));
+        for (int column = 0; column < 4; column++) {
+            const vec4 identity = mat4(1.0f)[column];
+            glVertexAttrib4f(instanceLocation + column, identity.x, identity.y, identity.z, identity.w);
+        }
+    }
+
+    buffer.bindVertexArray();
+    buffer.checkAttributes();
+    buffer.applyPrimitiveRestart(true);
+    for (const multi_draw& call : calls) {
+        if (call.counts.empty()) {
+            continue;
+        }
+        glMultiDrawElementsBaseVertex(call.drawMode, call.counts.data(), buffer.indexType,
+            call.offsets.data(), static_cast<GLsizei>(call.counts.size()), call.baseVertices.data());
+        stats.draws++;
+    }
+    buffer.applyPrimitiveRestart(false);
+}
+
+size_t geometry_batch::size() const {
+    return objects.size();
+}
+
+scene_obj* geometry_batch::front() const {
+    return objects.empty() ? nullptr : objects.front();
+}
+
+const geometry_batch::statistics& geometry_batch::getStatistics() const {
+    return stats;
+}
@@ -0,0 +1,110 @@
+#ifndef _GEOMETRY_BATCH
+#define _GEOMETRY_BATCH
+#include "_graphics.hpp"
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief The geometry of many static objects in shared vertex and index buffers, drawn with one call per primitive type.
+ *
+ * Every added object copies its vertices, transformed to world space, after the previous ones in a single vertex
+ * buffer, and its indices unchanged after the previous ones in a single index buffer. Instanced geometry adds one
+ * copy of its vertices per instance but its indices only once. The draw patterns of the objects keep their local
+ * indices and are drawn with the first vertex of their copy as base vertex, so a draw() of any subset of the objects
+ * is a single glMultiDrawElementsBaseVertex per primitive type instead of one glDrawElements per pattern.
+ * The strips of an object, of all its instances, are joined with restart indices into a single pattern per
+ * primitive type, so a field of line strips is not submitted one strip at a time.
+ *
+ * OpenGL 3.3 has no draw index to pick a model matrix per pattern in the shader, which is why the transforms are
+ * baked into the vertices: the objects must not move after they were added, build a new batch when they do.
+ * All objects share the program, material and depth test of the first one.
+ */
+class geometry_batch {
+public:
+    /**
+     * @brief The work done by the last draw().
+     */
+    struct statistics {
+        size_t objects = 0;     /**< Objects drawn. */
+        size_t patterns = 0;    /**< Draw patterns submitted. */
+        size_t draws = 0;       /**< Multi draw calls issued. */
+    };
+
+    /**
+     * @param layout The storage format of the shared vertex buffer, interleaved float positions with packed colors
+     * and normals by default: the positions are in world space where half floats lose too much precision.
+     */
+    geometry_batch(const vertex_format::vertex_layout& layout = default_layout());
+
+    /**
+     * @brief Returns whether an object can be added: its geometry must store its positions as vertices and have no texture.
+     */
+    static bool accepts(const scene_obj* obj);
+    /**
+     * @brief Returns whether an object can share the batch with the objects already added.
+     */
+    bool compatible(const scene_obj* obj) const;
+    /**
+     * @brief Copies the geometry of an object at its current model matrix, visible after the next upload().
+     *
+     * @return The slot of the object, used to select it in draw().
+     */
+    size_t add(scene_obj* obj);
+    /**
+     * @brief Uploads the shared buffers.
+     */
+    void upload();
+    /**
+     * @brief Draws every object of the batch.
+     */
+    void draw();
+    /**
+     * @brief Draws some objects of the batch, the shader program must already have the view and projection of the frame.
+     *
+     * @param slots The slots returned by add() of the objects to draw.
+     */
+    void draw(const vector<size_t>& slots);
+
+    size_t size() const;
+    /**
+     * @brief Returns the first object added, whose program, material and depth test are used by the batch.
+     */
+    scene_obj* front() const;
+    const statistics& getStatistics() const;
+
+    static vertex_format::vertex_layout default_layout();
+
+private:
+    /**
+     * @brief A draw pattern of one object, or of one instance of instanced geometry.
+     */
+    struct range {
+        GLenum drawMode;
+        size_t start;       /**< First index in the shared index buffer. */
+        GLsizei count;
+        GLint baseVertex;   /**< First vertex of the copy in the shared vertex buffer. */
+    };
+
+    geometry_buffer buffer;
+    vector<scene_obj*> objects;
+    vector<size_t> firstRange;  /**< First range of every slot, followed by the first range of the next slot. */
+    vector<range> ranges;
+    statistics stats;
+
+    // the arguments of one glMultiDrawElementsBaseVertex, reused between frames
+    struct multi_draw {
+        GLenum drawMode;
+        vector<GLsizei> counts;
+        vector<const void*> offsets;
+        vector<GLint> baseVertices;
+    };
+    vector<multi_draw> calls;
+
+    void submit(size_t slot);
+    /**
+     * @brief Returns whether primitives of a draw mode can be joined with primitive restart.
+     */
+    static bool is_strip(GLenum drawMode);
+};
+
+#endif
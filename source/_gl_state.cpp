@@ -0,0 +1,252 @@
+#include "_gl_state.hpp"
+#include <unordered_map>
+
+namespace gl_state {
+
+    // value of a state that was never set through this layer
+    static const GLuint UNKNOWN = ~0u;
+    static const int TEXTURE_UNITS = 32;
+    static const int TEXTURE_TARGETS = 3;
+
+    static statistics stats;
+    static GLuint vertexArray = UNKNOWN;
+    static GLuint program = UNKNOWN;
+    static std::unordered_map<GLenum, GLuint> buffers;
+    static std::unordered_map<GLuint, GLuint> elementBuffers;   // element array buffer of every vertex array
+    static std::unordered_map<GLuint, GLuint> uniformBuffers;   // uniform buffer of every binding point
+    static GLenum activeUnit = UNKNOWN;
+    static GLuint textures[TEXTURE_UNITS][TEXTURE_TARGETS];
+    static bool texturesKnown = false;
+    static std::unordered_map<GLenum, bool> capabilities;
+    static GLenum blendSource = UNKNOWN, blendDestination = UNKNOWN;
+    static GLenum depthFunction = UNKNOWN;
+    static int depthWrite = -1;
+    static GLenum culledFace = UNKNOWN;
+
+    /**
+     * @brief Counts a call and returns true if it has to reach the driver, remembering the new value.
+     */
+    template <typename T>
+    static bool changes(T& current, T value) {
+        stats.calls++;
+        if (current == value) {
+            stats.elided++;
+            return false;
+        }
+        current = value;
+        return true;
+    }
+
+    static int target_index(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_CUBE_MAP: return 1;
+        case GL_TEXTURE_3D: return 2;
+        default: return -1;
+        }
+    }
+
+    static void forget_textures() {
+        for (auto& unit : textures) {
+            for (GLuint& texture : unit) texture = UNKNOWN;
+        }
+        texturesKnown = true;
+    }
+
+    void bind_vertex_array(GLuint vertexArrayName) {
+        if (changes(vertexArray, vertexArrayName)) {
+            glBindVertexArray(vertexArrayName);
+        }
+    }
+
+    void use_program(GLuint programName) {
+        if (changes(program, programName)) {
+            glUseProgram(programName);
+        }
+    }
+
+    void bind_buffer(GLenum target, GLuint buffer) {
+        if (target == GL_ELEMENT_ARRAY_BUFFER) {
+            if (vertexArray == UNKNOWN) {
+                // the vertex array holding the binding is unknown, nothing to compare to
+                stats.calls++;
+                glBindBuffer(target, buffer);
+                return;
+            }
+            auto it = elementBuffers.find(vertexArray);
+            GLuint& current = it != elementBuffers.end() ? it->second : (elementBuffers[vertexArray] = UNKNOWN);
+            if (changes(current, buffer)) {
+                glBindBuffer(target, buffer);
+            }
+            return;
+        }
+        auto it = buffers.find(target);
+        GLuint& current = it != buffers.end() ? it->second : (buffers[target] = UNKNOWN);
+        if (changes(current, buffer)) {
+            glBindBuffer(target, buffer);
+        }
+    }
+
+    void bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+        if (target != GL_UNIFORM_BUFFER) {
+            stats.calls++;
+            glBindBufferBase(target, index, buffer);
+            buffers[target] = buffer;
+            return;
+        }
+        auto it = uniformBuffers.find(index);
+        GLuint& current = it != uniformBuffers.end() ? it->second : (uniformBuffers[index] = UNKNOWN);
+        if (changes(current, buffer)) {
+            glBindBufferBase(target, index, buffer);
+            buffers[target] = buffer;
+        }
+    }
+
+    void active_texture(GLenum unit) {
+        if (changes(activeUnit, unit)) {
+            glActiveTexture(unit);
+        }
+    }
+
+    void bind_texture(GLenum target, GLuint texture) {
+        const int unit = activeUnit == UNKNOWN ? -1 : static_cast<int>(activeUnit - GL_TEXTURE0);
+        const int index = target_index(target);
+        if (unit < 0 || unit >= TEXTURE_UNITS || index < 0) {
+            stats.calls++;
+            glBindTexture(target, texture);
+            return;
+        }
+        if (!texturesKnown) {
+            forget_textures();
+        }
+        if (changes(textures[unit][index], texture)) {
+            glBindTexture(target, texture);
+        }
+    }
+
+    void bind_texture(GLenum unit, GLenum target, GLuint texture) {
+        active_texture(unit);
+        bind_texture(target, texture);
+    }
+
+    void set_enabled(GLenum capability, bool enabled) {
+        auto it = capabilities.find(capability);
+        if (it != capabilities.end()) {
+            if (!changes(it->second, enabled)) {
+                return;
+            }
+        }
+        else {
+            stats.calls++;
+            capabilities[capability] = enabled;
+        }
+        if (enabled) {
+            glEnable(capability);
+        }
+        else {
+            glDisable(capability);
+        }
+    }
+
+    void enable(GLenum capability) {
+        set_enabled(capability, true);
+    }
+
+    void disable(GLenum capability) {
+        set_enabled(capability, false);
+    }
+
+    void blend_func(GLenum source, GLenum destination) {
+        stats.calls++;
+        if (blendSource == source && blendDestination == destination) {
+            stats.elided++;
+            return;
+        }
+        blendSource = source;
+        blendDestination = destination;
+        glBlendFunc(source, destination);
+    }
+
+    void depth_func(GLenum function) {
+        if (changes(depthFunction, function)) {
+            glDepthFunc(function);
+        }
+    }
+
+    void depth_mask(bool write) {
+        if (changes(depthWrite, static_cast<int>(write))) {
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+        }
+    }
+
+    void cull_face(GLenum face) {
+        if (changes(culledFace, face)) {
+            glCullFace(face);
+        }
+    }
+
+    void delete_vertex_arrays(GLsizei count, const GLuint* vertexArrays) {
+        for (GLsizei i = 0; i < count; i++) {
+            // deleting the bound vertex array binds 0
+            if (vertexArray == vertexArrays[i]) vertexArray = 0;
+            elementBuffers.erase(vertexArrays[i]);
+        }
+        glDeleteVertexArrays(count, vertexArrays);
+    }
+
+    void delete_buffers(GLsizei count, const GLuint* deleted) {
+        for (GLsizei i = 0; i < count; i++) {
+            // deleted buffers are unbound from the context, a vertex array that is not bound keeps referencing
+            // the old buffer, forget it since a new buffer may reuse the name
+            for (auto& binding : buffers) {
+                if (binding.second == deleted[i]) binding.second = 0;
+            }
+            for (auto& binding : elementBuffers) {
+                if (binding.second == deleted[i]) binding.second = binding.first == vertexArray ? 0 : UNKNOWN;
+            }
+            for (auto& binding : uniformBuffers) {
+                if (binding.second == deleted[i]) binding.second = 0;
+            }
+        }
+        glDeleteBuffers(count, deleted);
+    }
+
+    void delete_textures(GLsizei count, const GLuint* deleted) {
+        for (GLsizei i = 0; i < count; i++) {
+            for (auto& unit : textures) {
+                for (GLuint& texture : unit) {
+                    if (texture == deleted[i]) texture = 0;
+                }
+            }
+        }
+        glDeleteTextures(count, deleted);
+    }
+
+    void delete_program(GLuint programName) {
+        // a program in use is only deleted once it is not current any more, its name stays valid until then
+        glDeleteProgram(programName);
+    }
+
+    void invalidate() {
+        vertexArray = UNKNOWN;
+        program = UNKNOWN;
+        buffers.clear();
+        elementBuffers.clear();
+        uniformBuffers.clear();
+        activeUnit = UNKNOWN;
+        texturesKnown = false;
+        capabilities.clear();
+        blendSource = blendDestination = UNKNOWN;
+        depthFunction = UNKNOWN;
+        depthWrite = -1;
+        culledFace = UNKNOWN;
+    }
+
+    const statistics& get_statistics() {
+        return stats;
+    }
+
+    void reset_statistics() {
+        stats = statistics();
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef _GL_STATE
+#define _GL_STATE
+#include <cstddef>
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
+
+/**
+ * @brief A shadow of the OpenGL state of the current context that skips the calls setting a state it already has.
+ *
+ * Every binding, enable and fixed function setting made through these functions is remembered, a call setting
+ * the remembered value again is elided and counted. The element array buffer is remembered per vertex array since
+ * it is part of the vertex array state. A value is unknown until it is set once, so the first call always reaches
+ * the driver.
+ *
+ * State changed by direct OpenGL calls is not seen: call invalidate() after code that bypasses this layer, and
+ * delete objects through the delete functions below, which forget the bindings of the deleted names so that the
+ * names can safely be reused.
+ */
+namespace gl_state {
+
+    /**
+     * @brief The number of state calls made through this layer since the last reset_statistics().
+     */
+    struct statistics {
+        size_t calls = 0;       /**< Calls received. */
+        size_t elided = 0;      /**< Calls skipped because the state already had the value. */
+    };
+
+    void bind_vertex_array(GLuint vertexArray);
+    void use_program(GLuint program);
+    /**
+     * @brief Binds a buffer, GL_ELEMENT_ARRAY_BUFFER bindings are remembered for the bound vertex array.
+     */
+    void bind_buffer(GLenum target, GLuint buffer);
+    /**
+     * @brief Binds a buffer to an indexed binding point of GL_UNIFORM_BUFFER, which also binds it to the target.
+     */
+    void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+    void active_texture(GLenum unit);
+    /**
+     * @brief Binds a texture to the active texture unit.
+     */
+    void bind_texture(GLenum target, GLuint texture);
+    /**
+     * @brief Binds a texture to a texture unit, the unit becomes the active one.
+     */
+    void bind_texture(GLenum unit, GLenum target, GLuint texture);
+    void set_enabled(GLenum capability, bool enabled);
+    void enable(GLenum capability);
+    void disable(GLenum capability);
+    void blend_func(GLenum source, GLenum destination);
+    void depth_func(GLenum function);
+    void depth_mask(bool write);
+    void cull_face(GLenum face);
+
+    void delete_vertex_arrays(GLsizei count, const GLuint* vertexArrays);
+    void delete_buffers(GLsizei count, const GLuint* buffers);
+    void delete_textures(GLsizei count, const GLuint* textures);
+    void delete_program(GLuint program);
+
+    /**
+     * @brief Forgets the whole state, the next call of every function reaches the driver.
+     */
+    void invalidate();
+
+    const statistics& get_statistics();
+    void reset_statistics();
+}
+
+#endif
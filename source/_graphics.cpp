@@ -1,6 +1,14 @@
 #include "_graphics.hpp"
+#include "_parallel.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stbi_image.h"
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // ---------------  Geometry functions --------------- //
 namespace geometry {
@@ -23,19 +31,89 @@ namespace geometry {
         return A + B;
     }
 
-    vector<vec3> b_spline(vector<vec3> cp, vector<float> knots, int approxM) {
+    int b_spline_find_span(float u, int degree, const vector<float>& knots, int numControlPoints) {
+        int n = numControlPoints - 1;
+        if (u >= knots[n + 1]) {
+            return n;
+        }
+        if (u <= knots[degree]) {
+            return degree;
+        }
+        // binary search for knots[mid] <= u < knots[mid + 1]
+        int low = degree, high = n + 1;
+        int mid = (low + high) / 2;
+        while (u < knots[mid] || u >= knots[mid + 1]) {
+            if (u < knots[mid]) {
+                high = mid;
+            }
+            else {
+                low = mid;
+            }
+            mid = (low + high) / 2;
+        }
+        return mid;
+    }
+
+    void b_spline_basis(int span, float u, int degree, const vector<float>& knots, float* N) {
+        // triangular de Boor scheme, only the degree + 1 non-zero blends are computed
+        N[0] = 1.0f;
+        for (int j = 1; j <= degree; j++) {
+            float saved = 0.0f;
+            for (int r = 0; r < j; r++) {
+                float right = knots[span + r + 1] - u;
+                float left = u - knots[span + 1 - j + r];
+                float temp = N[r] / (right + left);
+                N[r] = saved + right * temp;
+                saved = left * temp;
+            }
+            N[j] = saved;
+        }
+    }
+
+    void b_spline_basis_derivatives(int span, float u, int degree, const vector<float>& knots, float* N, float* dN) {
+        if (degree == 0) {
+            N[0] = 1.0f;
+            dN[0] = 0.0f;
+            return;
+        }
+        // N holds the degree - 1 basis, N[r] is the blend of control point span - degree + 1 + r
+        b_spline_basis(span, u, degree - 1, knots, N);
+        for (int j = 0; j <= degree; j++) {
+            float a = j > 0 ? N[j - 1] / (knots[span + j] - knots[span - degree + j]) : 0.0f;
+            float b = j < degree ? N[j] / (knots[span + j + 1] - knots[span - degree + j + 1]) : 0.0f;
+            dN[j] = degree * (a - b);
+        }
+        // last step of the triangular scheme raises N to the full degree
+        float saved = 0.0f;
+        for (int r = 0; r < degree; r++) {
+            float right = knots[span + r + 1] - u;
+            float left = u - knots[span + 1 - degree + r];
+            float temp = N[r] / (right + left);
+            N[r] = saved + right * temp;
+            saved = left * temp;
+        }
+        N[degree] = saved;
+    }
+
+    vector<vec3> b_spline(const vector<vec3>& cp, const vector<float>& knots, int approxM, int degree) {
 
-        if (cp.size() + 4 != knots.size()) {
+        if (degree < 1 || cp.size() <= static_cast<size_t>(degree) || cp.size() + degree + 1 != knots.size()) {
             throw std::invalid_argument("Invalid size of knot vector for the given degree and control points.");
         }
 
+        const int n = cp.size();
+        const float uMin = knots[degree];
+        const float uMax = knots[n];
+        vector<float> N(degree + 1);
         vector<vec3> spline_points;
+        spline_points.reserve(approxM);
         for (int i = 0; i < approxM; i++) {
-            float u = static_cast<float>(i) / approxM;
+            float u = uMin + (uMax - uMin) * (static_cast<float>(i) / approxM);
+            int span = b_spline_find_span(u, degree, knots, n);
+            b_spline_basis(span, u, degree, knots, N.data());
             vec3 point(0.0f);
-            for (int k = 0; k < cp.size(); k++) {
-                float B = b_spline_blend(u, k, 3, knots);
-                point += B * cp[k];
+            for (int j = 0; j <= degree; j++) {
+                point += N[j] * cp[span - degree + j];
             }
             spline_points.push_back(point);
         }
@@ -44,39 +122,326 @@ namespace geometry {
     }
 
 
+    vec3 b_spline_point(const vector<vec3>& cp, const vector<float>& knots, float u, int degree) {
+        const int n = cp.size();
+        u = glm::clamp(u, knots[degree], knots[n]);
+        int span = b_spline_find_span(u, degree, knots, n);
+        vector<float> N(degree + 1);
+        b_spline_basis(span, u, degree, knots, N.data());
+        vec3 point(0.0f);
+        for (int j = 0; j <= degree; j++) {
+            point += N[j] * cp[span - degree + j];
+        }
+        return point;
+    }
+
+    /**
+        @brief Bisects [u0, u1] until error(p0, curve midpoint, p1) is below 1, appending the points after p0.
+    **/
+    static void b_spline_subdivide(
+        const vector<vec3>& cp, const vector<float>& knots, int degree,
+        float u0, const vec3& p0, float u1, const vec3& p1,
+        const function<float(const vec3&, const vec3&, const vec3&)>& error,
+        int depth, int minDepth, vector<vec3>& points) {
+        float um = 0.5f * (u0 + u1);
+        vec3 pm = b_spline_point(cp, knots, um, degree);
+        if (depth > 0 && (depth > minDepth || error(p0, pm, p1) > 1.0f)) {
+            b_spline_subdivide(cp, knots, degree, u0, p0, um, pm, error, depth - 1, minDepth, points);
+            b_spline_subdivide(cp, knots, degree, um, pm, u1, p1, error, depth - 1, minDepth, points);
+        }
+        else {
+            points.push_back(p1);
+        }
+    }
+
+    static vector<vec3> b_spline_adaptive_impl(
+        const vector<vec3>& cp, const vector<float>& knots, int degree, int maxDepth,
+        const function<float(const vec3&, const vec3&, const vec3&)>& error) {
+        const int n = cp.size();
+        if (degree < 1 || n <= degree || n + degree + 1 != static_cast<int>(knots.size())) {
+            throw std::invalid_argument("Invalid size of knot vector for the given degree and control points.");
+        }
+        // a cubic piece can hold an inflection, so every span is split at least twice before testing flatness
+        const int minDepth = glm::max(maxDepth - 2, 0);
+        vector<vec3> points{ b_spline_point(cp, knots, knots[degree], degree) };
+        for (int span = degree; span < n; span++) {
+            if (knots[span] == knots[span + 1]) {
+                continue;
+            }
+            float u0 = knots[span], u1 = knots[span + 1];
+            vec3 p0 = points.back();
+            vec3 p1 = b_spline_point(cp, knots, u1, degree);
+            b_spline_subdivide(cp, knots, degree, u0, p0, u1, p1, error, maxDepth, minDepth, points);
+        }
+        return points;
+    }
+
+    /**
+        @brief Distance of 'p' to the segment [a, b].
+    **/
+    static float segment_distance(const vec3& a, const vec3& b, const vec3& p) {
+        vec3 ab = b - a;
+        float len2 = dot(ab, ab);
+        float t = len2 > 0.0f ? glm::clamp(dot(p - a, ab) / len2, 0.0f, 1.0f) : 0.0f;
+        return length(p - (a + t * ab));
+    }
+
+    vector<vec3> b_spline_adaptive(const vector<vec3>& cp, const vector<float>& knots, float tolerance, int degree, int maxDepth) {
+        return b_spline_adaptive_impl(cp, knots, degree, maxDepth, [tolerance](const vec3& a, const vec3& m, const vec3& b) {
+            return segment_distance(a, b, m) / tolerance;
+        });
+    }
+
+    vector<vec3> b_spline_adaptive(const vector<vec3>& cp, const vector<float>& knots, const mat4& viewProjection, vec2 viewport, float pixelTolerance, int degree, int maxDepth) {
+        auto toScreen = [&viewProjection, viewport](const vec3& p, bool& inFront) {
+            vec4 clip = viewProjection * vec4(p, 1.0f);
+            inFront = clip.w > 0.0f;
+            return vec3(0.5f * viewport.x * clip.x / clip.w, 0.5f * viewport.y * clip.y / clip.w, 0.0f);
+        };
+        return b_spline_adaptive_impl(cp, knots, degree, maxDepth, [&toScreen, pixelTolerance](const vec3& a, const vec3& m, const vec3& b) {
+            bool aFront, mFront, bFront;
+            vec3 sa = toScreen(a, aFront), sm = toScreen(m, mFront), sb = toScreen(b, bFront);
+            if (!aFront && !mFront && !bFront) {
+                return 0.0f;
+            }
+            if (!aFront || !mFront || !bFront) {
+                // crossing the eye plane, the projected error is meaningless so keep refining
+                return 2.0f;
+            }
+            return segment_distance(sa, sb, sm) / pixelTolerance;
+        });
+    }
+
+    b_spline_batch::b_spline_batch(int numCurves, int numControlPoints) :
+        numCurves(numCurves),
+        numControlPoints(numControlPoints),
+        x(numCurves * numControlPoints),
+        y(numCurves * numControlPoints),
+        z(numCurves * numControlPoints) { }
+
+    void b_spline_batch::setCurve(int curve, const vector<vec3>& cp) {
+        if (cp.size() != static_cast<size_t>(numControlPoints)) {
+            throw std::invalid_argument("Invalid number of control points for the batch.");
+        }
+        for (int k = 0; k < numControlPoints; k++) {
+            x[k * numCurves + curve] = cp[k].x;
+            y[k * numCurves + curve] = cp[k].y;
+            z[k * numCurves + curve] = cp[k].z;
+        }
+    }
+
+    void b_spline_batch_eval(const b_spline_batch& batch, const vector<float>& knots, int approxM, vector<vec3>& out, int degree) {
+        const int n = batch.numControlPoints;
+        const int numCurves = batch.numCurves;
+        if (degree < 1 || n <= degree || n + degree + 1 != static_cast<int>(knots.size())) {
+            throw std::invalid_argument("Invalid size of knot vector for the given degree and control points.");
+        }
+
+        // the basis only depends on the parameter, so it is shared by every curve of the batch
+        const int order = degree + 1;
+        const float uMin = knots[degree];
+        const float uMax = knots[n];
+        vector<int> spans(approxM);
+        vector<float> basis(approxM * order);
+        for (int i = 0; i < approxM; i++) {
+            float u = uMin + (uMax - uMin) * (static_cast<float>(i) / approxM);
+            spans[i] = b_spline_find_span(u, degree, knots, n);
+            b_spline_basis(spans[i], u, degree, knots, &basis[i * order]);
+        }
+
+        out.resize(static_cast<size_t>(numCurves) * approxM);
+        const float* X = batch.x.data();
+        const float* Y = batch.y.data();
+        const float* Z = batch.z.data();
+        int c = 0;
+
+#if defined(__AVX__)
+        for (; c + 8 <= numCurves; c += 8) {
+            alignas(32) float px[8], py[8], pz[8];
+            for (int i = 0; i < approxM; i++) {
+                const float* N = &basis[i * order];
+                int first = (spans[i] - degree) * numCurves + c;
+                __m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+                for (int j = 0; j < order; j++) {
+                    __m256 b = _mm256_set1_ps(N[j]);
+                    int k = first + j * numCurves;
+                    ax = _mm256_add_ps(ax, _mm256_mul_ps(b, _mm256_loadu_ps(X + k)));
+                    ay = _mm256_add_ps(ay, _mm256_mul_ps(b, _mm256_loadu_ps(Y + k)));
+                    az = _mm256_add_ps(az, _mm256_mul_ps(b, _mm256_loadu_ps(Z + k)));
+                }
+                _mm256_store_ps(px, ax);
+                _mm256_store_ps(py, ay);
+                _mm256_store_ps(pz, az);
+                for (int l = 0; l < 8; l++) {
+                    out[(c + l) * approxM + i] = vec3(px[l], py[l], pz[l]);
+                }
+            }
+        }
+#elif defined(__SSE2__)
+        for (; c + 4 <= numCurves; c += 4) {
+            alignas(16) float px[4], py[4], pz[4];
+            for (int i = 0; i < approxM; i++) {
+                const float* N = &basis[i * order];
+                int first = (spans[i] - degree) * numCurves + c;
+                __m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), az = _mm_setzero_ps();
+                for (int j = 0; j < order; j++) {
+                    __m128 b = _mm_set1_ps(N[j]);
+                    int k = first + j * numCurves;
+                    ax = _mm_add_ps(ax, _mm_mul_ps(b, _mm_loadu_ps(X + k)));
+                    ay = _mm_add_ps(ay, _mm_mul_ps(b, _mm_loadu_ps(Y + k)));
+                    az = _mm_add_ps(az, _mm_mul_ps(b, _mm_loadu_ps(Z + k)));
+                }
+                _mm_store_ps(px, ax);
+                _mm_store_ps(py, ay);
+                _mm_store_ps(pz, az);
+                for (int l = 0; l < 4; l++) {
+                    out[(c + l) * approxM + i] = vec3(px[l], py[l], pz[l]);
+                }
+            }
+        }
+#endif
+        // scalar fallback for the remaining curves
+        for (; c < numCurves; c++) {
+            for (int i = 0; i < approxM; i++) {
+                const float* N = &basis[i * order];
+                int first = (spans[i] - degree) * numCurves + c;
+                vec3 point(0.0f);
+                for (int j = 0; j < order; j++) {
+                    int k = first + j * numCurves;
+                    point += N[j] * vec3(X[k], Y[k], Z[k]);
+                }
+                out[c * approxM + i] = point;
+            }
+        }
+    }
+
     vector<vec3> b_spline_surface(
-        vector<vector<vec3>> C,
-        vector<float> knotsU,
-        vector<float> knotsV,
+        const vector<vector<vec3>>& C,
+        const vector<float>& knotsU,
+        const vector<float>& knotsV,
         int degreeU, int degreeV,
         int numPointsU, int numPointsV) {
-        int n = C.size();
-        int m = C[0].size();
-        if (n != knotsU.size() - degreeU - 1) {
-            throw std::invalid_argument("Invalid size of knot vector for the given degree and control points.");
+        return b_spline_surface_eval(C, knotsU, knotsV, degreeU, degreeV, numPointsU, numPointsV, false).points;
+    }
+
+    /**
+        @brief Basis table of one surface direction, row 'i' holds the degree + 1 non-zero blends of sample 'i'
+        starting at control point first[i].
+    **/
+    struct basis_table {
+        int order;
+        vector<int> first;
+        vector<float> N;
+        vector<float> dN;
+    };
+
+    static basis_table make_basis_table(const vector<float>& knots, int degree, int numControlPoints, int numPoints, bool derivatives) {
+        basis_table table;
+        table.order = degree + 1;
+        table.first.resize(numPoints);
+        table.N.resize(numPoints * table.order);
+        if (derivatives) {
+            table.dN.resize(numPoints * table.order);
+        }
+        const float uMin = knots[degree];
+        const float uMax = knots[numControlPoints];
+        for (int i = 0; i < numPoints; i++) {
+            float u = uMin + (uMax - uMin) * (i / static_cast<float>(numPoints));
+            int span = b_spline_find_span(u, degree, knots, numControlPoints);
+            table.first[i] = span - degree;
+            if (derivatives) {
+                b_spline_basis_derivatives(span, u, degree, knots, &table.N[i * table.order], &table.dN[i * table.order]);
+            }
+            else {
+                b_spline_basis(span, u, degree, knots, &table.N[i * table.order]);
+            }
         }
+        return table;
+    }
 
-        if (m != knotsV.size() - degreeV - 1) {
+    b_spline_surface_samples b_spline_surface_eval(
+        const vector<vector<vec3>>& C,
+        const vector<float>& knotsU,
+        const vector<float>& knotsV,
+        int degreeU, int degreeV,
+        int numPointsU, int numPointsV,
+        bool derivatives) {
+        const int n = C.size();
+        const int m = n > 0 ? C[0].size() : 0;
+        if (degreeU < 1 || n <= degreeU || n + degreeU + 1 != static_cast<int>(knotsU.size())) {
+            throw std::invalid_argument("Invalid size of knot vector for the given degree and control points.");
+        }
+        if (degreeV < 1 || m <= degreeV || m + degreeV + 1 != static_cast<int>(knotsV.size())) {
             throw std::invalid_argument("Invalid size of knot vector for the given degree and control points.");
         }
+        for (const vector<vec3>& row : C) {
+            if (static_cast<int>(row.size()) != m) {
+                throw std::invalid_argument("Control point rows must all have the same size.");
+            }
+        }
+
+        const basis_table Bu = make_basis_table(knotsU, degreeU, n, numPointsU, derivatives);
+        const basis_table Bv = make_basis_table(knotsV, degreeV, m, numPointsV, derivatives);
+
+        b_spline_surface_samples samples;
+        samples.numPointsU = numPointsU;
+        samples.numPointsV = numPointsV;
+        const size_t total = static_cast<size_t>(numPointsU) * numPointsV;
+        samples.points.resize(total);
+        if (derivatives) {
+            samples.dU.resize(total);
+            samples.dV.resize(total);
+            samples.normals.resize(total);
+        }
 
-        vector<vec3> points;
-        for (int i = 0; i < numPointsU; i++) {
-            float u = i / static_cast<float>(numPointsU);
-            for (int j = 0; j < numPointsV; j++) {
-                float v = j / static_cast<float>(numPointsV);
-                glm::vec3 p(0, 0, 0);
-                for (int k = 0; k < n; k++) {
-                    for (int l = 0; l < m; l++) {
-                        float Bu = b_spline_blend(u, k, degreeU, knotsU);
-                        float Bv = b_spline_blend(v, l, degreeV, knotsV);
-                        p += Bu * Bv * C[k][l];
+        parallel_for(0, numPointsU, [&](int rowBegin, int rowEnd) {
+            // row i of Bu * C (and dBu * C), m control points in the V direction
+            vector<vec3> T(m), dT(derivatives ? m : 0);
+            for (int i = rowBegin; i < rowEnd; i++) {
+                const float* Nu = &Bu.N[i * Bu.order];
+                const float* dNu = derivatives ? &Bu.dN[i * Bu.order] : nullptr;
+                for (int l = 0; l < m; l++) {
+                    vec3 t(0.0f), dt(0.0f);
+                    for (int k = 0; k < Bu.order; k++) {
+                        const vec3& c = C[Bu.first[i] + k][l];
+                        t += Nu[k] * c;
+                        if (derivatives) {
+                            dt += dNu[k] * c;
+                        }
+                    }
+                    T[l] = t;
+                    if (derivatives) {
+                        dT[l] = dt;
+                    }
+                }
+                // (Bu * C) * Bv^T
+                for (int j = 0; j < numPointsV; j++) {
+                    const float* Nv = &Bv.N[j * Bv.order];
+                    const int first = Bv.first[j];
+                    vec3 p(0.0f);
+                    for (int l = 0; l < Bv.order; l++) {
+                        p += Nv[l] * T[first + l];
+                    }
+                    const size_t index = static_cast<size_t>(i) * numPointsV + j;
+                    samples.points[index] = p;
+                    if (derivatives) {
+                        const float* dNv = &Bv.dN[j * Bv.order];
+                        vec3 su(0.0f), sv(0.0f);
+                        for (int l = 0; l < Bv.order; l++) {
+                            su += Nv[l] * dT[first + l];
+                            sv += dNv[l] * T[first + l];
+                        }
+                        vec3 normal = cross(su, sv);
+                        float len = length(normal);
+                        samples.dU[index] = su;
+                        samples.dV[index] = sv;
+                        samples.normals[index] = len > 0.0f ? normal / len : vec3(0.0f);
                     }
                 }
-                points.push_back(glm::vec3(p));
             }
-        }
-        return points;
+        }, 16);
+
+        return samples;
     }
 
     vector<vec3> sphere(glm::vec3 center, float radius, int stacks, int slices) {
@@ -98,11 +463,195 @@ namespace geometry {
         return vertices;
     }
 
+
+    pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> optimize_mesh(mesh& m) {
+        pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> stats;
+        const size_t count = m.indices.size();
+        stats.first = mesh_optimizer::analyze_vertex_cache(m.indices, 0, count, m.vertices.size());
+        mesh_optimizer::optimize_vertex_cache(m.indices, 0, count, m.vertices.size());
+        mesh_optimizer::optimize_overdraw(m.indices, 0, count, m.vertices);
+        stats.second = mesh_optimizer::analyze_vertex_cache(m.indices, 0, count, m.vertices.size());
+        const vector<unsigned int> remap = mesh_optimizer::optimize_vertex_fetch(m.indices, m.vertices.size());
+        mesh_optimizer::remap_vertices(m.vertices, remap);
+        mesh_optimizer::remap_vertices(m.normals, remap);
+        mesh_optimizer::remap_vertices(m.uvs, remap);
+        return stats;
+    }
+
+    mesh uv_sphere_mesh(vec3 center, float radius, int stacks, int slices) {
+        mesh m;
+        for (int i = 0; i <= stacks; ++i) {
+            float stackAngle = M_PI / float(stacks) * i; // range from 0 to pi
+            for (int j = 0; j <= slices; ++j) {
+                float sliceAngle = 2 * M_PI / float(slices) * j; // range from 0 to 2pi
+                vec3 normal(sinf(stackAngle) * cosf(sliceAngle), cosf(stackAngle), sinf(stackAngle) * sinf(sliceAngle));
+                m.vertices.push_back(center + radius * normal);
+                m.normals.push_back(normal);
+                m.uvs.push_back(vec2(j / float(slices), 1.0f - i / float(stacks)));
+            }
+        }
+        for (int i = 0; i < stacks; ++i) {
+            for (int j = 0; j < slices; ++j) {
+                unsigned int a = i * (slices + 1) + j;
+                unsigned int b = a + slices + 1;
+                // the triangles touching the poles would be degenerate
+                if (i != 0) {
+                    m.indices.insert(m.indices.end(), { a, a + 1, b });
+                }
+                if (i != stacks - 1) {
+                    m.indices.insert(m.indices.end(), { a + 1, b + 1, b });
+                }
+            }
+        }
+        optimize_mesh(m);
+        return m;
+    }
+
+    mesh uv_sphere_mesh(vec3 center, float radius, primitive_detail detail) {
+        const int stacks[] = { 8, 16, 32 };
+        return uv_sphere_mesh(center, radius, stacks[detail], 2 * stacks[detail]);
+    }
+
+    mesh icosphere_mesh(vec3 center, float radius, int subdivisions) {
+        const float t = (1.0f + sqrtf(5.0f)) / 2.0f;
+        vector<vec3> unit {
+            { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+            { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+            { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+        };
+        for (vec3& v : unit) {
+            v = normalize(v);
+        }
+        vector<unsigned int> indices {
+            0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+            1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+            3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+            4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1
+        };
+        for (int s = 0; s < subdivisions; s++) {
+            // every edge is split once, the midpoint is shared by both triangles of the edge
+            map<pair<unsigned int, unsigned int>, unsigned int> midpoints;
+            auto midpoint = [&](unsigned int a, unsigned int b) {
+                pair<unsigned int, unsigned int> key(glm::min(a, b), glm::max(a, b));
+                auto it = midpoints.find(key);
+                if (it != midpoints.end()) {
+                    return it->second;
+                }
+                unit.push_back(normalize(unit[a] + unit[b]));
+                unsigned int index = unit.size() - 1;
+                midpoints[key] = index;
+                return index;
+            };
+            vector<unsigned int> refined;
+            for (size_t f = 0; f < indices.size(); f += 3) {
+                unsigned int a = indices[f], b = indices[f + 1], c = indices[f + 2];
+                unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+                refined.insert(refined.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+            }
+            indices.swap(refined);
+        }
+        mesh m;
+        for (const vec3& normal : unit) {
+            m.vertices.push_back(center + radius * normal);
+            m.normals.push_back(normal);
+            // spherical mapping, the triangles crossing the seam interpolate across the whole texture
+            m.uvs.push_back(vec2(0.5f + atan2f(normal.z, normal.x) / float(2 * M_PI), 0.5f + asinf(normal.y) / float(M_PI)));
+        }
+        m.indices = indices;
+        optimize_mesh(m);
+        return m;
+    }
+
+    mesh icosphere_mesh(vec3 center, float radius, primitive_detail detail) {
+        const int subdivisions[] = { 1, 2, 4 };
+        return icosphere_mesh(center, radius, subdivisions[detail]);
+    }
+
+    /**
+        @brief Appends a subdivided quad spanned by 'right' and 'up' around 'origin', facing cross(right, up).
+    **/
+    static void append_grid(mesh& m, vec3 origin, vec3 right, vec3 up, int subdivisions) {
+        const unsigned int first = m.vertices.size();
+        const vec3 normal = normalize(cross(right, up));
+        for (int i = 0; i <= subdivisions; i++) {
+            for (int j = 0; j <= subdivisions; j++) {
+                vec2 uv(j / float(subdivisions), i / float(subdivisions));
+                m.vertices.push_back(origin + (uv.x - 0.5f) * right + (uv.y - 0.5f) * up);
+                m.normals.push_back(normal);
+                m.uvs.push_back(uv);
+            }
+        }
+        for (int i = 0; i < subdivisions; i++) {
+            for (int j = 0; j < subdivisions; j++) {
+                unsigned int a = first + i * (subdivisions + 1) + j;
+                unsigned int b = a + subdivisions + 1;
+                m.indices.insert(m.indices.end(), { a, a + 1, b + 1, a, b + 1, b });
+            }
+        }
+    }
+
+    mesh cube_mesh(vec3 center, float size, int subdivisions) {
+        mesh m;
+        const float h = 0.5f * size;
+        append_grid(m, center + vec3(h, 0, 0), vec3(0, 0, -size), vec3(0, size, 0), subdivisions);
+        append_grid(m, center + vec3(-h, 0, 0), vec3(0, 0, size), vec3(0, size, 0), subdivisions);
+        append_grid(m, center + vec3(0, h, 0), vec3(size, 0, 0), vec3(0, 0, -size), subdivisions);
+        append_grid(m, center + vec3(0, -h, 0), vec3(size, 0, 0), vec3(0, 0, size), subdivisions);
+        append_grid(m, center + vec3(0, 0, h), vec3(size, 0, 0), vec3(0, size, 0), subdivisions);
+        append_grid(m, center + vec3(0, 0, -h), vec3(-size, 0, 0), vec3(0, size, 0), subdivisions);
+        optimize_mesh(m);
+        return m;
+    }
+
+    mesh cube_mesh(vec3 center, float size, primitive_detail detail) {
+        const int subdivisions[] = { 1, 4, 16 };
+        return cube_mesh(center, size, subdivisions[detail]);
+    }
+
+    mesh plane_mesh(vec3 center, vec2 size, int subdivisions) {
+        mesh m;
+        append_grid(m, center, vec3(size.x, 0, 0), vec3(0, 0, -size.y), subdivisions);
+        optimize_mesh(m);
+        return m;
+    }
+
+    mesh plane_mesh(vec3 center, vec2 size, primitive_detail detail) {
+        const int subdivisions[] = { 1, 4, 16 };
+        return plane_mesh(center, size, subdivisions[detail]);
+    }
 };
 
 
+// --------------- Uniform Blocks --------------- //
+uniform_blocks::light::light(const light_props& props) :
+    position(props.position),
+    color(props.color),
+    type(props.type),
+    direction(props.direction),
+    cutOff(props.cutOff),
+    outerCutOff(props.outerCutOff),
+    constant(props.constant),
+    linear(props.linear),
+    quadratic(props.quadratic),
+    ambientCoeff(props.ambientCoeff),
+    diffuseCoeff(props.diffuseCoeff),
+    specularCoeff(props.specularCoeff) { }
+
+uniform_blocks::lights::lights(const vector<light_props>& props, vec3 viewPosition) : viewPos(viewPosition) {
+    numLights = props.size() < MAX_LIGHTS ? static_cast<int>(props.size()) : MAX_LIGHTS;
+    for (int i = 0; i < numLights; i++) {
+        entries[i] = light(props[i]);
+    }
+}
+
+uniform_blocks::material::material(const material_props& props) :
+    ambientStrength(props.ambientStrength),
+    diffuseStrength(props.diffuseStrength),
+    specularStrength(props.specularStrength) { }
+
+
 // --------------- Shader Program --------------- //
-shader_program::shader_program() {
+shader_program::shader_program() : loaded(false), attached(false) {
     // Create Program
     m_program = glCreateProgram();
     // Create Shaders
@@ -110,58 +659,40 @@ shader_program::shader_program() {
     fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 }
 shader_program::~shader_program() {
-    glDeleteProgram(m_program);
-}
-
-void shader_program::setLights(vector<light_props>& lights, material_props& materialProperties, vec3 viewDirection) {
-    function<string(string, int, string)> combine = [](string s1, int s2, string  s3) {
-        return s1 + to_string(s2) + s3;
-    };
-    setUniform("numLights", static_cast<int>(lights.size()));
-    setUniform("viewPos", viewDirection);
-    setUniform("material.ambientStrength", materialProperties.ambientStrength);
-    setUniform("material.diffueStrength", materialProperties.diffuseStrength);
-    setUniform("material.specularStrength", materialProperties.specularStrength);
-    for (int i = 0; i < lights.size(); i++) {
-        light_props& lightProperties = lights[i];
-
-        setUniform(combine("lights[", i, "].position").c_str(), lightProperties.position);
-        setUniform(combine("lights[", i, "].color").c_str(), lightProperties.color);
-        setUniform(combine("lights[", i, "].type").c_str(), lightProperties.type);
-        setUniform(combine("lights[", i, "].direction").c_str(), lightProperties.direction);
-        setUniform(combine("lights[", i, "].cutOff").c_str(), lightProperties.cutOff);
-        setUniform(combine("lights[", i, "].outerCutOff").c_str(), lightProperties.outerCutOff);
-
-        setUniform(combine("lights[", i, "].constant").c_str(), lightProperties.constant);
-        setUniform(combine("lights[", i, "].linear").c_str(), lightProperties.linear);
-        setUniform(combine("lights[", i, "].quadratic").c_str(), lightProperties.quadratic);
-
-        setUniform(combine("lights[", i, "].ambientCoeff").c_str(), lightProperties.ambientCoeff);
-        setUniform(combine("lights[", i, "].diffuseCoeff").c_str(), lightProperties.diffuseCoeff);
-        setUniform(combine("lights[", i, "].specularCoeff").c_str(), lightProperties.specularCoeff);
-
-    }
+    discardReload();
+    gl_state::delete_program(m_program);
 }
 
-
 void shader_program::load(const char* vertexShaderPath, const char* fragmentShaderPath) {
-    // Load Vertex Shader
-    loadShader(vertexShaderPath, vertexShader);
-    // Load Fragment Shader
-    loadShader(fragmentShaderPath, fragmentShader);
+    loadSources(readShader(vertexShaderPath), readShader(fragmentShaderPath));
+}
 
+void shader_program::loadSources(const std::string& vertexSource, const std::string& fragmentSource) {
+    m_vertexSource = vertexSource;
+    m_fragmentSource = fragmentSource;
     loaded = true;
 }
 
 void shader_program::attach() {
     if(attached) return;
+    // Compile Shaders
+    compileShader(vertexShader, m_vertexSource);
+    compileShader(fragmentShader, m_fragmentSource);
     // Attach Shaders
     glAttachShader(m_program, vertexShader);
     glAttachShader(m_program, fragmentShader);
 
+    if (!m_feedbackVaryings.empty()) {
+        glTransformFeedbackVaryings(m_program, m_feedbackVaryings.size(), m_feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+    if (retrievable) {
+        glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     // Link Program
     glLinkProgram(m_program);
     checkShader(m_program, GL_LINK_STATUS, true, "Error linking shader program");
+    finishLink();
     // Validate Program
     glValidateProgram(m_program);
     checkShader(m_program, GL_VALIDATE_STATUS, true, "Invalid shader program");
@@ -172,37 +703,415 @@ void shader_program::attach() {
     attached = true;
 }
 
+bool shader_program::attachBinary(GLenum format, const void* binary, GLsizei length) {
+    if (attached) return linked;
+    glProgramBinary(m_program, format, binary, length);
+    GLint success = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &success);
+    // a binary of another driver or version is rejected, the program is then linked from its sources
+    if (success == GL_FALSE) {
+        return false;
+    }
+    finishLink();
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    attached = true;
+    return true;
+}
+
+void shader_program::finishLink() {
+    GLint success = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &success);
+    linked = success == GL_TRUE;
+    reflectUniforms();
+    reflectAttributes();
+    // every program reads the lights and the material from the same binding points
+    const GLuint lightsIndex = glGetUniformBlockIndex(m_program, "Lights");
+    if (lightsIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(m_program, lightsIndex, uniform_blocks::LIGHTS_BINDING);
+    }
+    const GLuint materialIndex = glGetUniformBlockIndex(m_program, "Material");
+    if (materialIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(m_program, materialIndex, uniform_blocks::MATERIAL_BINDING);
+    }
+}
+
+void shader_program::setBinaryRetrievable(bool retrievable) {
+    this->retrievable = retrievable;
+}
+
+bool shader_program::getBinary(GLenum& format, vector<unsigned char>& binary) const {
+    if (!linked) return false;
+    GLint length = 0;
+    glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return false;
+    binary.resize(length);
+    GLsizei written = 0;
+    glGetProgramBinary(m_program, length, &written, &format, binary.data());
+    binary.resize(written);
+    return written > 0;
+}
+
+bool shader_program::isLinked() const { return linked; }
+const std::string& shader_program::getVertexSource() const { return m_vertexSource; }
+const std::string& shader_program::getFragmentSource() const { return m_fragmentSource; }
+const vector<const char*>& shader_program::getTransformFeedbackVaryings() const { return m_feedbackVaryings; }
+
 void shader_program::use() {
-    glUseProgram(m_program);
+    gl_state::use_program(m_program);
+}
+
+void shader_program::setTransformFeedbackVaryings(vector<const char*> varyings) {
+    m_feedbackVaryings = varyings;
 }
 
 
 void shader_program::setUniform(const char* name, const glm::mat4& value) {
-    glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, value_ptr(value));
+    setUniform(getUniformHandle<mat4>(name), value);
 }
 
 void shader_program::setUniform(const char* name, const glm::vec3& value) {
-    glUniform3f(getUniformLocation(name), value.x, value.y, value.z);
+    setUniform(getUniformHandle<vec3>(name), value);
 }
 void shader_program::setUniform(const char* name, const glm::vec4& value) {
-    glUniform4f(getUniformLocation(name), value.x, value.y, value.z, value.w);
+    setUniform(getUniformHandle<vec4>(name), value);
 }
 
 void shader_program::setUniform(const char* name, float value) {
-    glUniform1f(getUniformLocation(name), value);
+    setUniform(getUniformHandle<float>(name), value);
 }
 
 void shader_program::setUniform(const char* name, int value) {
-    glUniform1i(getUniformLocation(name), value);
+    setUniform(getUniformHandle<int>(name), value);
 }
 
 void shader_program::setUniform(const char* name, bool value) {
-    glUniform1i(getUniformLocation(name), value);
+    setUniform(getUniformHandle<bool>(name), value);
+}
+
+void shader_program::setUniform(uniform_handle<mat4> handle, const glm::mat4& value) {
+    if (changes(handle.index, value_ptr(value), sizeof(mat4))) {
+        glUniformMatrix4fv(m_uniformSlots[handle.index].location, 1, GL_FALSE, value_ptr(value));
+    }
+}
+
+void shader_program::setUniform(uniform_handle<vec3> handle, const glm::vec3& value) {
+    if (changes(handle.index, value_ptr(value), sizeof(vec3))) {
+        glUniform3f(m_uniformSlots[handle.index].location, value.x, value.y, value.z);
+    }
+}
+
+void shader_program::setUniform(uniform_handle<vec4> handle, const glm::vec4& value) {
+    if (changes(handle.index, value_ptr(value), sizeof(vec4))) {
+        glUniform4f(m_uniformSlots[handle.index].location, value.x, value.y, value.z, value.w);
+    }
+}
+
+void shader_program::setUniform(uniform_handle<float> handle, float value) {
+    if (changes(handle.index, &value, sizeof(float))) {
+        glUniform1f(m_uniformSlots[handle.index].location, value);
+    }
+}
+
+void shader_program::setUniform(uniform_handle<int> handle, int value) {
+    if (changes(handle.index, &value, sizeof(int))) {
+        glUniform1i(m_uniformSlots[handle.index].location, value);
+    }
+}
+
+void shader_program::setUniform(uniform_handle<bool> handle, bool value) {
+    // compared as the int the uniform stores
+    const int stored = value;
+    if (changes(handle.index, &stored, sizeof(int))) {
+        glUniform1i(m_uniformSlots[handle.index].location, stored);
+    }
+}
+
+const shader_program::common_uniforms& shader_program::getCommonUniforms() const {
+    return m_common;
+}
+
+const attribute_layout& shader_program::getAttributeLayout() const {
+    return m_attributes;
+}
+
+GLint attribute_layout::location(const char* name) const {
+    for (const input& in : inputs) {
+        if (in.name == name) return in.location;
+    }
+    return -1;
+}
+
+bool attribute_layout::is_integer(GLenum type) {
+    switch (type) {
+    case GL_INT: case GL_INT_VEC2: case GL_INT_VEC3: case GL_INT_VEC4:
+    case GL_UNSIGNED_INT: case GL_UNSIGNED_INT_VEC2: case GL_UNSIGNED_INT_VEC3: case GL_UNSIGNED_INT_VEC4:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void shader_program::reflectAttributes() {
+    m_attributes = attribute_layout();
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    vector<GLchar> nameBuffer(maxLength + 1);
+    for (GLint i = 0; i < count; i++) {
+        attribute_layout::input in;
+        glGetActiveAttrib(m_program, i, static_cast<GLsizei>(nameBuffer.size()), nullptr, &in.size, &in.type, nameBuffer.data());
+        in.name = nameBuffer.data();
+        in.location = glGetAttribLocation(m_program, in.name.c_str());
+        // built in inputs such as gl_VertexID have no location
+        if (in.location < 0) {
+            continue;
+        }
+        m_attributes.inputs.push_back(in);
+    }
+    for (int a = 0; a < vertex_format::ATTRIB_COUNT; a++) {
+        m_attributes.attributes[a] = m_attributes.location(vertex_format::attribute_name(static_cast<vertex_format::attribute>(a)));
+    }
+    m_attributes.instanceTransform = m_attributes.location("instanceTransform");
+}
+
+bool shader_program::changes(int index, const void* value, size_t size) {
+    if (index < 0) {
+        return false;
+    }
+    uniform_slot& slot = m_uniformSlots[index];
+    if (slot.set && memcmp(slot.value, value, size) == 0) {
+        return false;
+    }
+    memcpy(slot.value, value, size);
+    slot.set = true;
+    return true;
+}
+
+static bool is_sampler(GLenum type) {
+    switch (type) {
+    case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT:
+    case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Returns whether a uniform declared with a type can be set with glUniform calls for another one.
+ */
+static bool accepts_type(GLenum declared, GLenum requested) {
+    if (declared == requested) {
+        return true;
+    }
+    // booleans and samplers are set with glUniform1i
+    if (requested == GL_INT) {
+        return declared == GL_BOOL || is_sampler(declared);
+    }
+    return requested == GL_BOOL && declared == GL_INT;
+}
+
+int shader_program::findUniform(const char* name, GLenum type) {
+    auto it = m_uniformIndices.find(name);
+    if (it == m_uniformIndices.end()) {
+        return -1;
+    }
+    uniform_slot& slot = m_uniformSlots[it->second];
+    if (!accepts_type(slot.type, type)) {
+        if (!slot.mismatchReported) {
+            std::cout << "Uniform " << name << " is set with a value of another type" << std::endl;
+            slot.mismatchReported = true;
+        }
+        return -1;
+    }
+    return it->second;
+}
+
+void shader_program::reflectUniforms() {
+    m_uniformSlots.clear();
+    m_uniformIndices.clear();
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    vector<GLchar> nameBuffer(maxLength + 1);
+    for (GLint i = 0; i < count; i++) {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(m_program, i, static_cast<GLsizei>(nameBuffer.size()), nullptr, &size, &type, nameBuffer.data());
+        const std::string name(nameBuffer.data());
+        uniform_slot slot;
+        slot.location = glGetUniformLocation(m_program, name.c_str());
+        // members of uniform blocks have no location, they are set through their buffer
+        if (slot.location < 0) {
+            continue;
+        }
+        slot.type = type;
+        m_uniformIndices[name] = static_cast<int>(m_uniformSlots.size());
+        // arrays are reported as name[0], also found by their plain name
+        const size_t bracket = name.size() > 3 ? name.rfind("[0]") : std::string::npos;
+        const bool array = bracket != std::string::npos && bracket + 3 == name.size();
+        if (array) {
+            m_uniformIndices[name.substr(0, bracket)] = static_cast<int>(m_uniformSlots.size());
+        }
+        m_uniformSlots.push_back(slot);
+        // every further element has its own location and remembers its own value
+        for (GLint element = 1; array && element < size; element++) {
+            const std::string elementName = name.substr(0, bracket) + "[" + std::to_string(element) + "]";
+            slot.location = glGetUniformLocation(m_program, elementName.c_str());
+            if (slot.location < 0) {
+                continue;
+            }
+            m_uniformIndices[elementName] = static_cast<int>(m_uniformSlots.size());
+            m_uniformSlots.push_back(slot);
+        }
+    }
+    m_common.model = getUniformHandle<mat4>("mModel");
+    m_common.view = getUniformHandle<mat4>("mView");
+    m_common.projection = getUniformHandle<mat4>("mProjection");
+    m_common.normalEncoding = getUniformHandle<int>("normalEncoding");
+    m_common.instanceFormat = getUniformHandle<int>("instanceFormat");
+    m_common.textureSampler = getUniformHandle<int>("textureSampler");
+}
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/**
+ * @brief Returns whether the driver compiles in the background and reports when a program is done.
+ */
+static bool parallel_compile_supported() {
+    static int supported = -1;
+    if (supported < 0) {
+        supported = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++) {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (name && (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || strcmp(name, "GL_ARB_parallel_shader_compile") == 0)) {
+                supported = 1;
+            }
+        }
+    }
+    return supported == 1;
+}
+
+void shader_program::reload(const std::string& vertexSource, const std::string& fragmentSource) {
+    discardReload();
+    m_pendingVertexSource = vertexSource;
+    m_pendingFragmentSource = fragmentSource;
+    m_pendingProgram = glCreateProgram();
+    const std::string* sources[2] = { &m_pendingVertexSource, &m_pendingFragmentSource };
+    const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    for (int i = 0; i < 2; i++) {
+        // the status is only queried by finishReload(), so that the compiler can run meanwhile
+        const char* source = sources[i]->c_str();
+        m_pendingShaders[i] = glCreateShader(types[i]);
+        glShaderSource(m_pendingShaders[i], 1, &source, NULL);
+        glCompileShader(m_pendingShaders[i]);
+        glAttachShader(m_pendingProgram, m_pendingShaders[i]);
+    }
+    if (!m_feedbackVaryings.empty()) {
+        glTransformFeedbackVaryings(m_pendingProgram, m_feedbackVaryings.size(), m_feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+    glLinkProgram(m_pendingProgram);
 }
 
+shader_program::reload_status shader_program::finishReload() {
+    if (!m_pendingProgram) {
+        return RELOAD_NONE;
+    }
+    if (parallel_compile_supported()) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(m_pendingProgram, GL_COMPLETION_STATUS_KHR, &done);
+        if (done == GL_FALSE) {
+            return RELOAD_PENDING;
+        }
+    }
+    GLint success = GL_FALSE;
+    glGetProgramiv(m_pendingProgram, GL_LINK_STATUS, &success);
+    if (success == GL_FALSE) {
+        checkShader(m_pendingShaders[0], GL_COMPILE_STATUS, false, "Error compiling shader");
+        checkShader(m_pendingShaders[1], GL_COMPILE_STATUS, false, "Error compiling shader");
+        checkShader(m_pendingProgram, GL_LINK_STATUS, true, "Error linking shader program");
+        discardReload();
+        return RELOAD_FAILED;
+    }
+
+    gl_state::delete_program(m_program);
+    m_program = m_pendingProgram;
+    m_pendingProgram = 0;
+    for (GLuint& shader : m_pendingShaders) {
+        glDeleteShader(shader);
+        shader = 0;
+    }
+    m_vertexSource.swap(m_pendingVertexSource);
+    m_fragmentSource.swap(m_pendingFragmentSource);
+    vector<uniform_slot> previousSlots;
+    std::unordered_map<std::string, int> previousIndices;
+    previousSlots.swap(m_uniformSlots);
+    previousIndices.swap(m_uniformIndices);
+    finishLink();
+
+    // the uniforms set once, e.g. at start up, are not set again by the draws
+    use();
+    for (auto& entry : m_uniformIndices) {
+        auto previous = previousIndices.find(entry.first);
+        if (previous == previousIndices.end()) {
+            continue;
+        }
+        const uniform_slot& from = previousSlots[previous->second];
+        uniform_slot& to = m_uniformSlots[entry.second];
+        if (from.set && !to.set && from.type == to.type) {
+            memcpy(to.value, from.value, sizeof(to.value));
+            to.set = true;
+            uploadSlot(to);
+        }
+    }
+    generation++;
+    return RELOAD_SWAPPED;
+}
+
+void shader_program::discardReload() {
+    if (!m_pendingProgram) {
+        return;
+    }
+    glDeleteProgram(m_pendingProgram);
+    m_pendingProgram = 0;
+    for (GLuint& shader : m_pendingShaders) {
+        glDeleteShader(shader);
+        shader = 0;
+    }
+}
+
+void shader_program::uploadSlot(const uniform_slot& slot) {
+    switch (slot.type) {
+    case GL_FLOAT_MAT4:
+        glUniformMatrix4fv(slot.location, 1, GL_FALSE, reinterpret_cast<const GLfloat*>(slot.value));
+        break;
+    case GL_FLOAT_VEC4:
+        glUniform4fv(slot.location, 1, reinterpret_cast<const GLfloat*>(slot.value));
+        break;
+    case GL_FLOAT_VEC3:
+        glUniform3fv(slot.location, 1, reinterpret_cast<const GLfloat*>(slot.value));
+        break;
+    case GL_FLOAT:
+        glUniform1fv(slot.location, 1, reinterpret_cast<const GLfloat*>(slot.value));
+        break;
+    default:
+        // ints, booleans and samplers, the only other types setUniform() accepts
+        glUniform1iv(slot.location, 1, reinterpret_cast<const GLint*>(slot.value));
+        break;
+    }
+}
+
+unsigned int shader_program::getGeneration() const { return generation; }
+
 GLuint shader_program::getProgram() { return m_program; };
 bool shader_program::isLoaded() { return loaded; }
-void shader_program::loadShader(const char* path, GLuint shader) {
+std::string shader_program::readShader(const char* path) {
     std::string shaderSource;
     std::ifstream file;
     file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -217,7 +1126,10 @@ void shader_program::loadShader(const char* path, GLuint shader) {
     catch (std::ifstream::failure e) {
         std::cout << "Error reading shader file: " << path << std::endl;
     }
+    return shaderSource;
+}
 
+void shader_program::compileShader(GLuint shader, const std::string& shaderSource) {
     const char* source = shaderSource.c_str();
     glShaderSource(shader, 1, &source, NULL);
     glCompileShader(shader);
@@ -243,22 +1155,10 @@ void shader_program::checkShader(GLuint shader, GLuint flag, bool isProgram, con
 }
 
 
-GLint shader_program::getUniformLocation(const char* name) {
-    GLint loc;
-    if (m_uniforms.find(name) != m_uniforms.end()) {
-        loc = m_uniforms[name];
-    }
-    else {
-        loc = glGetUniformLocation(m_program, name);
-        m_uniforms[name] = loc;
-    }
-    return loc;
-};
-
 // -------------- texture_2d ------------------ //
 
 void texture_2d::loadTextureFromFile(const char* filename) {
-    glBindTexture(GL_TEXTURE_2D, texture);
+    gl_state::bind_texture(GL_TEXTURE_2D, texture);
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -282,7 +1182,7 @@ void texture_2d::loadTextureFromFile(const char* filename) {
 }
 
 void texture_2d::loadTextureFromData(const unsigned char* data) {
-    glBindTexture(GL_TEXTURE_2D, texture);
+    gl_state::bind_texture(GL_TEXTURE_2D, texture);
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -302,19 +1202,19 @@ void texture_2d::loadTextureFromData(const unsigned char* data) {
 }
 
 void texture_2d::use() {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    gl_state::active_texture(GL_TEXTURE0);
+    gl_state::bind_texture(GL_TEXTURE_2D, texture);
 }
 void texture_2d::unuse() {
-    glActiveTexture(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    gl_state::active_texture(GL_TEXTURE0);
+    gl_state::bind_texture(GL_TEXTURE_2D, 0);
 }
 
 texture_2d::texture_2d() {
     glGenTextures(1, &texture);
 }
 texture_2d::~texture_2d() {
-    glDeleteTextures(1, &texture);
+    gl_state::delete_textures(1, &texture);
 }
 
 
@@ -338,16 +1238,74 @@ geometry_buffer::~geometry_buffer() {
     deleteBuffers();
 }
 
+// the base destructor deletes the buffers of geometry_buffer, every destructor only deletes the buffers its constructor added
 instanced_geometry_buffer::~instanced_geometry_buffer() {
-    instanced_geometry_buffer::deleteBuffers();
+    gl_state::delete_buffers(1, &mbo);
 }
 
 void geometry_buffer::setDrawPatterns(vector<DrawPattern> drawPatterns) {
     this->drawPatterns = drawPatterns;
 }
 
+pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> geometry_buffer::optimize(bool report) {
+    pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> stats;
+    const size_t vertexCount = vertices.size();
+    auto accumulate = [](mesh_optimizer::cache_stats& total, const mesh_optimizer::cache_stats& pattern) {
+        total.triangles += pattern.triangles;
+        total.transformed += pattern.transformed;
+        total.uniqueVertices += pattern.uniqueVertices;
+        total.acmr = total.triangles ? total.transformed / static_cast<float>(total.triangles) : 0.0f;
+        total.atvr = total.uniqueVertices ? total.transformed / static_cast<float>(total.uniqueVertices) : 0.0f;
+    };
+
+    for (const DrawPattern& pattern : drawPatterns) {
+        if (pattern.drawMode != GL_TRIANGLES) {
+            continue;
+        }
+        accumulate(stats.first, mesh_optimizer::analyze_vertex_cache(indices, pattern.start, pattern.count, vertexCount));
+        mesh_optimizer::optimize_vertex_cache(indices, pattern.start, pattern.count, vertexCount);
+        mesh_optimizer::optimize_overdraw(indices, pattern.start, pattern.count, vertices);
+        accumulate(stats.second, mesh_optimizer::analyze_vertex_cache(indices, pattern.start, pattern.count, vertexCount));
+    }
+    remapVertices(mesh_optimizer::optimize_vertex_fetch(indices, vertexCount));
+
+    if (report) {
+        cout << "Mesh optimization: " << stats.first.triangles << " triangles, "
+            << "ACMR " << stats.first.acmr << " -> " << stats.second.acmr << ", "
+            << "ATVR " << stats.first.atvr << " -> " << stats.second.atvr << endl;
+    }
+    return stats;
+}
+
+void geometry_buffer::remapVertices(const vector<unsigned int>& remap) {
+    if (vertices.size() == remap.size()) mesh_optimizer::remap_vertices(vertices, remap);
+    if (colors.size() == remap.size()) mesh_optimizer::remap_vertices(colors, remap);
+    if (normals.size() == remap.size()) mesh_optimizer::remap_vertices(normals, remap);
+}
+
 void geometry_buffer::setVertices(vector<vec3>& vertices) {
     this->vertices = vertices;
+    invalidateBounds();
+}
+
+const bounding_box& geometry_buffer::meshBounds() {
+    if (meshBoundsVersion != boundsVersion) {
+        cachedMeshBounds = bounding_box::fromPoints(vertices);
+        meshBoundsVersion = boundsVersion;
+    }
+    return cachedMeshBounds;
+}
+
+bounding_box geometry_buffer::localBounds() {
+    return meshBounds();
+}
+
+void geometry_buffer::invalidateBounds() {
+    boundsVersion++;
+}
+
+unsigned int geometry_buffer::getBoundsVersion() const {
+    return boundsVersion;
 }
 
 void geometry_buffer::setColors(vector<vec3>& colors) {
@@ -362,67 +1320,230 @@ void geometry_buffer::setIndices(vector<unsigned int>& indices) {
     this->indices = indices;
 }
 
-void geometry_buffer::setShaderProgram(shader_program* sp) { this->sp = sp; }
+void geometry_buffer::setShaderProgram(shader_program* sp) {
+    this->sp = sp;
+    // streams uploaded before the program was known are pointed at its inputs now
+    if (sp && streams[vertex_format::ATTRIB_POSITION].buffer) {
+        bindVertexArray();
+        pointAttributes();
+        gl_state::bind_vertex_array(0);
+    }
+}
+
+void geometry_buffer::setPrimitiveRestart(bool enabled) { this->primitiveRestart = enabled; }
+
+void geometry_buffer::setVertexLayout(const vertex_format::vertex_layout& layout) { this->layout = layout; }
+
+void geometry_buffer::setBufferArena(buffer_arena* arena) {
+    if (arena == this->arena) {
+        return;
+    }
+    if (this->arena) {
+        for (buffer_arena::handle& range : arenaRanges) {
+            if (range != buffer_arena::INVALID_HANDLE) this->arena->free(range);
+            range = buffer_arena::INVALID_HANDLE;
+        }
+    }
+    this->arena = arena;
+    arenaGeneration = arena ? arena->getGeneration() : 0;
+}
+
+const vector<vec2>* geometry_buffer::textureCoordinates() const { return nullptr; }
+
+size_t geometry_buffer::indexSize() const {
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
+
+size_t geometry_buffer::indexOffset() const {
+    const buffer_arena::handle range = arenaRanges[vertex_format::ATTRIB_COUNT];
+    return arena && range != buffer_arena::INVALID_HANDLE ? arena->offset(range) : 0;
+}
+
+void geometry_buffer::applyPrimitiveRestart(bool drawing) {
+    if (!primitiveRestart) {
+        return;
+    }
+    if (drawing) {
+        gl_state::enable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(indexType == GL_UNSIGNED_SHORT ? 0xFFFF : mesh_optimizer::RESTART_INDEX);
+    }
+    else {
+        gl_state::disable(GL_PRIMITIVE_RESTART);
+    }
+}
 
 void geometry_buffer::updateBuffers() {
-    updateVerticesBuffer();
-    updateColorsBuffer();
-    updateNormalsBuffer();
+    invalidateBounds();
+    if (layout.interleaved) {
+        updateInterleavedBuffer();
+    }
+    else {
+        updateVerticesBuffer();
+        updateColorsBuffer();
+        updateNormalsBuffer();
+    }
     updateIndicesBuffer();
+    if (arena) {
+        arenaGeneration = arena->getGeneration();
+    }
     // unbind buffers
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+    gl_state::bind_vertex_array(0);
 }
 
 void geometry_buffer::draw() {
     bindVertexArray();
+    checkAttributes();
+    applyPrimitiveRestart(true);
     for (auto drawPattern : drawPatterns) {
-        glDrawElements(drawPattern.drawMode, drawPattern.count, GL_UNSIGNED_INT, (void*)(drawPattern.start * sizeof(unsigned int)));
+        glDrawElements(drawPattern.drawMode, drawPattern.count, indexType, (void*)(indexOffset() + drawPattern.start * indexSize()));
     }
+    applyPrimitiveRestart(false);
 }
 
 void geometry_buffer::updateVerticesBuffer() {
+    updateAttributeBuffer(vbo, vertex_format::ATTRIB_POSITION, vertices);
+}
+
+void geometry_buffer::updateColorsBuffer() {
+    updateAttributeBuffer(cbo, vertex_format::ATTRIB_COLOR, colors);
+}
+
+void geometry_buffer::updateNormalsBuffer() {
+    updateAttributeBuffer(nbo, vertex_format::ATTRIB_NORMAL, normals);
+}
+
+void geometry_buffer::updateAttributeBuffer(GLuint buffer, vertex_format::attribute a, const vector<vec3>& values) {
     bindVertexArray();
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3), vertices.data(), GL_STATIC_DRAW);
+    size_t offset;
+    if (layout.describe(a).type == GL_FLOAT) {
+        offset = uploadStream(a, buffer, GL_ARRAY_BUFFER, values.data(), values.size() * sizeof(vec3));
+    }
+    else {
+        vector<unsigned char> data = vertex_format::pack_stream(layout, a, values);
+        offset = uploadStream(a, buffer, GL_ARRAY_BUFFER, data.data(), data.size());
+    }
+    setAttributePointer(a, arena ? arena->buffer(arenaRanges[a]) : buffer, 0, offset);
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+}
 
+size_t geometry_buffer::uploadStream(size_t stream, GLuint buffer, GLenum target, const void* data, size_t size) {
+    if (!arena) {
+        gl_state::bind_buffer(target, buffer);
+        glBufferData(target, size, data, GL_STATIC_DRAW);
+        return 0;
+    }
+    arenaRanges[stream] = arena->reallocate(arenaRanges[stream], size);
+    arena->upload(arenaRanges[stream], data, size);
+    gl_state::bind_buffer(target, arena->buffer(arenaRanges[stream]));
+    return arena->offset(arenaRanges[stream]);
+}
+
+void geometry_buffer::pointArenaRanges() {
+    for (int i = 0; i < vertex_format::ATTRIB_COUNT; i++) {
+        vertex_format::attribute a = static_cast<vertex_format::attribute>(i);
+        // interleaved attributes all live in the range of the positions
+        const buffer_arena::handle range = arenaRanges[layout.interleaved ? vertex_format::ATTRIB_POSITION : a];
+        if (range == buffer_arena::INVALID_HANDLE || !streams[a].buffer) {
+            continue;
+        }
+        streams[a].buffer = arena->buffer(range);
+        streams[a].offset = arena->offset(range) + (layout.interleaved ? layout.offset(a) : 0);
+    }
     if (sp) {
-        GLuint vPosLoc = glGetAttribLocation(sp->getProgram(), "vPos");
-        glVertexAttribPointer(vPosLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(vPosLoc);
+        pointAttributes();
+    }
+    const buffer_arena::handle indexRange = arenaRanges[vertex_format::ATTRIB_COUNT];
+    if (indexRange != buffer_arena::INVALID_HANDLE) {
+        gl_state::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, arena->buffer(indexRange));
     }
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void geometry_buffer::updateColorsBuffer() {
+void geometry_buffer::updateInterleavedBuffer() {
     bindVertexArray();
-    glBindBuffer(GL_ARRAY_BUFFER, cbo);
-    glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(vec3), colors.data(), GL_STATIC_DRAW);
-    if (sp) {
-        GLuint vColorLoc = glGetAttribLocation(sp->getProgram(), "vColor");
-        glVertexAttribPointer(vColorLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(vColorLoc);
+    const vector<vec2>* uvs = textureCoordinates();
+    vector<unsigned char> data = vertex_format::pack_interleaved(layout, vertices, colors, normals, uvs);
+    const size_t offset = uploadStream(vertex_format::ATTRIB_POSITION, vbo, GL_ARRAY_BUFFER, data.data(), data.size());
+    const GLuint holder = arena ? arena->buffer(arenaRanges[vertex_format::ATTRIB_POSITION]) : vbo;
+    const GLsizei stride = layout.stride(uvs != nullptr);
+    const int count = uvs ? vertex_format::ATTRIB_COUNT : vertex_format::ATTRIB_UV;
+    for (int i = 0; i < count; i++) {
+        vertex_format::attribute a = static_cast<vertex_format::attribute>(i);
+        setAttributePointer(a, holder, stride, offset + layout.offset(a));
     }
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
 }
 
-void geometry_buffer::updateNormalsBuffer() {
-    bindVertexArray();
-    glBindBuffer(GL_ARRAY_BUFFER, nbo);
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(vec3), normals.data(), GL_STATIC_DRAW);
+void geometry_buffer::setAttributePointer(vertex_format::attribute a, GLuint buffer, GLsizei stride, size_t offset) {
+    streams[a].buffer = buffer;
+    streams[a].stride = stride;
+    streams[a].offset = offset;
     if (sp) {
-        GLuint vNormalLoc = glGetAttribLocation(sp->getProgram(), "vNormal");
-        glVertexAttribPointer(vNormalLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(vNormalLoc);
+        pointAttribute(a);
+    }
+}
+
+void geometry_buffer::pointAttribute(vertex_format::attribute a) {
+    const GLint location = sp->getAttributeLayout().attributes[a];
+    if (location < 0 || !streams[a].buffer) {
+        return;
+    }
+    const attribute_stream& stream = streams[a];
+    vertex_format::attribute_desc desc = layout.describe(a);
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, stream.buffer);
+    // separate streams are packed with the padding of the format, which GL does not infer from stride 0
+    glVertexAttribPointer(location, desc.size, desc.type, desc.normalized, stream.stride ? stream.stride : desc.bytes, (void*)stream.offset);
+    glEnableVertexAttribArray(location);
+}
+
+void geometry_buffer::pointAttributes() {
+    for (int i = 0; i < vertex_format::ATTRIB_COUNT; i++) {
+        pointAttribute(static_cast<vertex_format::attribute>(i));
+    }
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+void geometry_buffer::checkAttributes() {
+    if (!sp || (sp == checkedProgram && sp->getGeneration() == checkedGeneration)) {
+        return;
+    }
+    // a reloaded program can read its inputs from other locations
+    if (sp == checkedProgram) {
+        pointAttributes();
+    }
+    checkedProgram = sp;
+    checkedGeneration = sp->getGeneration();
+    const attribute_layout& inputs = sp->getAttributeLayout();
+    for (int i = 0; i < vertex_format::ATTRIB_COUNT; i++) {
+        vertex_format::attribute a = static_cast<vertex_format::attribute>(i);
+        if (inputs.attributes[a] >= 0 && !streams[a].buffer) {
+            std::cout << "Shader input " << vertex_format::attribute_name(a) << " has no stream in the geometry buffer" << std::endl;
+        }
+    }
+    for (const attribute_layout::input& in : inputs.inputs) {
+        if (attribute_layout::is_integer(in.type)) {
+            std::cout << "Shader input " << in.name << " is an integer, the geometry buffer only feeds float inputs" << std::endl;
+        }
     }
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void geometry_buffer::updateIndicesBuffer() {
     bindVertexArray();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // 0xFFFF is kept free as the 16 bit restart index
+    unsigned int maxIndex = 0;
+    for (unsigned int index : indices) {
+        if (index != mesh_optimizer::RESTART_INDEX) maxIndex = glm::max(maxIndex, index);
+    }
+    if (maxIndex < 0xFFFF) {
+        indexType = GL_UNSIGNED_SHORT;
+        vector<unsigned short> shortIndices(indices.begin(), indices.end());
+        uploadStream(vertex_format::ATTRIB_COUNT, ebo, GL_ELEMENT_ARRAY_BUFFER, shortIndices.data(), shortIndices.size() * sizeof(unsigned short));
+    }
+    else {
+        indexType = GL_UNSIGNED_INT;
+        uploadStream(vertex_format::ATTRIB_COUNT, ebo, GL_ELEMENT_ARRAY_BUFFER, indices.data(), indices.size() * sizeof(unsigned int));
+    }
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
 }
 
 void geometry_buffer::generateBuffers() {
@@ -434,27 +1555,45 @@ void geometry_buffer::generateBuffers() {
 }
 
 void geometry_buffer::deleteBuffers() {
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &cbo);
-    glDeleteBuffers(1, &nbo);
-    glDeleteBuffers(1, &ebo);
+    setBufferArena(nullptr);
+    gl_state::delete_vertex_arrays(1, &vao);
+    gl_state::delete_buffers(1, &vbo);
+    gl_state::delete_buffers(1, &cbo);
+    gl_state::delete_buffers(1, &nbo);
+    gl_state::delete_buffers(1, &ebo);
 }
 
 void geometry_buffer::bindVertexArray() {
-    glBindVertexArray(vao);
+    gl_state::bind_vertex_array(vao);
+    if (arena && arenaGeneration != arena->getGeneration()) {
+        arenaGeneration = arena->getGeneration();
+        pointArenaRanges();
+    }
 }
 
 
 void instanced_geometry_buffer::setTransformations(vector<mat4>& matrices) {
     this->matrices = matrices;
+    invalidateBounds();
+}
+
+bounding_box instanced_geometry_buffer::localBounds() {
+    if (instanceBoundsVersion != boundsVersion) {
+        const bounding_box& mesh = meshBounds();
+        cachedInstanceBounds = bounding_box();
+        for (const mat4& instance : matrices) {
+            cachedInstanceBounds.expand(mesh.transformed(instance));
+        }
+        instanceBoundsVersion = boundsVersion;
+    }
+    return cachedInstanceBounds;
 }
 
 void instanced_geometry_buffer::updateBuffers() {
     geometry_buffer::updateBuffers();
     bindVertexArray();
     updateMatricesBuffers();
-    glBindVertexArray(0);
+    gl_state::bind_vertex_array(0);
 }
 
 void instanced_geometry_buffer::generateBuffers() {
@@ -464,56 +1603,392 @@ void instanced_geometry_buffer::generateBuffers() {
 
 void instanced_geometry_buffer::deleteBuffers() {
     geometry_buffer::deleteBuffers();
-    glDeleteBuffers(1, &mbo);
+    gl_state::delete_buffers(1, &mbo);
 }
 
 
 void instanced_geometry_buffer::draw() {
     bindVertexArray();
+    checkAttributes();
+    if (sp) {
+        sp->setUniform(sp->getCommonUniforms().instanceFormat, static_cast<int>(instanceFormat));
+    }
+    applyPrimitiveRestart(true);
+    if (compacted && !lodLevels.empty()) {
+        // there is no base instance in OpenGL 3.3, the instance attributes are offset to the first instance of every level
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, instanceBuffer());
+        size_t firstInstance = 0;
+        for (size_t level = 0; level < lodLevels.size(); level++) {
+            if (lodCounts[level] == 0) {
+                continue;
+            }
+            if (sp) {
+                setInstanceAttributes(firstInstance);
+            }
+            for (auto drawPattern : lodLevels[level].drawPatterns) {
+                glDrawElementsInstanced(drawPattern.drawMode, drawPattern.count, indexType, (void*)(indexOffset() + drawPattern.start * indexSize()), lodCounts[level]);
+            }
+            firstInstance += lodCounts[level];
+        }
+        if (sp) {
+            setInstanceAttributes();
+        }
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+    else {
+        for (auto drawPattern : drawPatterns) {
+            glDrawElementsInstanced(drawPattern.drawMode, drawPattern.count, indexType, (void*)(indexOffset() + drawPattern.start * indexSize()), visibleCount);
+        }
+    }
+    applyPrimitiveRestart(false);
+    if (streaming) {
+        instanceStream.fence();
+    }
+}
 
-    for (auto drawPattern : drawPatterns) {
-        glDrawElementsInstanced(drawPattern.drawMode, drawPattern.count, GL_UNSIGNED_INT, (void*)(drawPattern.start * sizeof(unsigned int)), matrices.size());
+void instanced_geometry_buffer::setInstanceFormat(vertex_format::instance_format format) {
+    this->requestedFormat = format;
+}
+
+vertex_format::instance_format instanced_geometry_buffer::getInstanceFormat() const {
+    return instanceFormat;
+}
+
+const vector<mat4>& instanced_geometry_buffer::getTransformations() const {
+    return matrices;
+}
+
+void instanced_geometry_buffer::setStreaming(bool enabled, stream_buffer::mode mode) {
+    const bool changed = enabled != streaming || (enabled && mode != instanceStream.getMode());
+    streaming = enabled;
+    instanceStream.setMode(mode);
+    if (changed && !matrices.empty()) {
+        updateMatricesBuffers();
+    }
+}
+
+bool instanced_geometry_buffer::isStreaming() const {
+    return streaming;
+}
+
+stream_buffer::statistics instanced_geometry_buffer::getStreamStatistics() const {
+    return instanceStream.getStatistics();
+}
+
+GLuint instanced_geometry_buffer::instanceBuffer() const {
+    return streaming ? instanceStream.buffer() : mbo;
+}
+
+void instanced_geometry_buffer::streamInstances(const vector<unsigned char>& data) {
+    instanceOffset = instanceStream.write(data.data(), data.size());
+    geometry_buffer::bindVertexArray();
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, instanceStream.buffer());
+    if (sp) {
+        setInstanceAttributes();
     }
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
 }
 
 void instanced_geometry_buffer::updateMatricesBuffers() {
     geometry_buffer::bindVertexArray();
-    // bind matrices buffer
-    glBindBuffer(GL_ARRAY_BUFFER, mbo);
-    glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(mat4), matrices.data(), GL_STATIC_DRAW);
-    GLuint vInstanceLoc = glGetAttribLocation(sp->getProgram(), "instanceTransform");
-    // attribute pointers for matrix (4 times vec4)
+    instanceFormat = requestedFormat == vertex_format::INSTANCE_AUTO
+        ? vertex_format::detect_instance_format(matrices, 0, matrices.size())
+        : requestedFormat;
+    vector<unsigned char> data(matrices.size() * vertex_format::instance_stride(instanceFormat));
+    vertex_format::pack_instances(instanceFormat, matrices.data(), matrices.size(), data.data());
+    if (streaming) {
+        streamInstances(data);
+    }
+    else {
+        // bind matrices buffer
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, mbo);
+        glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+        instanceOffset = 0;
+        if (sp) {
+            setInstanceAttributes();
+        }
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+    visibleCount = matrices.size();
+    compacted = false;
+}
+
+void instanced_geometry_buffer::setInstanceAttributes(size_t firstInstance) {
+    const GLint vInstanceLoc = sp->getAttributeLayout().instanceTransform;
+    if (vInstanceLoc < 0) {
+        return;
+    }
+    const GLsizei stride = vertex_format::instance_stride(instanceFormat);
+    size_t offset = instanceOffset + firstInstance * stride;
+    // compact formats only fill the first columns, the shader expands them to a matrix
     for (int i = 0; i < 4; i++) {
-        // matrix attribute
+        GLint size = vertex_format::instance_column_size(instanceFormat, i);
+        if (size == 0) {
+            glDisableVertexAttribArray(vInstanceLoc + i);
+            continue;
+        }
         glEnableVertexAttribArray(vInstanceLoc + i);
-        glVertexAttribPointer(vInstanceLoc + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+        glVertexAttribPointer(vInstanceLoc + i, size, GL_FLOAT, GL_FALSE, stride, (void*)offset);
         glVertexAttribDivisor(vInstanceLoc + i, 1);
+        offset += size * sizeof(float);
+    }
+}
+
+void instanced_geometry_buffer::pointAttributes() {
+    geometry_buffer::pointAttributes();
+    if (!matrices.empty()) {
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, instanceBuffer());
+        setInstanceAttributes();
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
     }
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void instanced_geometry_buffer::updatePartialMatrices(int start, int end) {
-    geometry_buffer::bindVertexArray();
-    // bind matrices buffer
-    glBindBuffer(GL_ARRAY_BUFFER, mbo);
-    glBufferSubData(GL_ARRAY_BUFFER, start * sizeof(mat4), (end - start) * sizeof(mat4), matrices.data() + start);
+    updatePartialMatrices(vector<pair<int, int>> { { start, end } });
 }
 
 void instanced_geometry_buffer::updatePartialMatrices(vector<pair<int, int>> ranges) {
+    invalidateBounds();
+    // matrices that do not fit the uploaded format any more need a full upload in a more general one
+    if (requestedFormat == vertex_format::INSTANCE_AUTO) {
+        for (auto range : ranges) {
+            vertex_format::instance_format format = vertex_format::detect_instance_format(matrices, range.first, range.second);
+            if (vertex_format::most_general(instanceFormat, format) != instanceFormat) {
+                updateMatricesBuffers();
+                return;
+            }
+        }
+    }
+    // the compacted buffer is rewritten by the next cull()
+    if (cullingEnabled || !lodLevels.empty()) {
+        return;
+    }
+    // a streamed upload goes to a new region, which has to hold every instance
+    if (streaming) {
+        updateMatricesBuffers();
+        return;
+    }
     geometry_buffer::bindVertexArray();
     // bind matrices buffer
-    glBindBuffer(GL_ARRAY_BUFFER, mbo);
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, mbo);
+    const GLsizei stride = vertex_format::instance_stride(instanceFormat);
+    vector<unsigned char> data;
     for (auto range : ranges) {
-        glBufferSubData(GL_ARRAY_BUFFER, range.first * sizeof(mat4), (range.second - range.first) * sizeof(mat4), matrices.data() + range.first);
+        data.resize((range.second - range.first) * stride);
+        vertex_format::pack_instances(instanceFormat, matrices.data() + range.first, range.second - range.first, data.data());
+        glBufferSubData(GL_ARRAY_BUFFER, range.first * stride, data.size(), data.data());
+    }
+}
+
+void instanced_geometry_buffer::setCulling(bool enabled) {
+    if (enabled == cullingEnabled) {
+        return;
+    }
+    cullingEnabled = enabled;
+    // restore every instance in the buffer, with levels of detail cull() keeps compacting them
+    if (!enabled && compacted && lodLevels.empty()) {
+        updateMatricesBuffers();
+    }
+}
+
+size_t instanced_geometry_buffer::getVisibleCount() const {
+    return visibleCount;
+}
+
+void instanced_geometry_buffer::setLodLevels(const vector<lod_level>& levels, float hysteresis) {
+    if (levels.size() > 0xFF) {
+        cout << "At most 255 levels of detail are supported" << endl;
+        throw std::invalid_argument("Too many levels of detail");
+    }
+    lodLevels = levels;
+    lodHysteresis = hysteresis;
+    lodCounts.assign(levels.size(), 0);
+    instanceLod.clear();
+    // restore every instance in the buffer
+    if (levels.empty() && !cullingEnabled && compacted) {
+        updateMatricesBuffers();
+    }
+}
+
+const vector<size_t>& instanced_geometry_buffer::getLodCounts() const {
+    return lodCounts;
+}
+
+void instanced_geometry_buffer::sortByLod(const vec3& viewPosition) {
+    const unsigned char levels = static_cast<unsigned char>(lodLevels.size());
+    if (instanceLod.size() != matrices.size()) {
+        // no previous level, picked without hysteresis
+        instanceLod.assign(matrices.size(), 0xFF);
     }
+    const vec3 center = meshBounds().getCenter();
+    parallel_for(0, static_cast<int>(visibleCount), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const unsigned int instance = visibleInstances[i];
+            const float distance = length(vec3(matrices[instance] * vec4(center, 1.0f)) - viewPosition);
+            unsigned char level = 0;
+            while (level + 1 < levels && distance >= lodLevels[level].maxDistance) level++;
+            const unsigned char previous = instanceLod[instance];
+            // stay at the previous level while within the hysteresis band around its boundaries
+            if (previous < levels && previous != level) {
+                const float outer = previous + 1 < levels ? lodLevels[previous].maxDistance * (1.0f + lodHysteresis) : INFINITY;
+                const float inner = previous > 0 ? lodLevels[previous - 1].maxDistance * (1.0f - lodHysteresis) : -INFINITY;
+                if (inner <= distance && distance < outer) level = previous;
+            }
+            instanceLod[instance] = level;
+        }
+    }, 8192);
+
+    // counting sort of the visible instances by level
+    lodCounts.assign(levels, 0);
+    for (size_t i = 0; i < visibleCount; i++) {
+        lodCounts[instanceLod[visibleInstances[i]]]++;
+    }
+    vector<size_t> next(levels, 0);
+    for (unsigned char level = 1; level < levels; level++) {
+        next[level] = next[level - 1] + lodCounts[level - 1];
+    }
+    lodOrder.resize(visibleCount);
+    for (size_t i = 0; i < visibleCount; i++) {
+        lodOrder[next[instanceLod[visibleInstances[i]]]++] = visibleInstances[i];
+    }
+    visibleInstances.swap(lodOrder);
 }
 
+size_t instanced_geometry_buffer::cull(const mat4& clipFromObject, const vec3& viewPosition) {
+    if (!cullingEnabled && lodLevels.empty()) {
+        return visibleCount;
+    }
+    if (cullingEnabled) {
+        if (instanceSetVersion != boundsVersion) {
+            const bounding_box& mesh = meshBounds();
+            instanceSet.build(matrices, mesh.getMin(), mesh.getMax());
+            instanceSetVersion = boundsVersion;
+        }
+        visibleCount = instanceSet.cull(culling::frustum::from_matrix(clipFromObject), visibleInstances, occlusionTest);
+    }
+    else {
+        visibleCount = matrices.size();
+        visibleInstances.resize(visibleCount);
+        for (size_t i = 0; i < visibleCount; i++) visibleInstances[i] = static_cast<unsigned int>(i);
+    }
+    if (!lodLevels.empty()) {
+        sortByLod(viewPosition);
+    }
+
+    const GLsizei stride = vertex_format::instance_stride(instanceFormat);
+    visibleData.resize(visibleCount * stride);
+    parallel_for(0, static_cast<int>(visibleCount), [&](int begin, int end) {
+        vertex_format::pack_instances(instanceFormat, matrices.data(), visibleInstances.data() + begin, end - begin, visibleData.data() + begin * stride);
+    }, 8192);
+    if (streaming) {
+        streamInstances(visibleData);
+    }
+    else {
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, mbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, visibleData.size(), visibleData.data());
+        gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+    compacted = true;
+    return visibleCount;
+}
+
+// the base constructor generated the buffers of geometry_buffer, generateBuffers() would generate them again
 instanced_geometry_buffer::instanced_geometry_buffer() : geometry_buffer() {
-    generateBuffers();
-};
+    glGenBuffers(1, &mbo);
+}
+
+instanced_geometry_buffer::instanced_geometry_buffer(
+    vector<vec3> vertices,
+    vector<vec3> colors,
+    vector<vec3> normals,
+    vector<unsigned int> indices
+) : geometry_buffer(vertices, colors, normals, indices) {
+    glGenBuffers(1, &mbo);
+}
+
+spline_geometry_buffer::spline_geometry_buffer(int approxM, vec3 color, vec3 normal) :
+    geometry_buffer(),
+    approxM(approxM),
+    color(color),
+    normal(normal) { }
+
+void spline_geometry_buffer::setControlPoints(vector<array<vec3, 4>>& controlPoints) {
+    this->controlPoints = controlPoints;
+    invalidateBounds();
+}
+
+bounding_box spline_geometry_buffer::localBounds() {
+    bounding_box bounds;
+    for (const array<vec3, 4>& curve : controlPoints) {
+        for (const vec3& point : curve) bounds.expand(point);
+    }
+    return bounds;
+}
+
+void spline_geometry_buffer::updateBuffers() {
+    invalidateBounds();
+    bindVertexArray();
+    // control points of every instance are stored in vbo, 4 vec3 per instance
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, controlPoints.size() * sizeof(array<vec3, 4>), controlPoints.data(), GL_STATIC_DRAW);
+    if (sp) {
+        pointAttributes();
+    }
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+    gl_state::bind_vertex_array(0);
+}
+
+void spline_geometry_buffer::pointAttributes() {
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, vbo);
+    const char* names[4] = { "cp0", "cp1", "cp2", "cp3" };
+    for (int i = 0; i < 4; i++) {
+        const GLint cpLoc = sp->getAttributeLayout().location(names[i]);
+        if (cpLoc < 0) {
+            std::cout << "Shader input " << names[i] << " is missing, the control points are not drawn" << std::endl;
+            continue;
+        }
+        glVertexAttribPointer(cpLoc, 3, GL_FLOAT, GL_FALSE, sizeof(array<vec3, 4>), (void*)(sizeof(vec3) * i));
+        glVertexAttribDivisor(cpLoc, 1);
+        glEnableVertexAttribArray(cpLoc);
+    }
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+void spline_geometry_buffer::draw() {
+    bindVertexArray();
+    checkAttributes();
+    if (sp) {
+        // the handles are resolved once per program and again after it is reloaded
+        if (sp != uniformsProgram || sp->getGeneration() != uniformsGeneration) {
+            uniformsProgram = sp;
+            uniformsGeneration = sp->getGeneration();
+            uniforms.approxM = sp->getUniformHandle<int>("approxM");
+            uniforms.color = sp->getUniformHandle<vec3>("splineColor");
+            uniforms.normal = sp->getUniformHandle<vec3>("splineNormal");
+        }
+        sp->setUniform(uniforms.approxM, approxM);
+        sp->setUniform(uniforms.color, color);
+        sp->setUniform(uniforms.normal, normal);
+    }
+    // no per vertex attributes, the curve points are evaluated from gl_VertexID
+    glDrawArraysInstanced(drawMode, 0, approxM, controlPoints.size());
+}
 
 textured_geometry_buffer::textured_geometry_buffer() : instanced_geometry_buffer() {
-    generateBuffers();
+    glGenBuffers(1, &tbo);
+}
+
+textured_geometry_buffer::textured_geometry_buffer(
+    vector<vec3> vertices,
+    vector<vec3> colors,
+    vector<vec3> normals,
+    vector<unsigned int> indices
+) : instanced_geometry_buffer(vertices, colors, normals, indices) {
+    glGenBuffers(1, &tbo);
+}
+
+textured_geometry_buffer::~textured_geometry_buffer() {
+    gl_state::delete_buffers(1, &tbo);
 }
 void textured_geometry_buffer::generateBuffers() {
     instanced_geometry_buffer::generateBuffers();
@@ -521,13 +1996,23 @@ void textured_geometry_buffer::generateBuffers() {
 }
 void textured_geometry_buffer::updateBuffers() {
     instanced_geometry_buffer::updateBuffers();
-    updateTextureCoordinatesBuffer();
-    glBindVertexArray(0);
+    // interleaved layouts already packed the texture coordinates into vbo
+    if (!layout.interleaved) {
+        updateTextureCoordinatesBuffer();
+    }
+    gl_state::bind_vertex_array(0);
 }
 
 void textured_geometry_buffer::setTextureCoodinates(vector<vec2>& tex_coords) {
     this->tex_coords = tex_coords;
 }
+void textured_geometry_buffer::remapVertices(const vector<unsigned int>& remap) {
+    geometry_buffer::remapVertices(remap);
+    if (tex_coords.size() == remap.size()) mesh_optimizer::remap_vertices(tex_coords, remap);
+}
+
+const vector<vec2>* textured_geometry_buffer::textureCoordinates() const { return &tex_coords; }
+
 void textured_geometry_buffer::loadTextureFromFile(const char* texture_path) {
     texture.loadTextureFromFile(texture_path);
 }
@@ -538,41 +2023,32 @@ void textured_geometry_buffer::loadTextureFromData(const unsigned char* data) {
 
 void textured_geometry_buffer::updateTextureCoordinatesBuffer() {
     bindVertexArray();
-    glBindBuffer(GL_ARRAY_BUFFER, tbo);
-    glBufferData(GL_ARRAY_BUFFER, tex_coords.size() * sizeof(vec2), tex_coords.data(), GL_STATIC_DRAW);
-    if (sp) {
-        GLuint vTexCoordLoc = glGetAttribLocation(sp->getProgram(), "vTexCoord");
-        glVertexAttribPointer(vTexCoordLoc, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(vTexCoordLoc);
-    }
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    vector<unsigned char> data = vertex_format::pack_stream(layout, tex_coords);
+    const size_t offset = uploadStream(vertex_format::ATTRIB_UV, tbo, GL_ARRAY_BUFFER, data.data(), data.size());
+    setAttributePointer(vertex_format::ATTRIB_UV, arena ? arena->buffer(arenaRanges[vertex_format::ATTRIB_UV]) : tbo, 0, offset);
+    gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
 
 }
 
 
 void textured_geometry_buffer::deleteBuffers() {
     instanced_geometry_buffer::deleteBuffers();
-    glDeleteBuffers(1, &tbo);
+    gl_state::delete_buffers(1, &tbo);
 }
 
 
 instanced_geometry_buffer* light_props::createSource(light_props& props, shader_program* sp) {
     instanced_geometry_buffer* source_gb = new instanced_geometry_buffer();
-    vector<vec3> vertices = geometry::sphere(props.position, 0.08, 400, 400);
-    vector<vec3> colors(vertices.size(), props.color);
-    vector<vec3> normals;
-    vector<unsigned int> indices;
+    // the icosphere is already reordered by geometry::optimize_mesh
+    geometry::mesh gizmo = geometry::icosphere_mesh(props.position, 0.08, geometry::DETAIL_MEDIUM);
+    vector<vec3> colors(gizmo.vertices.size(), props.color);
     vector<mat4> transforms{mat4(1.0f)};
-    for (int i = 0; i < vertices.size(); i++) {
-        vec3& pointOnSphere = vertices[i];
-        normals.push_back(normalize(pointOnSphere));
-        indices.push_back(i);
-    }
-    source_gb->setVertices(vertices);
+    source_gb->setVertices(gizmo.vertices);
     source_gb->setColors(colors);
-    source_gb->setNormals(normals);
-    source_gb->setIndices(indices);
+    source_gb->setNormals(gizmo.normals);
+    source_gb->setIndices(gizmo.indices);
     source_gb->setTransformations(transforms);
+    source_gb->setDrawPatterns(vector<DrawPattern> { { GL_TRIANGLES, /* start */ 0, /* count */ gizmo.indices.size() } });
     source_gb->setShaderProgram(sp);
     source_gb->updateBuffers();
 
@@ -586,18 +2062,44 @@ scene_obj::scene_obj(geometry_buffer* gb) : gb((gb)) {}
 scene_obj::scene_obj() : gb(new geometry_buffer()) {}
 scene_obj::~scene_obj() { if (boundingBox) delete boundingBox;  if (gb) delete gb; }
 
-bounding_box* scene_obj::b_box(vector<vec3> points) {
-    bounding_box* b = new bounding_box();
-    b->xMin = b->yMin = b->zMin = 1000000;
-    b->xMax = b->yMax = b->zMax = -1000000;
-    for (int i = 0; i < points.size(); i++) {
-        b->xMin = min(b->xMin, points[i].x);
-        b->yMin = min(b->yMin, points[i].y);
-        b->zMin = min(b->zMin, points[i].z);
-
-        b->xMax = max(b->xMax, points[i].x);
-        b->yMax = max(b->yMax, points[i].y);
-        b->zMax = max(b->zMax, points[i].z);
+bounding_box* scene_obj::b_box(const vector<vec3>& points) {
+    return new bounding_box(bounding_box::fromPoints(points));
+}
+
+bounding_box bounding_box::fromPoints(const vector<vec3>& points) {
+    bounding_box b;
+    const size_t n = points.size();
+    size_t i = 0;
+#if defined(__SSE2__)
+    static_assert(sizeof(vec3) == 3 * sizeof(float), "points are packed floats");
+    if (n >= 4) {
+        // 4 points are 12 floats, loaded as x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3, every lane of the 3
+        // registers keeps the min and max of one coordinate, the lanes are sorted out once at the end
+        const float* p = &points[0].x;
+        __m128 lo[3] = { _mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8) };
+        __m128 hi[3] = { lo[0], lo[1], lo[2] };
+        for (i = 4; i + 4 <= n; i += 4) {
+            p = &points[i].x;
+            for (int r = 0; r < 3; r++) {
+                const __m128 v = _mm_loadu_ps(p + 4 * r);
+                lo[r] = _mm_min_ps(lo[r], v);
+                hi[r] = _mm_max_ps(hi[r], v);
+            }
+        }
+        float minimum[12], maximum[12];
+        for (int r = 0; r < 3; r++) {
+            _mm_storeu_ps(minimum + 4 * r, lo[r]);
+            _mm_storeu_ps(maximum + 4 * r, hi[r]);
+        }
+        // lane k of the 12 holds coordinate k % 3
+        for (int k = 0; k < 12; k += 3) {
+            b.expand(vec3(minimum[k], minimum[k + 1], minimum[k + 2]));
+            b.expand(vec3(maximum[k], maximum[k + 1], maximum[k + 2]));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        b.expand(points[i]);
     }
     return b;
 }
@@ -609,9 +2111,68 @@ bool bounding_box::contains(vec3 point) {
         zMin <= point.z && point.z <= zMax;
 }
 
+vec3 bounding_box::getMin() const { return vec3(xMin, yMin, zMin); }
+vec3 bounding_box::getMax() const { return vec3(xMax, yMax, zMax); }
+vec3 bounding_box::getCenter() const { return 0.5f * (getMin() + getMax()); }
+vec3 bounding_box::getExtent() const { return 0.5f * (getMax() - getMin()); }
+
+bool bounding_box::isEmpty() const {
+    return xMin > xMax || yMin > yMax || zMin > zMax;
+}
+
+float bounding_box::surfaceArea() const {
+    if (isEmpty()) {
+        return 0.0f;
+    }
+    const vec3 size = getMax() - getMin();
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+bool bounding_box::intersects(const bounding_box& other) const {
+    return
+        xMin <= other.xMax && other.xMin <= xMax &&
+        yMin <= other.yMax && other.yMin <= yMax &&
+        zMin <= other.zMax && other.zMin <= zMax;
+}
+
+void bounding_box::expand(vec3 point) {
+    xMin = min(xMin, point.x); yMin = min(yMin, point.y); zMin = min(zMin, point.z);
+    xMax = max(xMax, point.x); yMax = max(yMax, point.y); zMax = max(zMax, point.z);
+}
+
+void bounding_box::expand(const bounding_box& other) {
+    xMin = min(xMin, other.xMin); yMin = min(yMin, other.yMin); zMin = min(zMin, other.zMin);
+    xMax = max(xMax, other.xMax); yMax = max(yMax, other.yMax); zMax = max(zMax, other.zMax);
+}
+
+bounding_box bounding_box::transformed(const mat4& transform) const {
+    bounding_box result;
+    if (isEmpty()) {
+        return result;
+    }
+    for (int corner = 0; corner < 8; corner++) {
+        const vec3 point(corner & 1 ? xMax : xMin, corner & 2 ? yMax : yMin, corner & 4 ? zMax : zMin);
+        result.expand(vec3(transform * vec4(point, 1.0f)));
+    }
+    return result;
+}
+
+const bounding_box& scene_obj::worldBoundingBox() {
+    if (!gb) {
+        worldBounds = bounding_box();
+        return worldBounds;
+    }
+    if (worldBoundsDirty || worldBoundsVersion != gb->getBoundsVersion()) {
+        worldBounds = (boundingBox ? *boundingBox : gb->localBounds()).transformed(getModel());
+        worldBoundsVersion = gb->getBoundsVersion();
+        worldBoundsDirty = false;
+    }
+    return worldBounds;
+}
+
 void scene_obj::setGeometryBuffer(geometry_buffer* gb) {
     this->gb = gb;
-    this->boundingBox = b_box(gb->vertices);
+    worldBoundsDirty = true;
 }
 
 const mat4& scene_obj::getModel() const {
@@ -639,31 +2200,61 @@ void scene_obj::scale(vec3 scale) {
 
 void scene_obj::setModel(mat4 model) {
     this->model = model;
+    worldBoundsDirty = true;
 }
 
 void scene_obj::draw() {
+    if (depthTest) {
+        gl_state::enable(GL_DEPTH_TEST);
+    }
+    else {
+        gl_state::disable(GL_DEPTH_TEST);
+    }
     if (gb->sp) {
         gb->sp->use();
-        gb->sp->setUniform("material.ambientStrength", getMaterialProperties().ambientStrength);
-        gb->sp->setUniform("material.diffuseStrength", getMaterialProperties().diffuseStrength);
-        gb->sp->setUniform("material.specularStrength", getMaterialProperties().specularStrength);
-        gb->sp->setUniform("mModel", getModel());
+        applyMaterial();
+        applyUniforms();
 
-        if (static_cast<textured_geometry_buffer*>(gb)) {
-            textured_geometry_buffer* tgb = static_cast<textured_geometry_buffer*>(gb);
+        if (textured_geometry_buffer* tgb = dynamic_cast<textured_geometry_buffer*>(gb)) {
             tgb->texture.use();
-            gb->sp->setUniform("textureSampler", 0);
         }
     }
     gb->draw();
-    glUseProgram(0);
-    if (static_cast<textured_geometry_buffer*>(gb)) {
-        textured_geometry_buffer* tgb = static_cast<textured_geometry_buffer*>(gb);
+    gl_state::use_program(0);
+    if (textured_geometry_buffer* tgb = dynamic_cast<textured_geometry_buffer*>(gb)) {
         tgb->texture.unuse();
     }
 }
 
 
+void scene_obj::applyMaterial() {
+    materialBuffer.update(uniform_blocks::material(getMaterialProperties()));
+    materialBuffer.bind(uniform_blocks::MATERIAL_BINDING);
+}
+
+void scene_obj::applyUniforms() {
+    const shader_program::common_uniforms& uniforms = gb->sp->getCommonUniforms();
+    gb->sp->setUniform(uniforms.model, getModel());
+    gb->sp->setUniform(uniforms.normalEncoding, gb->layout.normalEncoding());
+    if (getTexture()) {
+        gb->sp->setUniform(uniforms.textureSampler, 0);
+    }
+}
+
+GLuint scene_obj::getTexture() const {
+    if (textured_geometry_buffer* tgb = dynamic_cast<textured_geometry_buffer*>(gb)) {
+        return tgb->texture.texture;
+    }
+    return 0;
+}
+
+size_t scene_obj::cull(const mat4& viewProjection, const vec3& viewPosition) {
+    if (instanced_geometry_buffer* igb = dynamic_cast<instanced_geometry_buffer*>(gb)) {
+        return igb->cull(viewProjection * getModel(), vec3(inverse(getModel()) * vec4(viewPosition, 1.0f)));
+    }
+    return 1;
+}
+
 void scene_obj::setMaterialProperties(material_props& materialProperties) {
     this->materialProperties = materialProperties;
 }
@@ -2,15 +2,31 @@
 #define _GRAPHICS
 #define GL_SILENCE_DEPRECATION
 #include <iostream>
+#ifdef __APPLE__
 #include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
 #include <fstream>
 #include <sstream>
 #include <GLFW/glfw3.h>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+#include <array>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include "_mesh_optimizer.hpp"
+#include "_vertex_format.hpp"
+#include "_culling.hpp"
+#include "_gl_state.hpp"
+#include "_buffer_arena.hpp"
+#include "_stream_buffer.hpp"
+#include "_uniform_buffer.hpp"
 using namespace std;
 using namespace glm;
 
@@ -72,6 +88,62 @@ struct material_props {
         specularStrength(specularStrength) { }
 };
 
+/**
+ * @brief The uniform blocks Lights and Material of the fragment shaders, laid out with the std140 rules.
+ *
+ * Every shader_program binds the blocks to the same binding points when it is linked, so the blocks are uploaded
+ * once to a uniform_buffer and read by all programs. The pad members fill the gaps std140 leaves after a vec3 and
+ * at the end of structures, every member is initialised so that equal blocks have equal bytes.
+ */
+namespace uniform_blocks {
+    const GLuint LIGHTS_BINDING = 0;
+    const GLuint MATERIAL_BINDING = 1;
+    /**
+     * @brief The size of the lights array of the Lights block, further lights are ignored.
+     */
+    const int MAX_LIGHTS = 10;
+
+    struct light {
+        vec3 position = vec3(0.0f);
+        float pad0 = 0.0f;
+        vec3 color = vec3(0.0f);
+        int type = 0;
+        vec3 direction = vec3(0.0f);
+        float cutOff = 0.0f;
+        float outerCutOff = 0.0f;
+        float constant = 0.0f;
+        float linear = 0.0f;
+        float quadratic = 0.0f;
+        float ambientCoeff = 0.0f;
+        float diffuseCoeff = 0.0f;
+        float specularCoeff = 0.0f;
+        float pad1 = 0.0f;
+        light() {}
+        light(const light_props& props);
+    };
+
+    struct lights {
+        light entries[MAX_LIGHTS];
+        int numLights = 0;
+        float pad0[3] = { 0.0f, 0.0f, 0.0f };
+        vec3 viewPos = vec3(0.0f);
+        float pad1 = 0.0f;
+        lights(const vector<light_props>& props, vec3 viewPosition);
+    };
+
+    struct material {
+        float ambientStrength = 0.0f;
+        float diffuseStrength = 0.0f;
+        float specularStrength = 0.0f;
+        float pad0 = 0.0f;
+        material(const material_props& props);
+    };
+
+    static_assert(sizeof(light) == 80, "std140 light_props is 80 bytes");
+    static_assert(sizeof(lights) == 832, "std140 Lights block is 832 bytes");
+    static_assert(sizeof(material) == 16, "std140 Material block is 16 bytes");
+}
+
 
 namespace geometry {
     /**
@@ -83,7 +155,116 @@ namespace geometry {
         @return The blending factor for the given parameter value 'u'.
     **/
     float b_spline_blend(float u, int k, int d, vector<float>& knots);
-    vector<vec3> b_spline(vector<vec3> cp, vector<float> knots, int approxM);
+
+    /**
+        @brief Finds the knot span containing 'u' using a binary search over the knot vector.
+        Parameters outside the valid domain [knots[degree], knots[numControlPoints]] are clamped to the first/last span.
+        @param u The parameter value.
+        @param degree The degree of the B-spline basis functions.
+        @param knots The (non-decreasing) knot vector.
+        @param numControlPoints The number of control points of the curve.
+        @return The index 'i' of the span such that knots[i] <= u < knots[i + 1].
+    **/
+    int b_spline_find_span(float u, int degree, const vector<float>& knots, int numControlPoints);
+
+    /**
+        @brief Computes the degree + 1 basis functions that are non-zero on the given knot span.
+        @param span The knot span returned by b_spline_find_span.
+        @param u The parameter value.
+        @param degree The degree of the B-spline basis functions.
+        @param knots The knot vector.
+        @param N Output array of degree + 1 values, N[j] is the blend of control point span - degree + j.
+    **/
+    void b_spline_basis(int span, float u, int degree, const vector<float>& knots, float* N);
+
+    /**
+        @brief Computes the degree + 1 non-zero basis functions and their first derivatives with respect to 'u'.
+        @param span The knot span returned by b_spline_find_span.
+        @param u The parameter value.
+        @param degree The degree of the B-spline basis functions.
+        @param knots The knot vector.
+        @param N Output array of degree + 1 basis values.
+        @param dN Output array of degree + 1 basis derivatives.
+    **/
+    void b_spline_basis_derivatives(int span, float u, int degree, const vector<float>& knots, float* N, float* dN);
+
+    /**
+        @brief Samples a B-spline curve of any degree on any (clamped or unclamped, non-uniform) knot vector.
+        The curve is sampled at 'approxM' uniformly spaced parameters in [knots[degree], knots[cp.size()]).
+        @param cp The control points of the curve.
+        @param knots The knot vector, must hold cp.size() + degree + 1 values.
+        @param approxM The number of points to sample.
+        @param degree The degree of the curve (cubic by default).
+        @return The sampled curve points.
+    **/
+    vector<vec3> b_spline(const vector<vec3>& cp, const vector<float>& knots, int approxM, int degree = 3);
+
+    /**
+        @brief Evaluates a single point of a B-spline curve.
+        @param cp The control points of the curve.
+        @param knots The knot vector, must hold cp.size() + degree + 1 values.
+        @param u The parameter value, clamped to [knots[degree], knots[cp.size()]].
+        @param degree The degree of the curve (cubic by default).
+        @return The curve point at 'u'.
+    **/
+    vec3 b_spline_point(const vector<vec3>& cp, const vector<float>& knots, float u, int degree = 3);
+
+    /**
+        @brief Tessellates a B-spline curve adaptively: every knot span is bisected until the distance between
+        the curve midpoint and the chord is below 'tolerance'. Both curve end points are included.
+        @param cp The control points of the curve.
+        @param knots The knot vector, must hold cp.size() + degree + 1 values.
+        @param tolerance Maximal chord error in world units.
+        @param degree The degree of the curve (cubic by default).
+        @param maxDepth Maximal number of bisections per knot span.
+        @return The curve points, to be drawn as a line strip.
+    **/
+    vector<vec3> b_spline_adaptive(const vector<vec3>& cp, const vector<float>& knots, float tolerance, int degree = 3, int maxDepth = 10);
+
+    /**
+        @brief Tessellates a B-spline curve adaptively with a projected error budget: spans are bisected until
+        the chord error measured on screen is below 'pixelTolerance' pixels.
+        @param cp The control points of the curve.
+        @param knots The knot vector, must hold cp.size() + degree + 1 values.
+        @param viewProjection The matrix taking curve points to clip space (projection * view * model).
+        @param viewport The viewport size in pixels.
+        @param pixelTolerance Maximal chord error in pixels.
+        @param degree The degree of the curve (cubic by default).
+        @param maxDepth Maximal number of bisections per knot span.
+        @return The curve points, to be drawn as a line strip.
+    **/
+    vector<vec3> b_spline_adaptive(const vector<vec3>& cp, const vector<float>& knots, const mat4& viewProjection, vec2 viewport, float pixelTolerance, int degree = 3, int maxDepth = 10);
+
+    /**
+        @brief Control points of many independent curves sharing one knot vector, stored as structure of arrays.
+        Coordinate 'x' of control point 'k' of curve 'c' is stored at x[k * numCurves + c], so the same
+        control point of neighbouring curves is contiguous and can be loaded into one SIMD register.
+    **/
+    struct b_spline_batch {
+        b_spline_batch(int numCurves, int numControlPoints);
+
+        /**
+            @brief Stores the control points of a single curve in the batch.
+            @param curve The index of the curve.
+            @param cp The control points, must hold numControlPoints values.
+        **/
+        void setCurve(int curve, const vector<vec3>& cp);
+
+        int numCurves;
+        int numControlPoints;
+        vector<float> x, y, z;
+    };
+
+    /**
+        @brief Samples every curve of the batch with the same parameters as b_spline, evaluating several curves
+        per instruction (8 lanes with AVX, 4 with SSE, scalar otherwise).
+        @param batch The control points of the curves.
+        @param knots The knot vector shared by all curves, must hold numControlPoints + degree + 1 values.
+        @param approxM The number of points to sample per curve.
+        @param out Output vertex array, resized to numCurves * approxM. Curve 'c' occupies [c * approxM, (c + 1) * approxM).
+        @param degree The degree of the curves (cubic by default).
+    **/
+    void b_spline_batch_eval(const b_spline_batch& batch, const vector<float>& knots, int approxM, vector<vec3>& out, int degree = 3);
 
 
     /**
@@ -98,45 +279,255 @@ namespace geometry {
     @return A 2D vector representing the calculated B-spline surface points.
     **/
     vector<vec3> b_spline_surface(
-        vector<vector<vec3>> C,
-        vector<float> knotsU,
-        vector<float> knotsV,
+        const vector<vector<vec3>>& C,
+        const vector<float>& knotsU,
+        const vector<float>& knotsV,
         int degreeU, int degreeV,
         int numPointsU, int numPointsV);
 
+    /**
+        @brief Samples of a B-spline surface, stored row major: sample (i, j) is at index i * numPointsV + j.
+    **/
+    struct b_spline_surface_samples {
+        int numPointsU = 0;
+        int numPointsV = 0;
+        vector<vec3> points;    /**< Surface points. */
+        vector<vec3> dU;        /**< Partial derivatives with respect to u, empty if not requested. */
+        vector<vec3> dV;        /**< Partial derivatives with respect to v, empty if not requested. */
+        vector<vec3> normals;   /**< Unit normals cross(dU, dV), empty if not requested. */
+    };
+
+    /**
+    @brief Evaluates a B-spline surface on a regular grid as points = Bu * C * Bv^T.
+    The basis tables Bu and Bv (and their derivatives) are built once, each table row only holds degree + 1
+    non-zero values so both products are evaluated on the band. Rows of the grid are evaluated in parallel.
+    @param C A 2D vector representing the control points of the B-spline surface.
+    @param knotsU The knot vector for the U direction of the B-spline surface.
+    @param knotsV The knot vector for the V direction of the B-spline surface.
+    @param degreeU The degree of the B-spline basis functions in the U direction.
+    @param degreeV The degree of the B-spline basis functions in the V direction.
+    @param numPointsU The number of points to be calculated in the U direction.
+    @param numPointsV The number of points to be calculated in the V direction.
+    @param derivatives Whether to compute the partial derivatives and normals.
+    @return The sampled points, and optionally partial derivatives and normals.
+    **/
+    b_spline_surface_samples b_spline_surface_eval(
+        const vector<vector<vec3>>& C,
+        const vector<float>& knotsU,
+        const vector<float>& knotsV,
+        int degreeU, int degreeV,
+        int numPointsU, int numPointsV,
+        bool derivatives = true);
+
 
     vector<vec3> sphere(glm::vec3 center, float radius, int stacks, int slices);
+
+    /**
+     * @brief An indexed triangle mesh with shared vertices, drawn as GL_TRIANGLES.
+     * The primitive meshes below are returned already reordered by optimize_mesh().
+     */
+    struct mesh {
+        vector<vec3> vertices;
+        vector<vec3> normals;
+        vector<vec2> uvs;
+        vector<unsigned int> indices;
+    };
+
+    /**
+     * @brief Reorders the triangles and vertices of a mesh for the GPU, the same passes as geometry_buffer::optimize().
+     * @return The cache statistics of the triangles before and after.
+     */
+    pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> optimize_mesh(mesh& m);
+
+    /**
+     * @brief Predefined tessellation levels of the primitive meshes.
+     */
+    enum primitive_detail {
+        DETAIL_LOW,     /**< uv sphere 8x16, icosphere 1 subdivision, 1 quad per cube face / plane. */
+        DETAIL_MEDIUM,  /**< uv sphere 16x32, icosphere 2 subdivisions, 4x4 quads per cube face / plane. */
+        DETAIL_HIGH     /**< uv sphere 32x64, icosphere 4 subdivisions, 16x16 quads per cube face / plane. */
+    };
+
+    /**
+     * @brief Generates a uv sphere, the seam column is duplicated so the uvs wrap correctly.
+     * @param center The center of the sphere.
+     * @param radius The radius of the sphere.
+     * @param stacks The number of subdivisions from pole to pole.
+     * @param slices The number of subdivisions around the vertical axis.
+     */
+    mesh uv_sphere_mesh(vec3 center, float radius, int stacks, int slices);
+    mesh uv_sphere_mesh(vec3 center, float radius, primitive_detail detail = DETAIL_MEDIUM);
+
+    /**
+     * @brief Generates a sphere by subdividing an icosahedron, the triangles are close to uniform in size.
+     * @param center The center of the sphere.
+     * @param radius The radius of the sphere.
+     * @param subdivisions The number of times every triangle is split into 4.
+     */
+    mesh icosphere_mesh(vec3 center, float radius, int subdivisions);
+    mesh icosphere_mesh(vec3 center, float radius, primitive_detail detail = DETAIL_MEDIUM);
+
+    /**
+     * @brief Generates an axis aligned cube, every face has its own vertices so the normals stay flat.
+     * @param center The center of the cube.
+     * @param size The edge length of the cube.
+     * @param subdivisions The number of quads along each edge of a face.
+     */
+    mesh cube_mesh(vec3 center, float size, int subdivisions);
+    mesh cube_mesh(vec3 center, float size, primitive_detail detail = DETAIL_LOW);
+
+    /**
+     * @brief Generates a plane in the XZ plane facing +Y.
+     * @param center The center of the plane.
+     * @param size The extent of the plane along X and Z.
+     * @param subdivisions The number of quads along each side.
+     */
+    mesh plane_mesh(vec3 center, vec2 size, int subdivisions);
+    mesh plane_mesh(vec3 center, vec2 size, primitive_detail detail = DETAIL_LOW);
 };
 
 
+/**
+ * @brief A uniform of a linked shader_program, an index into its reflected uniforms.
+ *
+ * The type parameter is the C++ type passed to shader_program::setUniform(), it is checked against the declared
+ * type of the uniform when the handle is resolved. Handles are only valid for the program that returned them.
+ */
+template <typename T>
+struct uniform_handle {
+    int index = -1;
+    bool valid() const { return index >= 0; }
+};
+
+/**
+ * @brief The GL type of the uniforms set from a C++ type.
+ */
+template <typename T> struct uniform_type;
+template <> struct uniform_type<mat4> { static const GLenum value = GL_FLOAT_MAT4; };
+template <> struct uniform_type<vec3> { static const GLenum value = GL_FLOAT_VEC3; };
+template <> struct uniform_type<vec4> { static const GLenum value = GL_FLOAT_VEC4; };
+template <> struct uniform_type<float> { static const GLenum value = GL_FLOAT; };
+template <> struct uniform_type<int> { static const GLenum value = GL_INT; };
+template <> struct uniform_type<bool> { static const GLenum value = GL_BOOL; };
+
+/**
+ * @brief The active vertex inputs of a linked shader_program, reflected once when it is linked.
+ */
+struct attribute_layout {
+    struct input {
+        std::string name;
+        GLint location;
+        GLenum type;    /**< GL type of the input, e.g. GL_FLOAT_VEC3 or GL_FLOAT_MAT4. */
+        GLint size;     /**< Array size, 1 for plain inputs. */
+    };
+    vector<input> inputs;
+    GLint attributes[vertex_format::ATTRIB_COUNT] = { -1, -1, -1, -1 };  /**< Location of every mesh attribute, -1 if not read. */
+    GLint instanceTransform = -1;   /**< Location of the first column of the instance transform, -1 if not read. */
+
+    /**
+     * @brief Returns the location of an input, -1 if the program does not read it.
+     */
+    GLint location(const char* name) const;
+    /**
+     * @brief Returns whether the input is read as an integer, which glVertexAttribPointer cannot feed.
+     */
+    static bool is_integer(GLenum type);
+};
+
 /**
  * @brief A class representing a shader program
+ *
+ * The active uniforms are enumerated when the program is linked. setUniform() with a handle is an index into them,
+ * and every uniform keeps a copy of its current value so that setting the same value again skips the GL call.
+ * The values must only be set through this class for the copies to stay true.
  */
 class shader_program {
 public:
-    shader_program();
-    ~shader_program();
-
     /**
-     * @brief Sets the light and material properties for the shader program.
-     *
-     * @param lightProperties Light properties struct containing the position, color, and coefficients of the light source.
-     * @param materialProperties Material light properties struct containing the ambient, diffuse, and specular strengths.
-     * @param viewDirection Optional parameter for the direction of the viewer.
+     * @brief Handles of the uniforms set for every draw, resolved when the program is linked.
+     * Handles of uniforms the program does not have are invalid and setting them does nothing.
      */
-    void setLights(vector<light_props>& lights, material_props& materialProperties, vec3 viewDirection = vec3(0, 0, -1));
+    struct common_uniforms {
+        uniform_handle<mat4> model, view, projection;
+        uniform_handle<int> normalEncoding, instanceFormat, textureSampler;
+    };
 
+    enum reload_status {
+        RELOAD_NONE,        /**< No reload was started. */
+        RELOAD_PENDING,     /**< The new sources are still compiling. */
+        RELOAD_FAILED,      /**< The new sources did not link, the program kept its previous version. */
+        RELOAD_SWAPPED,     /**< The program was replaced by the new sources. */
+    };
+
+    shader_program();
+    ~shader_program();
 
     /**
-     * @brief Loads the vertex and fragment shaders, attaches them to the shader program, links and validates the program.
+     * @brief Reads the sources of the vertex and fragment shaders, they are compiled by attach().
      *
      * @param vertexShaderPath Path to the vertex shader file.
      * @param fragmentShaderPath Path to the fragment shader file.
      */
     void load(const char* vertexShaderPath, const char* fragmentShaderPath);
+    /**
+     * @brief Sets the sources of the vertex and fragment shaders, they are compiled by attach().
+     */
+    void loadSources(const std::string& vertexSource, const std::string& fragmentSource);
     void use();
 
+    /**
+     * @brief Compiles the shaders, attaches them to the shader program, links and validates the program.
+     */
     void attach();
+    /**
+     * @brief Links the program from a binary returned by getBinary() instead of compiling the sources.
+     *
+     * @return Whether the driver accepted the binary, otherwise the program is left unlinked for attach().
+     */
+    bool attachBinary(GLenum format, const void* binary, GLsizei length);
+    /**
+     * @brief Asks the driver to keep the binary of the next link for getBinary(), must be called before attach().
+     */
+    void setBinaryRetrievable(bool retrievable);
+    /**
+     * @brief Returns the binary of the linked program and its driver specific format, false if it has none.
+     */
+    bool getBinary(GLenum& format, vector<unsigned char>& binary) const;
+    bool isLinked() const;
+    const std::string& getVertexSource() const;
+    const std::string& getFragmentSource() const;
+    const vector<const char*>& getTransformFeedbackVaryings() const;
+    /**
+     * @brief Reads the source of a shader from a file, empty if it cannot be read.
+     *
+     * @param path Path to the shader source file.
+     */
+    static std::string readShader(const char* path);
+
+    /**
+     * @brief Starts to compile and link new sources in a replacement program, the current one stays in use meanwhile.
+     *
+     * The GL calls return without waiting for the compiler, a reload still compiling is discarded.
+     */
+    void reload(const std::string& vertexSource, const std::string& fragmentSource);
+    /**
+     * @brief Swaps in the replacement program of reload() if it linked, call it between frames.
+     *
+     * Waits for the compiler unless the driver has KHR_parallel_shader_compile, which lets a pending reload be
+     * polled on later frames instead. The uniforms the new program shares with the old one keep their values.
+     */
+    reload_status finishReload();
+    /**
+     * @brief Changes whenever the program is replaced by a reload, its uniforms and inputs may have moved then.
+     */
+    unsigned int getGeneration() const;
+
+    /**
+     * @brief Sets the vertex shader outputs captured by transform feedback, must be called before attach().
+     *
+     * @param varyings Names of the captured outputs, recorded interleaved into a single buffer.
+     */
+    void setTransformFeedbackVaryings(vector<const char*> varyings);
 
 
     /**
@@ -182,6 +573,27 @@ public:
      * @param value bool value to be set.
      */
     void setUniform(const char* name, bool value);
+
+    void setUniform(uniform_handle<mat4> handle, const glm::mat4& value);
+    void setUniform(uniform_handle<vec3> handle, const glm::vec3& value);
+    void setUniform(uniform_handle<vec4> handle, const glm::vec4& value);
+    void setUniform(uniform_handle<float> handle, float value);
+    void setUniform(uniform_handle<int> handle, int value);
+    void setUniform(uniform_handle<bool> handle, bool value);
+
+    /**
+     * @brief Returns the handle of an active uniform, invalid if the program has no such uniform or it has another type.
+     *
+     * @param name Name of the uniform variable, arrays can be named with or without [0] and their elements as name[i].
+     */
+    template <typename T>
+    uniform_handle<T> getUniformHandle(const char* name) {
+        uniform_handle<T> handle;
+        handle.index = findUniform(name, uniform_type<T>::value);
+        return handle;
+    }
+    const common_uniforms& getCommonUniforms() const;
+    const attribute_layout& getAttributeLayout() const;
     /**
      * @brief Returns the ID of the shader program.
      *
@@ -198,19 +610,46 @@ public:
 private:
     bool loaded;
     bool attached;
+    bool linked = false;
+    bool retrievable = false;
+    std::string m_vertexSource;
+    std::string m_fragmentSource;
     GLuint vertexShader;
     GLuint fragmentShader;
     GLuint m_program;
-    std::map<std::string, GLint> m_uniforms;
+    GLuint m_pendingProgram = 0;
+    GLuint m_pendingShaders[2] = { 0, 0 };
+    std::string m_pendingVertexSource;
+    std::string m_pendingFragmentSource;
+    unsigned int generation = 0;
+    /**
+     * @brief An active uniform and the value last set to it.
+     */
+    struct uniform_slot {
+        GLint location;
+        GLenum type;
+        bool set = false;
+        bool mismatchReported = false;
+        unsigned char value[sizeof(mat4)];
+    };
+    vector<uniform_slot> m_uniformSlots;
+    std::unordered_map<std::string, int> m_uniformIndices;
+    common_uniforms m_common;
+    attribute_layout m_attributes;
+    vector<const char*> m_feedbackVaryings;
 
 
     /**
-     * @brief Loads the shader source from a file and compiles the shader.
+     * @brief Compiles a shader object from its source.
      *
-     * @param path Path to the shader source file.
      * @param shader ID of the shader object.
+     * @param source Source of the shader.
      */
-    void loadShader(const char* path, GLuint shader);
+    void compileShader(GLuint shader, const std::string& source);
+    /**
+     * @brief Binds the uniform blocks and reflects the uniforms and inputs once the program is linked.
+     */
+    void finishLink();
     /**
      * @brief Checks the compile or link status of the shader program or shader object and prints an error message if needed.
      *
@@ -222,13 +661,29 @@ private:
     void checkShader(GLuint shader, GLuint flag, bool isProgram, const std::string& errorMessage);
 
     /**
-     * @brief Retrieves the location of a uniform variable in the shader program.
-     * If the location is not already cached, it queries and caches the location.
-     *
-     * @param name Name of the uniform variable.
-     * @return GLint Location of the uniform variable.
+     * @brief Enumerates the active uniforms of the linked program and resolves the common uniforms.
      */
-    GLint getUniformLocation(const char* name);
+    void reflectUniforms();
+    /**
+     * @brief Enumerates the active vertex inputs of the linked program.
+     */
+    void reflectAttributes();
+    /**
+     * @brief Returns the index of an active uniform, -1 if there is none or its type does not accept values of type.
+     */
+    int findUniform(const char* name, GLenum type);
+    /**
+     * @brief Returns whether a uniform has to be set to a value, remembering the value.
+     */
+    bool changes(int index, const void* value, size_t size);
+    /**
+     * @brief Uploads the value remembered by a slot, the program must be in use.
+     */
+    void uploadSlot(const uniform_slot& slot);
+    /**
+     * @brief Deletes the replacement program of a reload that did not finish.
+     */
+    void discardReload();
 };
 
 
@@ -256,6 +711,52 @@ struct DrawPattern {
     size_t count;
 };
 
+/**
+ * @brief A level of detail of instanced geometry: the draw patterns of one tessellation stored in the shared buffers.
+ */
+struct lod_level {
+    lod_level() {}
+    lod_level(vector<DrawPattern> drawPatterns, float maxDistance) :
+        drawPatterns(drawPatterns),
+        maxDistance(maxDistance) {}
+
+    vector<DrawPattern> drawPatterns;
+    float maxDistance;  /**< Instances closer to the viewer than this use the level, in model space units. */
+};
+
+struct bounding_box {
+    /**
+     * @brief Creates an empty box, expanding it by a point makes it the box of that point.
+     */
+    bounding_box() : xMin(INFINITY), yMin(INFINITY), zMin(INFINITY), xMax(-INFINITY), yMax(-INFINITY), zMax(-INFINITY) {}
+    bounding_box(vec3 min, vec3 max) : xMin(min.x), yMin(min.y), zMin(min.z), xMax(max.x), yMax(max.y), zMax(max.z) {}
+    float xMin, yMin, zMin,
+        xMax, yMax, zMax;
+    bool contains(vec3 point);
+
+    /**
+     * @brief Returns the box of a set of points, scanned 4 points at a time with SSE when available.
+     */
+    static bounding_box fromPoints(const vector<vec3>& points);
+
+    vec3 getMin() const;
+    vec3 getMax() const;
+    vec3 getCenter() const;
+    /**
+     * @brief Returns the half size of the box along every axis.
+     */
+    vec3 getExtent() const;
+    bool isEmpty() const;
+    float surfaceArea() const;
+    bool intersects(const bounding_box& other) const;
+    void expand(vec3 point);
+    void expand(const bounding_box& other);
+    /**
+     * @brief Returns the box of the 8 transformed corners of this box.
+     */
+    bounding_box transformed(const mat4& transform) const;
+};
+
 /**
  * @brief A structure representing a geometry buffer containing vertex, color, normal, and index data.
  */
@@ -294,23 +795,114 @@ struct geometry_buffer {
     */
     void setIndices(vector<unsigned int>& indices);
 
+    /**
+    * @brief Sets the program drawing the buffer, streams uploaded before are pointed at its inputs right away.
+    */
     void setShaderProgram(shader_program* sp);
     /**
+    * @brief Enables primitive restart, mesh_optimizer::RESTART_INDEX entries of the indices then start a new strip.
+    *
+    * @param enabled Whether the draw calls of this buffer use primitive restart.
+    */
+    void setPrimitiveRestart(bool enabled);
+    /**
+    * @brief Sets the storage format of the vertex attributes, used by the next updateBuffers().
+    *
+    * @param layout The layout, e.g. vertex_format::vertex_layout::packed() for a single interleaved and quantised stream.
+    */
+    void setVertexLayout(const vertex_format::vertex_layout& layout);
+    /**
+    * @brief Stores the vertex streams and the indices in ranges of a shared arena instead of buffers of their own, used by the next updateBuffers().
+    *
+    * The arena must outlive the geometry buffer. Vertex arrays follow the ranges moved by buffer_arena::defragment()
+    * the next time they are bound.
+    *
+    * @param arena The arena, null to go back to the buffers of the geometry buffer.
+    */
+    void setBufferArena(buffer_arena* arena);
+    /**
     * @brief Updates the vertex, color, normal, and index buffers of the geometry buffer.
     */
     virtual void updateBuffers();
 
     void setDrawPatterns(vector<DrawPattern> drawPatterns);
+
+    /**
+     * @brief Reorders the mesh for the GPU without changing what is rendered, call before updateBuffers().
+     *
+     * The triangles of every GL_TRIANGLES draw pattern are reordered for post transform cache hits and then
+     * by cluster to reduce overdraw, finally the vertices are renumbered in the order they are fetched.
+     * Vertices not referenced by any index are dropped.
+     *
+     * @param report Print the ACMR / ATVR of every triangle pattern before and after.
+     * @return The cache statistics of all triangle patterns, before and after.
+     */
+    pair<mesh_optimizer::cache_stats, mesh_optimizer::cache_stats> optimize(bool report = false);
     vector<vec3> vertices;
     vector<vec3> colors;
     vector<vec3> normals;
     vector<unsigned int> indices;
     virtual void draw();
+    /**
+     * @brief Returns the texture coordinates stored with the vertices, null if the buffer has none.
+     */
+    virtual const vector<vec2>* textureCoordinates() const;
+    /**
+     * @brief Returns the box of the vertices, scanned once after every change of the geometry.
+     */
+    const bounding_box& meshBounds();
+    /**
+     * @brief Returns the box of the geometry in model space, the box of the vertices unless overridden.
+     */
+    virtual bounding_box localBounds();
+    /**
+     * @brief Marks the cached bounds as outdated, needed after modifying the vertices without setVertices() or updateBuffers().
+     */
+    void invalidateBounds();
+    /**
+     * @brief Returns a counter incremented by every invalidateBounds(), to detect outdated copies of the bounds.
+     */
+    unsigned int getBoundsVersion() const;
 
 public:
     GLuint vao, vbo, cbo, nbo, ebo;
-    shader_program* sp;
+    buffer_arena* arena = nullptr;
+    /**
+     * @brief The arena range of every vertex stream by attribute, interleaved vertices use the position, and of the indices last.
+     */
+    vector<buffer_arena::handle> arenaRanges = vector<buffer_arena::handle>(vertex_format::ATTRIB_COUNT + 1, buffer_arena::INVALID_HANDLE);
+    unsigned int arenaGeneration = 0;
+    /**
+     * @brief Where an uploaded attribute stream lives, buffer 0 for attributes that were not uploaded.
+     */
+    struct attribute_stream {
+        GLuint buffer = 0;
+        GLsizei stride = 0;     /**< The size of an interleaved vertex, 0 for a separate stream. */
+        size_t offset = 0;
+    };
+    attribute_stream streams[vertex_format::ATTRIB_COUNT];
+    const shader_program* checkedProgram = nullptr;    /**< The last program whose inputs were checked against the streams. */
+    unsigned int checkedGeneration = 0;                 /**< The generation of checkedProgram when it was checked. */
+    shader_program* sp = nullptr;
     vector<DrawPattern> drawPatterns;
+    vertex_format::vertex_layout layout;
+    GLenum indexType = GL_UNSIGNED_INT;  /**< GL_UNSIGNED_SHORT when every index fits in 16 bits, chosen by updateIndicesBuffer(). */
+    bool primitiveRestart = false;
+    /**
+     * @brief Returns the size in bytes of one index of the uploaded index buffer.
+     */
+    size_t indexSize() const;
+    /**
+     * @brief Returns the offset in bytes of the indices in the bound element array buffer.
+     */
+    size_t indexOffset() const;
+    /**
+     * @brief Enables or disables primitive restart around the draw calls, if requested for this buffer.
+     */
+    void applyPrimitiveRestart(bool drawing);
+    unsigned int boundsVersion = 0;
+    unsigned int meshBoundsVersion = ~0u;
+    bounding_box cachedMeshBounds;
     /**
      * @brief Updates the vertex buffer with the current vertex data.
      */
@@ -324,9 +916,47 @@ public:
      */
     void updateNormalsBuffer();
     /**
-     * @brief Updates the index buffer with the current index data.
+     * @brief Updates the index buffer with the current index data, stored as 16 bit indices when they all fit.
      */
     void updateIndicesBuffer();
+    /**
+     * @brief Packs every vertex attribute into vbo for interleaved layouts.
+     */
+    void updateInterleavedBuffer();
+    /**
+     * @brief Uploads one attribute stream to its own buffer in the format of the layout.
+     */
+    void updateAttributeBuffer(GLuint buffer, vertex_format::attribute a, const vector<vec3>& values);
+    /**
+     * @brief Uploads a stream to its own buffer or to its arena range, and binds the buffer holding it.
+     *
+     * @param stream The index of the stream in arenaRanges.
+     * @return The offset of the stream in the bound buffer.
+     */
+    size_t uploadStream(size_t stream, GLuint buffer, GLenum target, const void* data, size_t size);
+    /**
+     * @brief Points the vertex array at the current arena ranges, after they were moved by a defragmentation.
+     */
+    void pointArenaRanges();
+    /**
+     * @brief Records where the stream of an attribute lives and points the shader input at it, the vertex array must be bound.
+     *
+     * @param stride The size of an interleaved vertex, 0 for a separate stream of this attribute.
+     */
+    void setAttributePointer(vertex_format::attribute a, GLuint buffer, GLsizei stride, size_t offset);
+    /**
+     * @brief Points the shader input of a recorded stream at it, from the attribute layout of the program.
+     */
+    void pointAttribute(vertex_format::attribute a);
+    /**
+     * @brief Points every input of the program at the recorded streams, the vertex array must be bound.
+     */
+    virtual void pointAttributes();
+    /**
+     * @brief Reports the inputs of the program that the recorded streams cannot feed, once per program.
+     * A program replaced by a reload is pointed at the streams again, the vertex array must be bound.
+     */
+    void checkAttributes();
     /**
      * @brief Generates the necessary OpenGL buffers (VAO, VBOs, EBO).
      */
@@ -339,13 +969,24 @@ public:
      * @brief Binds the Vertex Array Object (VAO) for rendering.
      */
     void bindVertexArray();
+    /**
+     * @brief Reorders the per vertex data after the vertices were renumbered.
+     *
+     * @param remap remap[old] is the new index of a vertex, or ~0u if the vertex is dropped.
+     */
+    virtual void remapVertices(const vector<unsigned int>& remap);
 };
 
 
 class instanced_geometry_buffer : public geometry_buffer {
-    using geometry_buffer::geometry_buffer;
 public:
     instanced_geometry_buffer();
+    instanced_geometry_buffer(
+        vector<vec3> vertices,
+        vector<vec3> colors,
+        vector<vec3> normals,
+        vector<unsigned int> indices
+    );
     virtual ~instanced_geometry_buffer();
 
     /**
@@ -357,7 +998,8 @@ public:
      *
      * The input to this method could be an array or vector of transformation matrices,
      * where each matrix corresponds to one instance of the geometry. The matrices should
-     * be in the same order as the instances in the buffer.
+     * be in the same order as the instances in the buffer. They are converted to the instance
+     * format on upload, see setInstanceFormat().
      *
      * @param transformations The new transformation matrices for the instances.
      */
@@ -375,17 +1017,181 @@ public:
     void updatePartialMatrices(int start, int end);
     void updatePartialMatrices(vector<pair<int, int>> ranges);
 
+    /**
+     * @brief Sets how the transformations are stored per instance, used by the next upload of the matrices.
+     *
+     * @param format The format, vertex_format::INSTANCE_AUTO (default) picks the most compact one representing every matrix.
+     */
+    void setInstanceFormat(vertex_format::instance_format format);
+    /**
+     * @brief Returns the format of the uploaded instances.
+     */
+    vertex_format::instance_format getInstanceFormat() const;
+    const vector<mat4>& getTransformations() const;
+    /**
+     * @brief Streams the instances through a ring of fenced regions or an orphaned buffer instead of rewriting mbo in place.
+     *
+     * Meant for instances rewritten every frame, by animation or by cull(): the writes then never wait for the draws
+     * of the previous frames. updatePartialMatrices() rewrites every instance while streaming, since the ranges it
+     * leaves out are not in the new region. Switching uploads the instances again.
+     *
+     * @param enabled Whether the instances are streamed, otherwise they are stored in mbo with GL_STATIC_DRAW.
+     * @param mode How the stream is written, see stream_buffer.
+     */
+    void setStreaming(bool enabled, stream_buffer::mode mode = stream_buffer::MODE_RING);
+    bool isStreaming() const;
+    stream_buffer::statistics getStreamStatistics() const;
+    // override localBounds() to cover every instance
+    bounding_box localBounds() override;
+
+    /**
+     * @brief Enables per instance frustum culling, cull() then has to be called every frame before draw().
+     * Setting the current value does nothing, so it can be called every frame.
+     */
+    void setCulling(bool enabled);
+    /**
+     * @brief Tests the bounds of every instance against the view frustum and compacts the visible instances
+     * to the front of the instance buffer, draw() then only draws those.
+     *
+     * With levels of detail the visible instances are also grouped by level, see setLodLevels().
+     *
+     * @param clipFromObject The matrix projection * view * model of the frame.
+     * @param viewPosition The position of the viewer in model space, used to pick the levels of detail.
+     * @return The number of visible instances.
+     */
+    size_t cull(const mat4& clipFromObject, const vec3& viewPosition);
+    /**
+     * @brief Returns the number of instances drawn by draw().
+     */
+    size_t getVisibleCount() const;
+    /**
+     * @brief Sets levels of detail drawing far instances with coarser draw patterns of the same buffers.
+     *
+     * Every cull() assigns each instance to the first level whose maxDistance exceeds its distance to the viewer
+     * and stores the instances of a level next to each other, draw() then issues the patterns of every level for
+     * its instances only. An instance only changes level once it is hysteresis * maxDistance past the boundary,
+     * so that instances near a boundary do not alternate between levels. cull() has to be called every frame,
+     * even with culling disabled. The draw patterns of the buffer are still used while no cull() happened.
+     *
+     * @param levels The levels from the finest to the coarsest, by increasing maxDistance. Empty disables the levels.
+     * @param hysteresis Fraction of the boundary distance an instance must cross before switching level.
+     */
+    void setLodLevels(const vector<lod_level>& levels, float hysteresis = 0.1f);
+    /**
+     * @brief Returns the number of instances drawn at every level of detail by draw().
+     */
+    const vector<size_t>& getLodCounts() const;
+
+    culling::occlusion_test occlusionTest;  /**< Optional occlusion test of object space boxes used by cull(). */
+
 protected:
     GLuint mbo;
     vector<mat4> matrices;
+    vertex_format::instance_format requestedFormat = vertex_format::INSTANCE_AUTO;
+    vertex_format::instance_format instanceFormat = vertex_format::INSTANCE_MAT4;
+    bool cullingEnabled = false;
+    unsigned int instanceSetVersion = ~0u;
+    bool compacted = false;
+    unsigned int instanceBoundsVersion = ~0u;
+    bounding_box cachedInstanceBounds;
+    culling::instance_set instanceSet;
+    vector<unsigned int> visibleInstances;
+    vector<unsigned char> visibleData;
+    size_t visibleCount = 0;
+    vector<lod_level> lodLevels;
+    float lodHysteresis = 0.1f;
+    vector<unsigned char> instanceLod;     /**< Level of every instance at the last cull(), kept for the hysteresis. */
+    vector<size_t> lodCounts;
+    vector<unsigned int> lodOrder;
+    bool streaming = false;
+    stream_buffer instanceStream;
+    size_t instanceOffset = 0;      /**< Offset of the instances in the buffer holding them. */
     void updateMatricesBuffers();
+    /**
+     * @brief Writes packed instances to the next region of the stream and points the instance attributes at them.
+     */
+    void streamInstances(const vector<unsigned char>& data);
+    /**
+     * @brief Returns the buffer holding the uploaded instances.
+     */
+    GLuint instanceBuffer() const;
+    /**
+     * @brief Assigns a level to every visible instance and sorts visibleInstances by level.
+     */
+    void sortByLod(const vec3& viewPosition);
+    /**
+     * @brief Points the instanceTransform columns at the uploaded instances, their buffer must be bound.
+     *
+     * @param firstInstance The instance read by the first instance of the draw calls.
+     */
+    void setInstanceAttributes(size_t firstInstance = 0);
+    // override pointAttributes() to also point the instanceTransform columns
+    void pointAttributes() override;
+};
+
+
+/**
+ * @brief A geometry buffer for instanced clamped cubic B-splines evaluated in the vertex shader.
+ *
+ * Only the 4 control points of every instance are uploaded, the curve points are computed
+ * from gl_VertexID by shaders/vertex_shader_spline.glsl with the same parameters as geometry::b_spline.
+ */
+class spline_geometry_buffer : public geometry_buffer {
+public:
+    /**
+     * @param approxM The number of points sampled per curve.
+     * @param color The color of the curves.
+     * @param normal The normal used for lighting the curves.
+     */
+    spline_geometry_buffer(int approxM = 100, vec3 color = vec3(0.0f), vec3 normal = normalize(vec3(0, 1, 1)));
+
+    /**
+     * @brief Sets the control points of every instance.
+     *
+     * @param controlPoints One set of 4 control points per curve.
+     */
+    void setControlPoints(vector<array<vec3, 4>>& controlPoints);
+
+    // override updateBuffers() to upload the control points as per instance attributes
+    virtual void updateBuffers() override;
+    // override pointAttributes() to point the control point inputs at the uploaded control points
+    virtual void pointAttributes() override;
+    // override draw() to evaluate the curves of all instances in a single instanced draw
+    virtual void draw() override;
+    // override localBounds() with the box of the control points, which contains their curves
+    bounding_box localBounds() override;
+
+    int approxM;
+    vec3 color;
+    vec3 normal;
+    GLenum drawMode = GL_LINE_STRIP;
+    vector<array<vec3, 4>> controlPoints;
+
+private:
+    /**
+     * @brief Handles of the curve uniforms in uniformsProgram.
+     */
+    struct spline_uniforms {
+        uniform_handle<int> approxM;
+        uniform_handle<vec3> color, normal;
+    };
+
+    spline_uniforms uniforms;
+    const shader_program* uniformsProgram = nullptr;   /**< The program the handles were resolved in. */
+    unsigned int uniformsGeneration = 0;                /**< The generation of uniformsProgram when they were resolved. */
 };
 
 
 class textured_geometry_buffer : public instanced_geometry_buffer {
-    using instanced_geometry_buffer::instanced_geometry_buffer;
 public:
     textured_geometry_buffer();
+    textured_geometry_buffer(
+        vector<vec3> vertices,
+        vector<vec3> colors,
+        vector<vec3> normals,
+        vector<unsigned int> indices
+    );
+    virtual ~textured_geometry_buffer();
 
     void updateTextureCoordinatesBuffer();
     void generateBuffers() override;
@@ -393,6 +1199,10 @@ public:
     void updateBuffers() override;
 
     void setTextureCoodinates(vector<vec2>& texCoords);
+    // override remapVertices() to also reorder the texture coordinates
+    void remapVertices(const vector<unsigned int>& remap) override;
+    // override textureCoordinates() to interleave the texture coordinates with the vertices
+    const vector<vec2>* textureCoordinates() const override;
     void loadTextureFromFile(const char* texture_path);
     void loadTextureFromData(const unsigned char* data);
 
@@ -402,12 +1212,6 @@ public:
     vector<vec2> tex_coords;
 };
 
-struct bounding_box {
-    bounding_box() {}
-    float xMin, yMin, zMin,
-        xMax, yMax, zMax;
-    bool contains(vec3 point);
-};
 
 
 class scene_obj {
@@ -429,12 +1233,48 @@ public:
     const material_props& getMaterialProperties() const;
 
     virtual void draw();
+    /**
+     * @brief Uploads the material block if the material changed and binds it to uniform_blocks::MATERIAL_BINDING.
+     */
+    void applyMaterial();
+    /**
+     * @brief Sets the per object uniforms other than the material: model matrix, normal encoding and texture unit.
+     */
+    void applyUniforms();
+    /**
+     * @brief Returns the texture of textured geometry, 0 if the geometry has none.
+     */
+    GLuint getTexture() const;
+    /**
+     * @brief Culls the instances of an instanced geometry buffer that has culling enabled, and picks their levels of detail.
+     *
+     * @param viewProjection The projection * view matrix of the frame.
+     * @param viewPosition The position of the viewer in world space.
+     * @return The number of instances drawn by the next draw(), 1 for geometry that is not instanced.
+     */
+    size_t cull(const mat4& viewProjection, const vec3& viewPosition);
+    /**
+     * @brief Returns the world space box of the geometry, covering every instance of instanced geometry.
+     *
+     * The box is cached and only recomputed from the 8 corners of the local box when the model matrix
+     * or the geometry changed.
+     */
+    const bounding_box& worldBoundingBox();
     geometry_buffer* gb;
-    bounding_box* boundingBox;
-    mat4 model = mat4(1.0f);
+    bounding_box* boundingBox = nullptr;    /**< Optional model space box replacing the bounds of the geometry. */
+    bool depthTest = true;  /**< Whether draw() enables the depth test. */
+    bool occluder = false;  /**< Whether the triangles of the object hide other objects for scene occlusion culling. */
+    bool batched = false;   /**< Whether a scene draws the static object from a geometry_batch shared with similar objects. */
     material_props materialProperties;
 
-    static bounding_box* b_box(vector<vec3> points);
+    static bounding_box* b_box(const vector<vec3>& points);
+
+protected:
+    mat4 model = mat4(1.0f);    /**< Only changed by setModel(), which invalidates the cached world box. */
+    uniform_buffer materialBuffer;
+    bounding_box worldBounds;
+    bool worldBoundsDirty = true;
+    unsigned int worldBoundsVersion = 0;
 };
 
 
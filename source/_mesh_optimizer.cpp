@@ -0,0 +1,353 @@
+#include "_mesh_optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace mesh_optimizer {
+
+    static bool within(const vec3& a, const vec3& b, float tolerance) {
+        return fabsf(a.x - b.x) <= tolerance && fabsf(a.y - b.y) <= tolerance && fabsf(a.z - b.z) <= tolerance;
+    }
+
+    static uint64_t cell_key(int x, int y, int z) {
+        // 21 bits per axis, wrapping is harmless since candidates are compared exactly
+        return (static_cast<uint64_t>(x & 0x1FFFFF) << 42) | (static_cast<uint64_t>(y & 0x1FFFFF) << 21) | static_cast<uint64_t>(z & 0x1FFFFF);
+    }
+
+    vector<unsigned int> weld_vertices(vector<vec3>& positions, vector<vec3>* colors, vector<vec3>* normals, float tolerance) {
+        const size_t n = positions.size();
+        if (colors && colors->size() != n) colors = nullptr;
+        if (normals && normals->size() != n) normals = nullptr;
+
+        // cells are at least 'tolerance' wide, so duplicates are always in one of the 27 neighbouring cells
+        const float cellSize = glm::max(tolerance, 1e-6f);
+        unordered_map<uint64_t, vector<unsigned int>> grid;
+        grid.reserve(n);
+        vector<unsigned int> remap(n);
+        vector<unsigned int> kept;
+        kept.reserve(n);
+
+        for (size_t i = 0; i < n; i++) {
+            const vec3& p = positions[i];
+            int cx = static_cast<int>(floorf(p.x / cellSize));
+            int cy = static_cast<int>(floorf(p.y / cellSize));
+            int cz = static_cast<int>(floorf(p.z / cellSize));
+            long match = -1;
+            for (int dx = -1; dx <= 1 && match < 0; dx++) {
+                for (int dy = -1; dy <= 1 && match < 0; dy++) {
+                    for (int dz = -1; dz <= 1 && match < 0; dz++) {
+                        auto cell = grid.find(cell_key(cx + dx, cy + dy, cz + dz));
+                        if (cell == grid.end()) continue;
+                        for (unsigned int welded : cell->second) {
+                            unsigned int j = kept[welded];
+                            if (within(p, positions[j], tolerance) &&
+                                (!colors || (*colors)[i] == (*colors)[j]) &&
+                                (!normals || within((*normals)[i], (*normals)[j], tolerance))) {
+                                match = welded;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            if (match < 0) {
+                match = kept.size();
+                kept.push_back(i);
+                grid[cell_key(cx, cy, cz)].push_back(match);
+            }
+            remap[i] = match;
+        }
+
+        // compact the streams, kept is increasing so the copies never overwrite an unread vertex
+        for (size_t k = 0; k < kept.size(); k++) {
+            positions[k] = positions[kept[k]];
+            if (colors) (*colors)[k] = (*colors)[kept[k]];
+            if (normals) (*normals)[k] = (*normals)[kept[k]];
+        }
+        positions.resize(kept.size());
+        if (colors) colors->resize(kept.size());
+        if (normals) normals->resize(kept.size());
+        return remap;
+    }
+
+    /**
+     * @brief Returns whether every index of a range is a vertex, a restart index would make the passes read
+     * past their vertex arrays and reordering triangles across it would change the primitives.
+     */
+    static bool is_triangle_list(const vector<unsigned int>& indices, size_t start, size_t count, size_t vertexCount) {
+        for (size_t i = start; i < start + count; i++) {
+            if (indices[i] >= vertexCount) return false;
+        }
+        return true;
+    }
+
+    vector<unsigned int> join_strips(const vector<vector<unsigned int>>& strips) {
+        vector<unsigned int> indices;
+        for (size_t s = 0; s < strips.size(); s++) {
+            if (s > 0) {
+                indices.push_back(RESTART_INDEX);
+            }
+            indices.insert(indices.end(), strips[s].begin(), strips[s].end());
+        }
+        return indices;
+    }
+
+    cache_stats analyze_vertex_cache(const vector<unsigned int>& indices, size_t start, size_t count, size_t vertexCount, int cacheSize) {
+        cache_stats stats;
+        // timestamp of the last time every vertex entered the cache, a vertex is cached if it entered
+        // the FIFO less than cacheSize misses ago
+        vector<size_t> entered(vertexCount, 0);
+        vector<bool> seen(vertexCount, false);
+        size_t misses = 0;
+        size_t vertices = 0;
+        for (size_t i = start; i < start + count; i++) {
+            unsigned int v = indices[i];
+            // restart indices are not vertices
+            if (v >= vertexCount) {
+                continue;
+            }
+            vertices++;
+            if (!seen[v]) {
+                seen[v] = true;
+                stats.uniqueVertices++;
+            }
+            if (entered[v] == 0 || misses - entered[v] >= static_cast<size_t>(cacheSize)) {
+                misses++;
+                entered[v] = misses;
+            }
+        }
+        stats.triangles = vertices / 3;
+        stats.transformed = misses;
+        stats.acmr = stats.triangles ? misses / static_cast<float>(stats.triangles) : 0.0f;
+        stats.atvr = stats.uniqueVertices ? misses / static_cast<float>(stats.uniqueVertices) : 0.0f;
+        return stats;
+    }
+
+    // Forsyth's scoring, tuned for a 32 entry LRU cache although the passes target a 16 entry FIFO, see optimize_vertex_cache
+    static const int MAX_CACHE_SIZE = 32;
+    static const float CACHE_DECAY_POWER = 1.5f;
+    static const float LAST_TRIANGLE_SCORE = 0.75f;
+    static const float VALENCE_BOOST_SCALE = 2.0f;
+    static const float VALENCE_BOOST_POWER = 0.5f;
+
+    static float vertex_score(int cachePosition, int remainingValence) {
+        if (remainingValence == 0) {
+            // no triangle needs this vertex anymore
+            return -1.0f;
+        }
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            if (cachePosition < 3) {
+                // the vertices of the last triangle get a fixed score so the next triangle does not just reuse them
+                score = LAST_TRIANGLE_SCORE;
+            }
+            else {
+                float scaler = 1.0f / (MAX_CACHE_SIZE - 3);
+                score = powf(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+        // favour vertices with few triangles left, so they can be dropped from the cache
+        score += VALENCE_BOOST_SCALE * powf(static_cast<float>(remainingValence), -VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    void optimize_vertex_cache(vector<unsigned int>& indices, size_t start, size_t count, size_t vertexCount) {
+        const size_t numTriangles = count / 3;
+        if (numTriangles < 2 || !is_triangle_list(indices, start, count, vertexCount)) {
+            return;
+        }
+        const unsigned int* tris = &indices[start];
+
+        // vertex -> triangles adjacency in compressed form
+        vector<int> valence(vertexCount, 0);
+        for (size_t i = 0; i < numTriangles * 3; i++) {
+            valence[tris[i]]++;
+        }
+        vector<size_t> adjacencyStart(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+        }
+        vector<unsigned int> adjacency(numTriangles * 3);
+        vector<size_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t t = 0; t < numTriangles; t++) {
+            for (int k = 0; k < 3; k++) {
+                adjacency[fill[tris[t * 3 + k]]++] = t;
+            }
+        }
+
+        vector<int> cachePosition(vertexCount, -1);
+        vector<float> score(vertexCount, 0.0f);
+        for (size_t v = 0; v < vertexCount; v++) {
+            score[v] = vertex_score(-1, valence[v]);
+        }
+        vector<float> triangleScore(numTriangles);
+        vector<bool> emitted(numTriangles, false);
+        for (size_t t = 0; t < numTriangles; t++) {
+            triangleScore[t] = score[tris[t * 3]] + score[tris[t * 3 + 1]] + score[tris[t * 3 + 2]];
+        }
+
+        vector<unsigned int> result;
+        result.reserve(numTriangles * 3);
+        vector<unsigned int> cache, nextCache;
+        size_t cursor = 0;
+        long best = -1;
+
+        for (size_t emittedCount = 0; emittedCount < numTriangles; emittedCount++) {
+            if (best < 0) {
+                // no candidate in the cache, continue with the next triangle in input order
+                while (emitted[cursor]) cursor++;
+                best = cursor;
+            }
+            emitted[best] = true;
+            const unsigned int* tri = &tris[best * 3];
+            result.insert(result.end(), tri, tri + 3);
+
+            // move the triangle vertices to the front of the cache and drop the triangle from their adjacency
+            nextCache.assign(tri, tri + 3);
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = tri[k];
+                size_t begin = adjacencyStart[v], end = begin + valence[v];
+                for (size_t a = begin; a < end; a++) {
+                    if (adjacency[a] == static_cast<unsigned int>(best)) {
+                        adjacency[a] = adjacency[end - 1];
+                        break;
+                    }
+                }
+                valence[v]--;
+            }
+            for (unsigned int v : cache) {
+                if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                    nextCache.push_back(v);
+                }
+            }
+            // vertices falling out of the cache lose their cache score
+            for (size_t i = MAX_CACHE_SIZE; i < nextCache.size(); i++) {
+                cachePosition[nextCache[i]] = -1;
+                score[nextCache[i]] = vertex_score(-1, valence[nextCache[i]]);
+            }
+            if (nextCache.size() > static_cast<size_t>(MAX_CACHE_SIZE)) {
+                nextCache.resize(MAX_CACHE_SIZE);
+            }
+            cache.swap(nextCache);
+
+            // update the scores of the cached vertices and pick the best triangle touching them
+            for (size_t i = 0; i < cache.size(); i++) {
+                cachePosition[cache[i]] = i;
+                score[cache[i]] = vertex_score(i, valence[cache[i]]);
+            }
+            best = -1;
+            float bestScore = -1.0f;
+            for (unsigned int v : cache) {
+                size_t begin = adjacencyStart[v], end = begin + valence[v];
+                for (size_t a = begin; a < end; a++) {
+                    unsigned int t = adjacency[a];
+                    const unsigned int* other = &tris[t * 3];
+                    triangleScore[t] = score[other[0]] + score[other[1]] + score[other[2]];
+                    if (triangleScore[t] > bestScore) {
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+            }
+        }
+        std::copy(result.begin(), result.end(), indices.begin() + start);
+    }
+
+    void optimize_overdraw(vector<unsigned int>& indices, size_t start, size_t count, const vector<vec3>& vertices, float threshold) {
+        const size_t numTriangles = count / 3;
+        if (numTriangles < 2 || !is_triangle_list(indices, start, count, vertices.size())) {
+            return;
+        }
+        const int cacheSize = CACHE_SIZE;
+
+        // split into clusters where the cache restarts (3 misses), merging clusters while the
+        // simulated ACMR stays within threshold of the whole range
+        const float targetAcmr = analyze_vertex_cache(indices, start, count, vertices.size(), cacheSize).acmr * threshold;
+        vector<size_t> clusterStart;
+        vector<size_t> entered(vertices.size(), 0);
+        size_t misses = 0, clusterMisses = 0, clusterTriangles = 0;
+        for (size_t t = 0; t < numTriangles; t++) {
+            int triangleMisses = 0;
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = indices[start + t * 3 + k];
+                if (entered[v] == 0 || misses - entered[v] >= static_cast<size_t>(cacheSize)) {
+                    misses++;
+                    entered[v] = misses;
+                    triangleMisses++;
+                }
+            }
+            bool restart = triangleMisses == 3 && (clusterTriangles == 0 || clusterMisses / static_cast<float>(clusterTriangles) <= targetAcmr);
+            if (t == 0 || restart) {
+                clusterStart.push_back(t);
+                clusterMisses = 0;
+                clusterTriangles = 0;
+            }
+            clusterMisses += triangleMisses;
+            clusterTriangles++;
+        }
+        clusterStart.push_back(numTriangles);
+        const size_t numClusters = clusterStart.size() - 1;
+        if (numClusters < 2) {
+            return;
+        }
+
+        // sort key: how much the cluster faces away from the mesh center, outer clusters occlude inner ones
+        vec3 meshCenter(0.0f);
+        float meshArea = 0.0f;
+        vector<vec3> clusterCenter(numClusters, vec3(0.0f)), clusterNormal(numClusters, vec3(0.0f));
+        vector<float> clusterArea(numClusters, 0.0f);
+        for (size_t c = 0; c < numClusters; c++) {
+            for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++) {
+                const vec3& a = vertices[indices[start + t * 3]];
+                const vec3& b = vertices[indices[start + t * 3 + 1]];
+                const vec3& d = vertices[indices[start + t * 3 + 2]];
+                vec3 n = cross(b - a, d - a);
+                float area = length(n);
+                vec3 centroid = (a + b + d) / 3.0f;
+                clusterCenter[c] += area * centroid;
+                clusterNormal[c] += n;
+                clusterArea[c] += area;
+            }
+            meshCenter += clusterCenter[c];
+            meshArea += clusterArea[c];
+        }
+        if (meshArea > 0.0f) {
+            meshCenter /= meshArea;
+        }
+        vector<float> key(numClusters, 0.0f);
+        for (size_t c = 0; c < numClusters; c++) {
+            if (clusterArea[c] <= 0.0f) continue;
+            vec3 center = clusterCenter[c] / clusterArea[c];
+            float normalLength = length(clusterNormal[c]);
+            if (normalLength > 0.0f) {
+                key[c] = dot(center - meshCenter, clusterNormal[c] / normalLength);
+            }
+        }
+        vector<size_t> order(numClusters);
+        for (size_t c = 0; c < numClusters; c++) order[c] = c;
+        std::stable_sort(order.begin(), order.end(), [&key](size_t a, size_t b) { return key[a] > key[b]; });
+
+        vector<unsigned int> result;
+        result.reserve(count);
+        for (size_t c : order) {
+            result.insert(result.end(), indices.begin() + start + clusterStart[c] * 3, indices.begin() + start + clusterStart[c + 1] * 3);
+        }
+        std::copy(result.begin(), result.end(), indices.begin() + start);
+    }
+
+    vector<unsigned int> optimize_vertex_fetch(vector<unsigned int>& indices, size_t vertexCount) {
+        vector<unsigned int> remap(vertexCount, ~0u);
+        unsigned int next = 0;
+        for (unsigned int& index : indices) {
+            if (index == RESTART_INDEX) {
+                continue;
+            }
+            if (remap[index] == ~0u) {
+                remap[index] = next++;
+            }
+            index = remap[index];
+        }
+        return remap;
+    }
+};
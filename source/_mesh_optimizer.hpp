@@ -0,0 +1,138 @@
+#ifndef _MESH_OPTIMIZER
+#define _MESH_OPTIMIZER
+#include <vector>
+#include <glm/glm.hpp>
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief Reordering passes for indexed triangle lists, none of them changes what is rendered.
+ *
+ * The passes are meant to run in this order: vertex cache, overdraw, vertex fetch.
+ * All index ranges are given as [start, start + count) into the index buffer, so the
+ * triangles of different draw patterns are never mixed.
+ */
+namespace mesh_optimizer {
+
+    /**
+     * @brief Index marking the end of a strip when primitive restart is enabled, see geometry_buffer::setPrimitiveRestart().
+     * The triangle list passes leave ranges containing it unchanged.
+     */
+    const unsigned int RESTART_INDEX = ~0u;
+
+    /**
+     * @brief Entries of the post transform cache the passes are tuned for and analyze_vertex_cache() simulates by default,
+     * a FIFO as on most GPUs.
+     */
+    const int CACHE_SIZE = 16;
+
+    /**
+     * @brief Merges duplicated vertices using a hash grid over the positions.
+     *
+     * Two vertices are merged when every component of their position and normal differs by at most
+     * 'tolerance' and their colors are equal: any color difference is visible, while positions and normals
+     * computed along different paths differ by rounding. The streams are compacted in place, keeping the
+     * first vertex of every group.
+     *
+     * @param positions The vertex positions.
+     * @param colors The vertex colors, may be null.
+     * @param normals The vertex normals, may be null.
+     * @param tolerance Maximal difference per component of the positions and normals of merged vertices.
+     * @return The remap table, remap[old] is the index of the welded vertex. For unindexed geometry this is
+     * directly the index buffer, indexed geometry maps its indices through it.
+     */
+    vector<unsigned int> weld_vertices(vector<vec3>& positions, vector<vec3>* colors, vector<vec3>* normals, float tolerance = 1e-5f);
+
+    /**
+     * @brief Concatenates strips into one index run separated by RESTART_INDEX, drawn with a single call
+     * when primitive restart is enabled.
+     *
+     * @param strips The indices of every strip, of any strip or loop draw mode.
+     * @return The joined indices.
+     */
+    vector<unsigned int> join_strips(const vector<vector<unsigned int>>& strips);
+
+    /**
+     * @brief Post transform vertex cache statistics of an index range.
+     */
+    struct cache_stats {
+        size_t triangles = 0;
+        size_t transformed = 0;     /**< Number of vertex shader invocations (cache misses). */
+        size_t uniqueVertices = 0;
+        float acmr = 0.0f;          /**< Average cache miss ratio, transformed vertices per triangle (0.5 - 3). */
+        float atvr = 0.0f;          /**< Average transformed vertex ratio, transformed / unique vertices (1 is optimal). */
+    };
+
+    /**
+     * @brief Simulates a FIFO post transform cache over a triangle list, RESTART_INDEX entries are skipped.
+     *
+     * @param indices The index buffer.
+     * @param start The first index of the range.
+     * @param count The number of indices of the range, a multiple of 3.
+     * @param vertexCount The number of vertices referenced by the index buffer.
+     * @param cacheSize The number of entries of the simulated cache.
+     * @return The cache statistics of the range.
+     */
+    cache_stats analyze_vertex_cache(const vector<unsigned int>& indices, size_t start, size_t count, size_t vertexCount, int cacheSize = CACHE_SIZE);
+
+    /**
+     * @brief Reorders the triangles of the range for post transform cache hits (Forsyth's linear speed algorithm).
+     *
+     * The scores model a 32 entry LRU cache rather than the CACHE_SIZE entry FIFO simulated by analyze_vertex_cache().
+     * An LRU moves a reused vertex to the front where a FIFO keeps it in place, so an LRU of the FIFO size does not
+     * predict the FIFO any better, and the slower decay of the 32 entry scores measures a lower FIFO ACMR on the
+     * primitive meshes of bench/mesh_optimizer_bench (cube 0.69 against 0.72, uv sphere 0.72 against 0.74).
+     *
+     * @param indices The index buffer, reordered in place.
+     * @param start The first index of the range.
+     * @param count The number of indices of the range, a multiple of 3.
+     * @param vertexCount The number of vertices referenced by the index buffer.
+     */
+    void optimize_vertex_cache(vector<unsigned int>& indices, size_t start, size_t count, size_t vertexCount);
+
+    /**
+     * @brief Reorders clusters of cache optimized triangles so outward facing clusters are drawn first.
+     *
+     * The range is split where the cache restarts (a triangle with 3 misses), so the cache efficiency
+     * is kept within 'threshold' of the input, then the clusters are sorted by how much they face away
+     * from the mesh center.
+     *
+     * @param indices The index buffer, reordered in place.
+     * @param start The first index of the range.
+     * @param count The number of indices of the range, a multiple of 3.
+     * @param vertices The vertex positions.
+     * @param threshold Maximal allowed ACMR degradation, 1.05 allows 5% more vertex shader invocations.
+     */
+    void optimize_overdraw(vector<unsigned int>& indices, size_t start, size_t count, const vector<vec3>& vertices, float threshold = 1.05f);
+
+    /**
+     * @brief Renumbers the vertices in the order they are first referenced, so vertex fetches are sequential.
+     * RESTART_INDEX entries are kept as they are.
+     *
+     * @param indices The index buffer, rewritten in place.
+     * @param vertexCount The number of vertices referenced by the index buffer.
+     * @return The remap table, remap[old] is the new index of a vertex or ~0u if it is not referenced.
+     */
+    vector<unsigned int> optimize_vertex_fetch(vector<unsigned int>& indices, size_t vertexCount);
+
+    /**
+     * @brief Applies a remap table returned by optimize_vertex_fetch to a vertex attribute stream.
+     *
+     * @param data The attribute stream, unreferenced vertices are dropped.
+     * @param remap The remap table.
+     */
+    template <typename T>
+    void remap_vertices(vector<T>& data, const vector<unsigned int>& remap) {
+        size_t count = 0;
+        for (unsigned int target : remap) {
+            if (target != ~0u) count++;
+        }
+        vector<T> remapped(count);
+        for (size_t i = 0; i < remap.size() && i < data.size(); i++) {
+            if (remap[i] != ~0u) remapped[remap[i]] = data[i];
+        }
+        data.swap(remapped);
+    }
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include "_occlusion.hpp"
+#include "_parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace culling {
+
+    // triangles are clipped to w >= NEAR_W, which keeps 1 / w finite whatever the depth range of the projection
+    static const float NEAR_W = 1e-3f;
+
+    occlusion_buffer::occlusion_buffer(int width, int height) {
+        tilesX = glm::max(1, (width + TILE_SIZE - 1) / TILE_SIZE);
+        tilesY = glm::max(1, (height + TILE_SIZE - 1) / TILE_SIZE);
+        this->width = tilesX * TILE_SIZE;
+        this->height = tilesY * TILE_SIZE;
+        depth.assign(this->width * this->height, 0.0f);
+        tileDepth.assign(tilesX * tilesY, 0.0f);
+    }
+
+    void occlusion_buffer::begin(const mat4& viewProjection) {
+        this->viewProjection = viewProjection;
+        primitives.clear();
+    }
+
+    /**
+     * @brief Returns the pixel coordinates and 1 / w of a clip space point in front of the near plane.
+     */
+    static vec3 to_screen(const vec4& clip, int width, int height) {
+        const float z = 1.0f / clip.w;
+        return vec3((clip.x * z * 0.5f + 0.5f) * width, (clip.y * z * 0.5f + 0.5f) * height, z);
+    }
+
+    /**
+     * @brief Returns twice the signed area of a screen space triangle.
+     */
+    static float signed_area(const vec3& a, const vec3& b, const vec3& c) {
+        return (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    }
+
+    /**
+     * @brief Returns whether a screen space quad is strictly convex.
+     */
+    static bool convex(const vec3 (&q)[4]) {
+        int positive = 0, negative = 0;
+        for (int k = 0; k < 4; k++) {
+            const float turn = signed_area(q[k], q[(k + 1) % 4], q[(k + 2) % 4]);
+            positive += turn > 0.0f;
+            negative += turn < 0.0f;
+        }
+        return positive == 4 || negative == 4;
+    }
+
+    void occlusion_buffer::addOccluder(const vector<vec3>& vertices, const vector<unsigned int>& indices, size_t start, size_t count, const mat4& model) {
+        const mat4 clipFromModel = viewProjection * model;
+        const size_t end = std::min(start + count, indices.size());
+        // the triangles completely in front of the near plane, paired by shared edge below
+        vector<size_t> whole;
+        vector<vec3> screen;
+        for (size_t i = start; i + 3 <= end; i += 3) {
+            vec4 in[3], out[4];
+            int inside = 0;
+            for (int k = 0; k < 3; k++) {
+                in[k] = clipFromModel * vec4(vertices[indices[i + k]], 1.0f);
+                inside += in[k].w >= NEAR_W;
+            }
+            if (inside == 3) {
+                whole.push_back(i);
+                for (int k = 0; k < 3; k++) {
+                    screen.push_back(to_screen(in[k], width, height));
+                }
+                continue;
+            }
+            if (inside == 0) {
+                continue;
+            }
+            // clip the polygon against w = NEAR_W, leaving 3 or 4 vertices of a convex planar polygon
+            int n = 0;
+            for (int k = 0; k < 3; k++) {
+                const vec4& p = in[k];
+                const vec4& q = in[(k + 1) % 3];
+                if (p.w >= NEAR_W) out[n++] = p;
+                if ((p.w >= NEAR_W) != (q.w >= NEAR_W)) {
+                    const float t = (NEAR_W - p.w) / (q.w - p.w);
+                    out[n++] = p + (q - p) * t;
+                }
+            }
+            vec3 corners[4];
+            for (int k = 0; k < n; k++) {
+                corners[k] = to_screen(out[k], width, height);
+            }
+            addPrimitive(corners, n, corners, corners);
+        }
+
+        // a pixel on the edge between two triangles is covered by neither completely, so neighbours forming a
+        // convex quad are rasterised together, otherwise every shared edge would leave a line of holes
+        unordered_map<uint64_t, size_t> open;
+        vector<long> partner(whole.size(), -1);
+        vector<int> quadStart(whole.size(), -1), quadOpposite(whole.size(), -1);
+        for (size_t t = 0; t < whole.size(); t++) {
+            for (int k = 0; k < 3 && partner[t] < 0; k++) {
+                const unsigned int a = indices[whole[t] + k], b = indices[whole[t] + (k + 1) % 3];
+                const uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+                auto it = open.find(key);
+                if (it == open.end()) {
+                    open[key] = t;
+                    continue;
+                }
+                const size_t other = it->second;
+                if (partner[other] >= 0) {
+                    continue;
+                }
+                int opposite = 0;
+                while (indices[whole[other] + opposite] == a || indices[whole[other] + opposite] == b) opposite++;
+                // the quad goes around t from a, through the vertex of the other triangle opposite the edge
+                const vec3* p = &screen[t * 3];
+                const vec3* o = &screen[other * 3];
+                const vec3 quad[4] = { p[k], o[opposite], p[(k + 1) % 3], p[(k + 2) % 3] };
+                if (convex(quad) && fabsf(signed_area(p[0], p[1], p[2])) >= 1e-8f && fabsf(signed_area(o[0], o[1], o[2])) >= 1e-8f) {
+                    partner[t] = other;
+                    partner[other] = t;
+                    quadStart[t] = k;
+                    quadOpposite[t] = opposite;
+                    open.erase(it);
+                }
+            }
+        }
+        for (size_t t = 0; t < whole.size(); t++) {
+            const vec3* p = &screen[t * 3];
+            if (partner[t] < 0) {
+                addPrimitive(p, 3, p, p);
+            }
+            else if (quadStart[t] >= 0) {
+                // the farther of the two planes over every pixel, whether or not the triangles are coplanar
+                const vec3* o = &screen[partner[t] * 3];
+                const int k = quadStart[t];
+                const vec3 quad[4] = { p[k], o[quadOpposite[t]], p[(k + 1) % 3], p[(k + 2) % 3] };
+                addPrimitive(quad, 4, p, o);
+            }
+        }
+    }
+
+    void occlusion_buffer::addPrimitive(const vec3* corners, int n, const vec3* first, const vec3* second) {
+        vec3 c[4];
+        std::copy(corners, corners + n, c);
+        float area = 0.0f;
+        for (int k = 0; k < n; k++) {
+            area += c[k].x * c[(k + 1) % n].y - c[(k + 1) % n].x * c[k].y;
+        }
+        if (fabsf(area) < 1e-8f) {
+            return;
+        }
+        // occluders are rasterised from both sides, the edges are oriented to be positive inside
+        if (area < 0.0f) {
+            std::reverse(c, c + n);
+        }
+        primitive t;
+        float xMin = INFINITY, xMax = -INFINITY, yMin = INFINITY, yMax = -INFINITY;
+        for (int k = 0; k < n; k++) {
+            xMin = glm::min(xMin, c[k].x); xMax = glm::max(xMax, c[k].x);
+            yMin = glm::min(yMin, c[k].y); yMax = glm::max(yMax, c[k].y);
+        }
+        t.xMin = glm::max(0, static_cast<int>(floorf(xMin)));
+        t.xMax = glm::min(width - 1, static_cast<int>(ceilf(xMax)));
+        t.yMin = glm::max(0, static_cast<int>(floorf(yMin)));
+        t.yMax = glm::min(height - 1, static_cast<int>(ceilf(yMax)));
+        if (t.xMin > t.xMax || t.yMin > t.yMax) {
+            return;
+        }
+        for (int k = 0; k < 4; k++) {
+            if (k >= n) {
+                // the missing edge of a triangle is true everywhere
+                t.edgeA[k] = t.edgeB[k] = t.edgeC[k] = 0.0f;
+                continue;
+            }
+            const int next = (k + 1) % n;
+            t.edgeA[k] = c[k].y - c[next].y;
+            t.edgeB[k] = c[next].x - c[k].x;
+            t.edgeC[k] = -(t.edgeA[k] * c[k].x + t.edgeB[k] * c[k].y);
+            // evaluated at the pixel centers, the edges then test the corner of the pixel farthest outside:
+            // only pixels covered completely by the primitive are marked
+            t.edgeC[k] -= 0.5f * (fabsf(t.edgeA[k]) + fabsf(t.edgeB[k]));
+        }
+        const vec3* planes[2] = { first, second };
+        for (int d = 0; d < 2; d++) {
+            const vec3* p = planes[d];
+            const float planeArea = signed_area(p[0], p[1], p[2]);
+            t.depthA[d] = ((p[1].z - p[0].z) * (p[2].y - p[0].y) - (p[2].z - p[0].z) * (p[1].y - p[0].y)) / planeArea;
+            t.depthB[d] = ((p[2].z - p[0].z) * (p[1].x - p[0].x) - (p[1].z - p[0].z) * (p[2].x - p[0].x)) / planeArea;
+            t.depthC[d] = p[0].z - t.depthA[d] * p[0].x - t.depthB[d] * p[0].y;
+            // likewise the depth of a pixel is the farthest of the plane over the pixel
+            t.depthC[d] -= 0.5f * (fabsf(t.depthA[d]) + fabsf(t.depthB[d]));
+        }
+        primitives.push_back(t);
+    }
+
+    void occlusion_buffer::end() {
+        parallel_for(0, tilesY, [&](int rowBegin, int rowEnd) {
+            for (int row = rowBegin; row < rowEnd; row++) {
+                rasterizeTiles(row);
+            }
+        }, 2);
+    }
+
+    void occlusion_buffer::rasterizeTiles(int tileRow) {
+        const int yBegin = tileRow * TILE_SIZE;
+        const int yEnd = yBegin + TILE_SIZE;
+        std::fill(depth.begin() + yBegin * width, depth.begin() + yEnd * width, 0.0f);
+        for (const primitive& t : primitives) {
+            if (t.yMax < yBegin || t.yMin >= yEnd) {
+                continue;
+            }
+            const int xBegin = t.xMin & ~3;
+            for (int y = glm::max(yBegin, t.yMin); y <= glm::min(yEnd - 1, t.yMax); y++) {
+                const float py = y + 0.5f;
+                float* row = depth.data() + y * width;
+                int x = xBegin;
+#if defined(__SSE2__)
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                __m128 rowEdge[4], stepEdge[4], rowDepth[2], stepDepth[2];
+                for (int k = 0; k < 4; k++) {
+                    rowEdge[k] = _mm_set1_ps(t.edgeB[k] * py + t.edgeC[k]);
+                    stepEdge[k] = _mm_set1_ps(t.edgeA[k]);
+                }
+                for (int d = 0; d < 2; d++) {
+                    rowDepth[d] = _mm_set1_ps(t.depthB[d] * py + t.depthC[d]);
+                    stepDepth[d] = _mm_set1_ps(t.depthA[d]);
+                }
+                for (; x <= t.xMax; x += 4) {
+                    const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepEdge[0], px), rowEdge[0]), zero);
+                    for (int k = 1; k < 4; k++) {
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepEdge[k], px), rowEdge[k]), zero));
+                    }
+                    // 1 / w is positive, masked out pixels keep their depth through the max
+                    const __m128 farthest = _mm_min_ps(_mm_add_ps(_mm_mul_ps(stepDepth[0], px), rowDepth[0]),
+                        _mm_add_ps(_mm_mul_ps(stepDepth[1], px), rowDepth[1]));
+                    const __m128 z = _mm_and_ps(inside, farthest);
+                    _mm_storeu_ps(row + x, _mm_max_ps(_mm_loadu_ps(row + x), z));
+                }
+#endif
+                for (; x <= t.xMax; x++) {
+                    const float px = x + 0.5f;
+                    bool inside = true;
+                    for (int k = 0; k < 4; k++) inside = inside && t.edgeA[k] * px + t.edgeB[k] * py + t.edgeC[k] >= 0.0f;
+                    const float farthest = glm::min(t.depthA[0] * px + t.depthB[0] * py + t.depthC[0], t.depthA[1] * px + t.depthB[1] * py + t.depthC[1]);
+                    if (inside) row[x] = glm::max(row[x], farthest);
+                }
+            }
+        }
+        // farthest depth of every tile of the row
+        for (int tileX = 0; tileX < tilesX; tileX++) {
+            float farthest = INFINITY;
+            for (int y = yBegin; y < yEnd; y++) {
+                const float* row = depth.data() + y * width + tileX * TILE_SIZE;
+                for (int x = 0; x < TILE_SIZE; x++) farthest = glm::min(farthest, row[x]);
+            }
+            tileDepth[tileRow * tilesX + tileX] = farthest;
+        }
+    }
+
+    bool occlusion_buffer::occluded(const vec3& min, const vec3& max, const mat4& model) const {
+        if (primitives.empty()) {
+            return false;
+        }
+        const mat4 clipFromModel = viewProjection * model;
+        float xMin = INFINITY, xMax = -INFINITY, yMin = INFINITY, yMax = -INFINITY, nearest = 0.0f;
+        for (int corner = 0; corner < 8; corner++) {
+            const vec3 p((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+            const vec4 clip = clipFromModel * vec4(p, 1.0f);
+            // boxes crossing the near plane are never hidden
+            if (clip.w < NEAR_W) {
+                return false;
+            }
+            const float z = 1.0f / clip.w;
+            const float x = (clip.x * z * 0.5f + 0.5f) * width;
+            const float y = (clip.y * z * 0.5f + 0.5f) * height;
+            xMin = glm::min(xMin, x); xMax = glm::max(xMax, x);
+            yMin = glm::min(yMin, y); yMax = glm::max(yMax, y);
+            nearest = glm::max(nearest, z);
+        }
+        // every pixel touched by the screen rectangle of the box
+        const int x0 = glm::max(0, static_cast<int>(floorf(xMin)));
+        const int x1 = glm::min(width - 1, static_cast<int>(floorf(xMax)));
+        const int y0 = glm::max(0, static_cast<int>(floorf(yMin)));
+        const int y1 = glm::min(height - 1, static_cast<int>(floorf(yMax)));
+        if (x0 > x1 || y0 > y1) {
+            return false;
+        }
+        for (int tileY = y0 / TILE_SIZE; tileY <= y1 / TILE_SIZE; tileY++) {
+            for (int tileX = x0 / TILE_SIZE; tileX <= x1 / TILE_SIZE; tileX++) {
+                // the whole tile is closer than the box
+                if (tileDepth[tileY * tilesX + tileX] > nearest) {
+                    continue;
+                }
+                const int xBegin = glm::max(x0, tileX * TILE_SIZE), xEnd = glm::min(x1, tileX * TILE_SIZE + TILE_SIZE - 1);
+                const int yBegin = glm::max(y0, tileY * TILE_SIZE), yEnd = glm::min(y1, tileY * TILE_SIZE + TILE_SIZE - 1);
+                for (int y = yBegin; y <= yEnd; y++) {
+                    const float* row = depth.data() + y * width;
+                    int x = xBegin;
+#if defined(__SSE2__)
+                    const __m128 boxDepth = _mm_set1_ps(nearest);
+                    for (; x + 3 <= xEnd; x += 4) {
+                        if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), boxDepth))) return false;
+                    }
+#endif
+                    for (; x <= xEnd; x++) {
+                        if (row[x] <= nearest) return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    occlusion_test occlusion_buffer::test(const mat4& model) const {
+        return [this, model](const vec3& min, const vec3& max) {
+            return occluded(min, max, model);
+        };
+    }
+
+    int occlusion_buffer::getWidth() const { return width; }
+    int occlusion_buffer::getHeight() const { return height; }
+
+    float occlusion_buffer::depthAt(int x, int y) const {
+        return depth[y * width + x];
+    }
+
+    size_t occlusion_buffer::getPrimitiveCount() const {
+        return primitives.size();
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef _OCCLUSION
+#define _OCCLUSION
+#include <vector>
+#include <glm/glm.hpp>
+#include "_culling.hpp"
+using namespace std;
+using namespace glm;
+
+namespace culling {
+
+    /**
+     * @brief A low resolution depth buffer rasterised on the CPU from a few large occluders, to skip the
+     * objects they hide before issuing any draw call.
+     *
+     * Every frame: begin() with the view projection of the camera, addOccluder() for every occluder mesh,
+     * end() to rasterise them, then occluded() for the boxes to test. The buffer stores 1 / w, which is
+     * linear in screen space and independent of the depth range of the projection, larger values are closer.
+     *
+     * The screen is split in TILE_SIZE x TILE_SIZE tiles rasterised in parallel, 4 pixels at a time with SSE,
+     * and the farthest depth of every tile is kept so that most box tests never look at single pixels.
+     * Occluders are rasterised conservatively inward: a pixel only gets the farthest depth of a triangle over the
+     * whole pixel, and only when the triangle covers the pixel completely. Triangles sharing an edge are merged
+     * into a quad when it is convex, so the edges inside a mesh do not leave lines of holes. A hidden box can then only be reported
+     * visible, never the opposite, up to float rounding and as long as the occluders are inside the meshes they
+     * stand for. Occluders thinner than a pixel hide nothing.
+     */
+    class occlusion_buffer {
+    public:
+        static const int TILE_SIZE = 8;
+
+        /**
+         * @param width The horizontal resolution, rounded up to a multiple of TILE_SIZE.
+         * @param height The vertical resolution, rounded up to a multiple of TILE_SIZE.
+         */
+        occlusion_buffer(int width = 256, int height = 128);
+
+        /**
+         * @brief Clears the buffer and sets the camera of the frame.
+         *
+         * @param viewProjection The projection * view matrix of the camera.
+         */
+        void begin(const mat4& viewProjection);
+        /**
+         * @brief Queues the triangles of an occluder mesh, rasterised by end().
+         *
+         * @param vertices The vertex positions of the mesh.
+         * @param indices The triangle list indices.
+         * @param start The first index of the triangles.
+         * @param count The number of indices of the triangles.
+         * @param model The model matrix of the mesh.
+         */
+        void addOccluder(const vector<vec3>& vertices, const vector<unsigned int>& indices, size_t start, size_t count, const mat4& model);
+        /**
+         * @brief Rasterises the queued occluders and updates the depth of the tiles.
+         */
+        void end();
+
+        /**
+         * @brief Tests if a box is completely behind the rasterised occluders, thread safe.
+         *
+         * @param min Minimum of the box in model space.
+         * @param max Maximum of the box in model space.
+         * @param model Matrix taking the box to world space.
+         * @return True if no part of the box can be visible.
+         */
+        bool occluded(const vec3& min, const vec3& max, const mat4& model = mat4(1.0f)) const;
+        /**
+         * @brief Returns an occlusion test of boxes in the model space of an object, for instance culling.
+         */
+        occlusion_test test(const mat4& model) const;
+
+        int getWidth() const;
+        int getHeight() const;
+        /**
+         * @brief Returns the 1 / w of the closest occluder at a pixel, 0 where no occluder was rasterised.
+         */
+        float depthAt(int x, int y) const;
+        /**
+         * @brief Returns the number of primitives rasterised by the last end(), the triangles after near plane
+         * clipping with the neighbours forming a convex quad merged.
+         */
+        size_t getPrimitiveCount() const;
+
+    private:
+        /**
+         * @brief A screen space triangle or convex quad with edge functions E(x, y) = a * x + b * y + c, positive
+         * inside, and the planes of the 1 / w of its two triangles, the same plane twice for a single triangle.
+         */
+        struct primitive {
+            float edgeA[4], edgeB[4], edgeC[4];
+            float depthA[2], depthB[2], depthC[2];
+            int xMin, xMax, yMin, yMax;
+        };
+
+        int width, height, tilesX, tilesY;
+        mat4 viewProjection;
+        vector<float> depth;
+        vector<float> tileDepth;    /**< Farthest depth of every tile. */
+        vector<primitive> primitives;
+
+        /**
+         * @brief Queues a primitive given by its screen space corners (x, y, 1 / w).
+         *
+         * @param corners The 3 or 4 corners of a convex polygon.
+         * @param first The 3 corners of the triangle giving the first depth plane.
+         * @param second The 3 corners of the triangle giving the second depth plane.
+         */
+        void addPrimitive(const vec3* corners, int n, const vec3* first, const vec3* second);
+        void rasterizeTiles(int tileRow);
+    };
+}
+
+#endif
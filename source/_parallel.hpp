@@ -0,0 +1,39 @@
+#ifndef _PARALLEL
+#define _PARALLEL
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Splits the range [begin, end) into contiguous chunks and runs fn(chunkBegin, chunkEnd) for each chunk
+ * on its own thread, the first chunk runs on the calling thread.
+ *
+ * @param begin First index of the range.
+ * @param end One past the last index of the range.
+ * @param fn Callable invoked as fn(int chunkBegin, int chunkEnd).
+ * @param minChunk Minimal number of indices per thread, smaller ranges are processed on the calling thread.
+ */
+template <typename Function>
+void parallel_for(int begin, int end, Function fn, int minChunk = 1) {
+    const int count = end - begin;
+    if (count <= 0) {
+        return;
+    }
+    const int workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int chunks = std::min(workers, std::max(1, count / std::max(1, minChunk)));
+    if (chunks == 1) {
+        fn(begin, end);
+        return;
+    }
+    const int chunkSize = (count + chunks - 1) / chunks;
+    std::vector<std::thread> threads;
+    for (int start = begin + chunkSize; start < end; start += chunkSize) {
+        threads.push_back(std::thread(fn, start, std::min(end, start + chunkSize)));
+    }
+    fn(begin, std::min(end, begin + chunkSize));
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "_program_cache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+
+const uint32_t program_cache::VERSION;
+
+static const char MAGIC[4] = { 'S', 'P', 'R', 'B' };
+
+program_cache::program_cache(const string& directory) : directory(directory) {
+    if (!directory.empty()) {
+        // an existing directory is fine, a failure shows when the binaries are written
+        mkdir(directory.c_str(), 0755);
+    }
+}
+
+program_cache::~program_cache() {
+    for (auto& entry : programs) {
+        delete entry.second;
+    }
+}
+
+uint64_t program_cache::hash(const string& text, uint64_t seed) {
+    uint64_t h = seed;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+shader_program* program_cache::get(const char* vertexShaderPath, const char* fragmentShaderPath, vector<const char*> feedbackVaryings) {
+    const string vertexSource = shader_program::readShader(vertexShaderPath);
+    const string fragmentSource = shader_program::readShader(fragmentShaderPath);
+    // the separators keep e.g. sources "ab" + "c" and "a" + "bc" apart
+    uint64_t key = hash(vertexSource);
+    key = hash(string(1, '\0') + fragmentSource, key);
+    for (const char* varying : feedbackVaryings) {
+        key = hash(string(1, '\0') + varying, key);
+    }
+    auto it = programs.find(key);
+    if (it != programs.end()) {
+        stats.shared++;
+        return it->second;
+    }
+
+    if (driver.empty()) {
+        driver = string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "\n"
+            + reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "\n"
+            + reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        binariesSupported = formats > 0;
+    }
+
+    shader_program* program = new shader_program();
+    program->loadSources(vertexSource, fragmentSource);
+    program->setTransformFeedbackVaryings(feedbackVaryings);
+    if (!loadBinary(key, *program)) {
+        program->setBinaryRetrievable(binariesSupported && !directory.empty());
+        program->attach();
+        stats.compiled++;
+        storeBinary(key, *program);
+    }
+    programs[key] = program;
+    return program;
+}
+
+const program_cache::statistics& program_cache::getStatistics() const {
+    return stats;
+}
+
+string program_cache::binaryPath(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+template <typename T>
+static bool read_value(ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+static void write_value(ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+bool program_cache::loadBinary(uint64_t key, shader_program& program) {
+    if (!binariesSupported || directory.empty()) {
+        return false;
+    }
+    ifstream file(binaryPath(key), ios::binary | ios::ate);
+    if (!file) {
+        return false;
+    }
+    // the sizes read from the file are checked against it, so that a corrupt file cannot ask for a huge allocation
+    const streamoff fileSize = file.tellg();
+    file.seekg(0);
+    char magic[4];
+    uint32_t version = 0, driverLength = 0, format = 0, length = 0;
+    uint64_t storedKey = 0;
+    bool valid = file.read(magic, sizeof(magic)) && equal(magic, magic + 4, MAGIC)
+        && read_value(file, version) && version == VERSION
+        && read_value(file, storedKey) && storedKey == key
+        && read_value(file, driverLength) && driverLength == driver.size();
+    string storedDriver(valid ? driverLength : 0, '\0');
+    valid = valid && file.read(&storedDriver[0], driverLength) && storedDriver == driver
+        && read_value(file, format) && read_value(file, length) && length > 0
+        && length <= fileSize - static_cast<streamoff>(file.tellg());
+    vector<unsigned char> binary(valid ? length : 0);
+    valid = valid && file.read(reinterpret_cast<char*>(binary.data()), length)
+        && program.attachBinary(format, binary.data(), static_cast<GLsizei>(length));
+    if (!valid) {
+        stats.rejected++;
+        return false;
+    }
+    stats.binaries++;
+    return true;
+}
+
+void program_cache::storeBinary(uint64_t key, const shader_program& program) {
+    GLenum format = 0;
+    vector<unsigned char> binary;
+    if (!binariesSupported || directory.empty() || !program.getBinary(format, binary)) {
+        return;
+    }
+    // written next to the final file and only renamed once complete, so that a crash or a full disk never leaves a truncated binary
+    const string path = binaryPath(key);
+    const string temporary = path + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        if (!file) {
+            cout << "Cannot write the shader cache file " << temporary << endl;
+            return;
+        }
+        file.write(MAGIC, sizeof(MAGIC));
+        write_value(file, VERSION);
+        write_value(file, key);
+        write_value(file, static_cast<uint32_t>(driver.size()));
+        file.write(driver.data(), driver.size());
+        write_value(file, static_cast<uint32_t>(format));
+        write_value(file, static_cast<uint32_t>(binary.size()));
+        file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+        file.close();
+        if (!file) {
+            cout << "Cannot write the shader cache file " << temporary << endl;
+            remove(temporary.c_str());
+            return;
+        }
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        cout << "Cannot replace the shader cache file " << path << endl;
+        remove(temporary.c_str());
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef _PROGRAM_CACHE
+#define _PROGRAM_CACHE
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "_graphics.hpp"
+using namespace std;
+
+/**
+ * @brief Shader programs shared by every request for the same sources, with their linked binaries kept on disk.
+ *
+ * Programs are keyed by a hash of their shader sources and transform feedback varyings. A request for sources
+ * already in the cache returns the same program. A new program is first linked from the binary stored by a previous
+ * run with glProgramBinary. The binary is only used if it was made by the same driver, renderer and GL version, and
+ * if the driver accepts it. Otherwise the sources are compiled and the new binary replaces the stale one.
+ *
+ * The cache owns its programs, which are linked when returned and stay valid until the cache is destroyed.
+ */
+class program_cache {
+public:
+    struct statistics {
+        size_t shared = 0;      /**< Requests served by a program already in the cache. */
+        size_t binaries = 0;    /**< Programs linked from a binary on disk. */
+        size_t compiled = 0;    /**< Programs compiled from their sources. */
+        size_t rejected = 0;    /**< Binaries on disk that were stale or rejected by the driver. */
+    };
+
+    /**
+     * @brief Changes with the layout of the binary files, files of another version are stale.
+     */
+    static const uint32_t VERSION = 1;
+
+    /**
+     * @param directory The directory of the binaries, created if needed. Empty keeps the cache in memory only.
+     */
+    program_cache(const string& directory = "shader_cache");
+    ~program_cache();
+    program_cache(const program_cache&) = delete;
+    program_cache& operator=(const program_cache&) = delete;
+
+    /**
+     * @brief Returns the linked program of a pair of shaders, shared with every other request for the same sources.
+     *
+     * @param feedbackVaryings Vertex shader outputs captured by transform feedback, see shader_program::setTransformFeedbackVaryings().
+     */
+    shader_program* get(const char* vertexShaderPath, const char* fragmentShaderPath, vector<const char*> feedbackVaryings = {});
+    const statistics& getStatistics() const;
+
+    /**
+     * @brief 64 bit FNV-1a hash of a text, continuing from seed.
+     */
+    static uint64_t hash(const string& text, uint64_t seed = 14695981039346656037ull);
+
+private:
+    string directory;
+    string driver;      /**< Vendor, renderer and version of the context, queried by the first get(). */
+    bool binariesSupported = false;
+    unordered_map<uint64_t, shader_program*> programs;
+    statistics stats;
+
+    string binaryPath(uint64_t key) const;
+    /**
+     * @brief Links a program from its stored binary, false if there is none or it is stale.
+     */
+    bool loadBinary(uint64_t key, shader_program& program);
+    void storeBinary(uint64_t key, const shader_program& program);
+};
+
+#endif
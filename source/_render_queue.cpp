@@ -0,0 +1,125 @@
+#include "_render_queue.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int PASS_BITS = 4;
+static const int PROGRAM_BITS = 12;
+static const int TEXTURE_BITS = 12;
+static const int VERTEX_ARRAY_BITS = 16;
+static const int DEPTH_BITS = 20;
+
+static uint64_t field(unsigned int value, int bits, int shift) {
+    return (static_cast<uint64_t>(value) & ((uint64_t(1) << bits) - 1)) << shift;
+}
+
+uint64_t render_queue::make_key(unsigned int pass, unsigned int program, unsigned int texture, unsigned int vertexArray, float depth) {
+    // the bits of a non negative float sort like its value, its 20 highest bits keep 12 bits of mantissa
+    uint32_t depthBits;
+    const float distance = glm::max(depth, 0.0f);
+    memcpy(&depthBits, &distance, sizeof(depthBits));
+    return field(pass, PASS_BITS, 60)
+        | field(program, PROGRAM_BITS, 48)
+        | field(texture, TEXTURE_BITS, 36)
+        | field(vertexArray, VERTEX_ARRAY_BITS, DEPTH_BITS)
+        | field(depthBits >> (31 - DEPTH_BITS), DEPTH_BITS, 0);
+}
+
+unsigned int render_queue::dense_id(unordered_map<GLuint, unsigned int>& ids, GLuint name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    const unsigned int id = static_cast<unsigned int>(ids.size());
+    ids[name] = id;
+    return id;
+}
+
+void render_queue::submit(scene_obj* obj, const vec3& viewPosition, pass objectPass) {
+    geometry_buffer* gb = obj->gb;
+    if (!gb) {
+        return;
+    }
+    if (objectPass == PASS_AUTO) {
+        objectPass = obj->depthTest ? PASS_OPAQUE : PASS_OVERLAY;
+    }
+    const GLuint program = gb->sp ? gb->sp->getProgram() : 0;
+    const float distance = length(obj->worldBoundingBox().getCenter() - viewPosition);
+    item entry;
+    entry.key = make_key(
+        static_cast<unsigned int>(objectPass),
+        dense_id(programIds, program),
+        dense_id(textureIds, obj->getTexture()),
+        dense_id(vertexArrayIds, gb->vao),
+        std::isnan(distance) ? 0.0f : distance);
+    entry.order = items.size();
+    entry.obj = obj;
+    items.push_back(entry);
+}
+
+void render_queue::execute() {
+    sort(items.begin(), items.end(), [](const item& a, const item& b) {
+        return a.key != b.key ? a.key < b.key : a.order < b.order;
+    });
+    stats = statistics();
+    // the material block is shared by every program, the bound one serves every object with the same material
+    const material_props* material = nullptr;
+    GLuint program = 0, texture = 0, vertexArray = 0;
+    int depthTest = -1;
+    for (const item& entry : items) {
+        scene_obj* obj = entry.obj;
+        geometry_buffer* gb = obj->gb;
+        if (depthTest != static_cast<int>(obj->depthTest)) {
+            if (obj->depthTest) {
+                gl_state::enable(GL_DEPTH_TEST);
+            }
+            else {
+                gl_state::disable(GL_DEPTH_TEST);
+            }
+            depthTest = obj->depthTest;
+        }
+        if (gb->sp) {
+            if (gb->sp->getProgram() != program) {
+                gb->sp->use();
+                program = gb->sp->getProgram();
+                stats.programChanges++;
+            }
+            const material_props& objectMaterial = obj->getMaterialProperties();
+            if (!material
+                || material->ambientStrength != objectMaterial.ambientStrength
+                || material->diffuseStrength != objectMaterial.diffuseStrength
+                || material->specularStrength != objectMaterial.specularStrength) {
+                obj->applyMaterial();
+                material = &objectMaterial;
+                stats.materialChanges++;
+            }
+            obj->applyUniforms();
+        }
+        const GLuint objectTexture = obj->getTexture();
+        if (objectTexture && objectTexture != texture) {
+            gl_state::active_texture(GL_TEXTURE0);
+            gl_state::bind_texture(GL_TEXTURE_2D, objectTexture);
+            texture = objectTexture;
+            stats.textureChanges++;
+        }
+        if (gb->vao != vertexArray) {
+            vertexArray = gb->vao;
+            stats.vertexArrayChanges++;
+        }
+        gb->draw();
+        stats.draws++;
+    }
+    gl_state::use_program(0);
+    if (texture) {
+        gl_state::bind_texture(GL_TEXTURE_2D, 0);
+    }
+    items.clear();
+}
+
+size_t render_queue::size() const {
+    return items.size();
+}
+
+const render_queue::statistics& render_queue::getStatistics() const {
+    return stats;
+}
@@ -0,0 +1,79 @@
+#ifndef _RENDER_QUEUE
+#define _RENDER_QUEUE
+#include <cstdint>
+#include <unordered_map>
+#include "_graphics.hpp"
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief Collects the objects to draw in a frame and draws them sorted by the state they need.
+ *
+ * Every submitted object gets a 64 bit key made of, from the most to the least significant bits:
+ * the pass (4 bits), the shader program (12 bits), the texture (12 bits), the vertex array (16 bits)
+ * and the distance to the viewer (20 bits). Sorting the keys groups the objects sharing a program and
+ * a texture, execute() then only switches them between groups, and draws front to back inside a group
+ * to help early depth rejection. Programs, textures and vertex arrays are numbered in the order the queue
+ * first sees them, so the key fields stay small whatever names OpenGL hands out.
+ */
+class render_queue {
+public:
+    /**
+     * @brief The passes, drawn in this order.
+     */
+    enum pass {
+        PASS_OPAQUE = 0,    /**< Objects drawn with the depth test. */
+        PASS_OVERLAY = 1,   /**< Objects drawn without the depth test, over the opaque ones. */
+        PASS_AUTO = -1      /**< PASS_OPAQUE or PASS_OVERLAY from scene_obj::depthTest. */
+    };
+
+    /**
+     * @brief The state changes done by the last execute().
+     */
+    struct statistics {
+        size_t draws = 0;
+        size_t programChanges = 0;
+        size_t textureChanges = 0;
+        size_t vertexArrayChanges = 0;
+        size_t materialChanges = 0;
+    };
+
+    /**
+     * @brief Adds an object to the next execute().
+     *
+     * @param obj The object, drawn with the program of its geometry buffer.
+     * @param viewPosition The position of the viewer in world space.
+     * @param objectPass The pass of the object.
+     */
+    void submit(scene_obj* obj, const vec3& viewPosition, pass objectPass = PASS_AUTO);
+    /**
+     * @brief Draws the submitted objects in the order of their keys and empties the queue.
+     *
+     * The objects are drawn with the state set by scene_obj::draw(), but the material block is only bound when
+     * the material differs from the last one bound during this execute(). Overrides of scene_obj::draw()
+     * are not called.
+     */
+    void execute();
+    size_t size() const;
+    const statistics& getStatistics() const;
+
+    /**
+     * @brief Packs the fields of a key, every field is truncated to its number of bits.
+     */
+    static uint64_t make_key(unsigned int pass, unsigned int program, unsigned int texture, unsigned int vertexArray, float depth);
+
+private:
+    struct item {
+        uint64_t key;
+        size_t order;   /**< Submission order, keeps the sort deterministic for equal keys. */
+        scene_obj* obj;
+    };
+
+    vector<item> items;
+    statistics stats;
+    unordered_map<GLuint, unsigned int> programIds, textureIds, vertexArrayIds;
+
+    static unsigned int dense_id(unordered_map<GLuint, unsigned int>& ids, GLuint name);
+};
+
+#endif
@@ -0,0 +1,398 @@
+#include "_scene.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const int SAH_BINS = 16;
+static const int MAX_LEAF_SIZE = 4;
+static const int MAX_DEPTH = 64;
+// cost of visiting a node relative to testing an object
+static const float TRAVERSAL_COST = 1.0f;
+
+void scene::add(scene_obj* obj) {
+    objects.push_back(obj);
+    dirty = true;
+}
+
+void scene::remove(scene_obj* obj) {
+    objects.erase(std::remove(objects.begin(), objects.end(), obj), objects.end());
+    dirty = true;
+}
+
+size_t scene::size() const {
+    return objects.size();
+}
+
+void scene::build() {
+    const int n = static_cast<int>(objects.size());
+    objectBounds.resize(n);
+    order.resize(n);
+    for (int i = 0; i < n; i++) {
+        objectBounds[i] = objects[i]->worldBoundingBox();
+        order[i] = i;
+    }
+    nodes.clear();
+    nodes.reserve(2 * n);
+    if (n > 0) {
+        buildNode(0, n, 0);
+    }
+    buildBatches();
+    dirty = false;
+}
+
+void scene::buildBatches() {
+    batches.clear();
+    batchSlots.clear();
+    for (scene_obj* obj : objects) {
+        if (!obj->batched || !geometry_batch::accepts(obj)) {
+            continue;
+        }
+        size_t b = 0;
+        while (b < batches.size() && !batches[b]->compatible(obj)) {
+            b++;
+        }
+        if (b == batches.size()) {
+            batches.emplace_back(new geometry_batch());
+        }
+        batchSlots[obj] = make_pair(b, batches[b]->add(obj));
+    }
+    for (auto& batch : batches) {
+        batch->upload();
+    }
+    visibleSlots.assign(batches.size(), vector<size_t>());
+}
+
+int scene::buildNode(int first, int count, int depth) {
+    const int index = static_cast<int>(nodes.size());
+    nodes.push_back(node());
+    bounding_box bounds, centroids;
+    for (int i = first; i < first + count; i++) {
+        const bounding_box& box = objectBounds[order[i]];
+        bounds.expand(box);
+        // objects without geometry have no center, they go to the first bin
+        if (!box.isEmpty()) {
+            centroids.expand(box.getCenter());
+        }
+    }
+    nodes[index].bounds = bounds;
+    nodes[index].first = first;
+    nodes[index].count = count;
+    nodes[index].right = -1;
+    if (count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH || centroids.isEmpty()) {
+        return index;
+    }
+
+    // split along the largest axis of the centroids
+    const vec3 size = centroids.getMax() - centroids.getMin();
+    const int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    const float lo = centroids.getMin()[axis];
+    const float width = size[axis];
+    if (width <= 0.0f || !std::isfinite(width)) {
+        return index;
+    }
+
+    // bin the centroids, then evaluate the SAH cost of the SAH_BINS - 1 planes between the bins
+    bounding_box binBounds[SAH_BINS];
+    int binCount[SAH_BINS] = { 0 };
+    auto binOf = [&](int object) {
+        const bounding_box& box = objectBounds[object];
+        if (box.isEmpty()) {
+            return 0;
+        }
+        const int bin = static_cast<int>(SAH_BINS * (box.getCenter()[axis] - lo) / width);
+        return glm::clamp(bin, 0, SAH_BINS - 1);
+    };
+    for (int i = first; i < first + count; i++) {
+        const int bin = binOf(order[i]);
+        binCount[bin]++;
+        binBounds[bin].expand(objectBounds[order[i]]);
+    }
+    float leftArea[SAH_BINS], rightArea[SAH_BINS];
+    int leftCount[SAH_BINS], rightCount[SAH_BINS];
+    bounding_box sweep;
+    int sweepCount = 0;
+    for (int b = 0; b < SAH_BINS - 1; b++) {
+        sweep.expand(binBounds[b]);
+        sweepCount += binCount[b];
+        leftArea[b] = sweep.surfaceArea();
+        leftCount[b] = sweepCount;
+    }
+    sweep = bounding_box();
+    sweepCount = 0;
+    for (int b = SAH_BINS - 1; b > 0; b--) {
+        sweep.expand(binBounds[b]);
+        sweepCount += binCount[b];
+        rightArea[b - 1] = sweep.surfaceArea();
+        rightCount[b - 1] = sweepCount;
+    }
+    int bestSplit = -1;
+    float bestCost = INFINITY;
+    for (int b = 0; b < SAH_BINS - 1; b++) {
+        if (leftCount[b] == 0 || rightCount[b] == 0) {
+            continue;
+        }
+        const float cost = leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b];
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+    const float area = bounds.surfaceArea();
+    const float leafCost = static_cast<float>(count);
+    const float splitCost = area > 0.0f ? TRAVERSAL_COST + bestCost / area : INFINITY;
+    if (bestSplit < 0 || splitCost >= leafCost) {
+        return index;
+    }
+
+    int* middle = std::partition(order.data() + first, order.data() + first + count, [&](int object) {
+        return binOf(object) <= bestSplit;
+    });
+    const int leftSize = static_cast<int>(middle - (order.data() + first));
+    nodes[index].count = 0;
+    buildNode(first, leftSize, depth + 1);
+    const int right = buildNode(first + leftSize, count - leftSize, depth + 1);
+    nodes[index].right = right;
+    return index;
+}
+
+void scene::refit() {
+    if (dirty) {
+        build();
+        return;
+    }
+    for (size_t i = 0; i < objects.size(); i++) {
+        objectBounds[i] = objects[i]->worldBoundingBox();
+    }
+    // children are stored after their parent
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        node& current = nodes[i];
+        current.bounds = bounding_box();
+        if (current.count > 0) {
+            for (int j = current.first; j < current.first + current.count; j++) {
+                current.bounds.expand(objectBounds[order[j]]);
+            }
+        }
+        else {
+            current.bounds.expand(nodes[i + 1].bounds);
+            current.bounds.expand(nodes[current.right].bounds);
+        }
+    }
+}
+
+void scene::update() {
+    if (dirty) {
+        build();
+    }
+}
+
+void scene::collect(int nodeIndex, vector<int>& found) const {
+    const node& current = nodes[nodeIndex];
+    if (current.count > 0) {
+        for (int j = current.first; j < current.first + current.count; j++) {
+            if (!objectBounds[order[j]].isEmpty()) found.push_back(order[j]);
+        }
+        return;
+    }
+    collect(nodeIndex + 1, found);
+    collect(current.right, found);
+}
+
+void scene::sortedObjects(vector<int>& found, vector<scene_obj*>& result) const {
+    sort(found.begin(), found.end());
+    result.clear();
+    for (int object : found) {
+        result.push_back(objects[object]);
+    }
+}
+
+void scene::queryFrustum(const culling::frustum& f, vector<scene_obj*>& result) {
+    update();
+    vector<int> found;
+    vector<int> stack;
+    if (!nodes.empty()) stack.push_back(0);
+    while (!stack.empty()) {
+        const int index = stack.back();
+        stack.pop_back();
+        const node& current = nodes[index];
+        const culling::frustum::result r = f.test(current.bounds.getCenter(), current.bounds.getExtent());
+        if (r == culling::frustum::OUTSIDE) {
+            continue;
+        }
+        // everything below a node inside the frustum is visible
+        if (r == culling::frustum::INSIDE) {
+            collect(index, found);
+            continue;
+        }
+        if (current.count > 0) {
+            for (int j = current.first; j < current.first + current.count; j++) {
+                const bounding_box& box = objectBounds[order[j]];
+                if (!box.isEmpty() && f.test(box.getCenter(), box.getExtent()) != culling::frustum::OUTSIDE) found.push_back(order[j]);
+            }
+            continue;
+        }
+        stack.push_back(current.right);
+        stack.push_back(index + 1);
+    }
+    sortedObjects(found, result);
+}
+
+void scene::queryBox(const bounding_box& box, vector<scene_obj*>& result) {
+    update();
+    vector<int> found;
+    vector<int> stack;
+    if (!nodes.empty()) stack.push_back(0);
+    while (!stack.empty()) {
+        const int index = stack.back();
+        stack.pop_back();
+        const node& current = nodes[index];
+        if (!current.bounds.intersects(box)) {
+            continue;
+        }
+        if (current.count > 0) {
+            for (int j = current.first; j < current.first + current.count; j++) {
+                if (objectBounds[order[j]].intersects(box)) found.push_back(order[j]);
+            }
+            continue;
+        }
+        stack.push_back(current.right);
+        stack.push_back(index + 1);
+    }
+    sortedObjects(found, result);
+}
+
+/**
+ * @brief Slab test of a ray against a box, returns the entry distance or INFINITY if the box is missed.
+ */
+static float ray_box(const vec3& origin, const vec3& inverseDirection, const bounding_box& box, float maxDistance) {
+    if (box.isEmpty()) {
+        return INFINITY;
+    }
+    const vec3 t0 = (box.getMin() - origin) * inverseDirection;
+    const vec3 t1 = (box.getMax() - origin) * inverseDirection;
+    const vec3 tNear = min(t0, t1);
+    const vec3 tFar = max(t0, t1);
+    const float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+    const float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+    return enter <= exit ? enter : INFINITY;
+}
+
+void scene::queryRay(vec3 origin, vec3 direction, vector<scene_obj*>& result, float maxDistance) {
+    update();
+    const vec3 inverseDirection = 1.0f / direction;
+    vector<pair<float, int>> hits;
+    vector<int> stack;
+    if (!nodes.empty()) stack.push_back(0);
+    while (!stack.empty()) {
+        const int index = stack.back();
+        stack.pop_back();
+        const node& current = nodes[index];
+        if (ray_box(origin, inverseDirection, current.bounds, maxDistance) == INFINITY) {
+            continue;
+        }
+        if (current.count > 0) {
+            for (int j = current.first; j < current.first + current.count; j++) {
+                const float distance = ray_box(origin, inverseDirection, objectBounds[order[j]], maxDistance);
+                if (distance != INFINITY) hits.push_back({ distance, order[j] });
+            }
+            continue;
+        }
+        stack.push_back(current.right);
+        stack.push_back(index + 1);
+    }
+    sort(hits.begin(), hits.end());
+    result.clear();
+    for (auto& hit : hits) {
+        result.push_back(objects[hit.second]);
+    }
+}
+
+size_t scene::draw(const mat4& viewProjection, const vec3& viewPosition) {
+    vector<scene_obj*> visible;
+    queryFrustum(culling::frustum::from_matrix(viewProjection), visible);
+    if (occlusion) {
+        occlusion->begin(viewProjection);
+        for (scene_obj* obj : visible) {
+            if (obj->occluder) addOccluder(obj);
+        }
+        occlusion->end();
+    }
+    size_t drawn = 0;
+    for (scene_obj* obj : visible) {
+        instanced_geometry_buffer* igb = dynamic_cast<instanced_geometry_buffer*>(obj->gb);
+        if (occlusion && !obj->occluder) {
+            const bounding_box& box = obj->worldBoundingBox();
+            if (occlusion->occluded(box.getMin(), box.getMax())) {
+                continue;
+            }
+        }
+        auto batched = batchSlots.find(obj);
+        if (batched != batchSlots.end()) {
+            visibleSlots[batched->second.first].push_back(batched->second.second);
+            drawn++;
+            continue;
+        }
+        if (occlusion && !obj->occluder && igb) {
+            igb->occlusionTest = occlusion->test(obj->getModel());
+        }
+        obj->cull(viewProjection, viewPosition);
+        if (occlusion && !obj->occluder && igb) {
+            igb->occlusionTest = nullptr;
+        }
+        queue.submit(obj, viewPosition);
+        drawn++;
+    }
+    drawBatches(true);
+    queue.execute();
+    drawBatches(false);
+    return drawn;
+}
+
+void scene::drawBatches(bool depthTest) {
+    for (size_t b = 0; b < batches.size(); b++) {
+        if (batches[b]->front()->depthTest != depthTest) {
+            continue;
+        }
+        batches[b]->draw(visibleSlots[b]);
+        visibleSlots[b].clear();
+    }
+    gl_state::use_program(0);
+}
+
+geometry_batch::statistics scene::getBatchStatistics() const {
+    geometry_batch::statistics total;
+    for (const auto& batch : batches) {
+        total.objects += batch->getStatistics().objects;
+        total.patterns += batch->getStatistics().patterns;
+        total.draws += batch->getStatistics().draws;
+    }
+    return total;
+}
+
+const render_queue& scene::getRenderQueue() const {
+    return queue;
+}
+
+void scene::setOcclusion(culling::occlusion_buffer* occlusion) {
+    this->occlusion = occlusion;
+}
+
+void scene::addOccluder(scene_obj* obj) {
+    geometry_buffer* gb = obj->gb;
+    if (!gb) {
+        return;
+    }
+    vector<mat4> models { obj->getModel() };
+    if (instanced_geometry_buffer* igb = dynamic_cast<instanced_geometry_buffer*>(gb)) {
+        models.clear();
+        for (const mat4& instance : igb->getTransformations()) {
+            models.push_back(obj->getModel() * instance);
+        }
+    }
+    for (const DrawPattern& pattern : gb->drawPatterns) {
+        if (pattern.drawMode != GL_TRIANGLES) {
+            continue;
+        }
+        for (const mat4& model : models) {
+            occlusion->addOccluder(gb->vertices, gb->indices, pattern.start, pattern.count, model);
+        }
+    }
+}
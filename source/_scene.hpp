@@ -0,0 +1,135 @@
+#ifndef _SCENE
+#define _SCENE
+#include "_graphics.hpp"
+#include "_culling.hpp"
+#include "_occlusion.hpp"
+#include "_render_queue.hpp"
+#include "_geometry_batch.hpp"
+#include <memory>
+#include <unordered_map>
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief A container of scene objects indexed by a bounding volume hierarchy over their world boxes.
+ *
+ * The hierarchy is built with the surface area heuristic over binned centroids, and can be refitted when
+ * objects move without changing the tree. Frustum, box and ray queries only descend into nodes whose box
+ * passes the test, so they visit O(log n) nodes for small query regions.
+ *
+ * Objects with an empty box, e.g. without vertices or instances, stay in the hierarchy so that refit() picks
+ * them up once they have geometry, but no query returns them while their box is empty.
+ *
+ * The scene does not own its objects.
+ */
+class scene {
+public:
+    /**
+     * @brief Adds an object, the hierarchy is rebuilt by the next query.
+     */
+    void add(scene_obj* obj);
+    /**
+     * @brief Removes an object, the hierarchy is rebuilt by the next query.
+     */
+    void remove(scene_obj* obj);
+    size_t size() const;
+
+    /**
+     * @brief Rebuilds the hierarchy from the current world boxes of the objects, and the batches of the batched objects.
+     */
+    void build();
+    /**
+     * @brief Updates the boxes of the hierarchy after objects moved, keeping its structure.
+     *
+     * Cheaper than build() but the tree degrades when objects move far, rebuild then.
+     */
+    void refit();
+
+    /**
+     * @brief Collects the objects whose box intersects the frustum.
+     *
+     * @param f The frustum in world space, e.g. culling::frustum::from_matrix(projection * view).
+     * @param result Receives the objects, in the order they were added.
+     */
+    void queryFrustum(const culling::frustum& f, vector<scene_obj*>& result);
+    /**
+     * @brief Collects the objects whose box overlaps a box.
+     *
+     * @param box The box in world space.
+     * @param result Receives the objects, in the order they were added.
+     */
+    void queryBox(const bounding_box& box, vector<scene_obj*>& result);
+    /**
+     * @brief Collects the objects whose box is hit by a ray.
+     *
+     * @param origin The origin of the ray.
+     * @param direction The direction of the ray, does not need to be normalized.
+     * @param result Receives the objects sorted by the distance at which the ray enters their box.
+     * @param maxDistance Ignore boxes entered further away, in units of direction.
+     */
+    void queryRay(vec3 origin, vec3 direction, vector<scene_obj*>& result, float maxDistance = INFINITY);
+
+    /**
+     * @brief Draws the objects intersecting the view frustum, culling their instances first.
+     *
+     * The objects are drawn through a render_queue, grouped by program and texture and front to back. Visible
+     * objects marked scene_obj::batched are drawn from their batch instead, with one call per batch and primitive type:
+     * the batches with the depth test before the queue, the others after it.
+     *
+     * The shader programs must already be in use with the view and projection of the frame.
+     *
+     * @param viewProjection The projection * view matrix of the frame.
+     * @param viewPosition The position of the viewer, picks the levels of detail of instanced geometry.
+     * @return The number of drawn objects.
+     */
+    size_t draw(const mat4& viewProjection, const vec3& viewPosition);
+    /**
+     * @brief Enables software occlusion culling in draw().
+     *
+     * Every draw() then rasterises the triangles of the visible objects marked as occluders into the buffer,
+     * skips the other objects whose box is hidden behind them and culls the instance chunks the same way.
+     *
+     * @param occlusion The buffer used for the occluders, null disables occlusion culling.
+     */
+    void setOcclusion(culling::occlusion_buffer* occlusion);
+    /**
+     * @brief Returns the queue drawing the objects, with the statistics of the last draw().
+     */
+    const render_queue& getRenderQueue() const;
+    /**
+     * @brief Returns the sum of the statistics of the batches in the last draw().
+     */
+    geometry_batch::statistics getBatchStatistics() const;
+
+private:
+    /**
+     * @brief A node of the hierarchy, stored depth first: the left child directly follows its parent.
+     */
+    struct node {
+        bounding_box bounds;
+        int right;      /**< Index of the right child of an inner node. */
+        int first;      /**< First entry of a leaf in the object order. */
+        int count;      /**< Number of objects of a leaf, 0 for inner nodes. */
+    };
+
+    vector<scene_obj*> objects;
+    vector<bounding_box> objectBounds;
+    vector<int> order;
+    vector<node> nodes;
+    bool dirty = true;
+    culling::occlusion_buffer* occlusion = nullptr;
+    render_queue queue;
+    vector<unique_ptr<geometry_batch>> batches;
+    unordered_map<scene_obj*, pair<size_t, size_t>> batchSlots;    /**< Batch and slot of the batched objects. */
+    vector<vector<size_t>> visibleSlots;    /**< Visible slots of every batch during draw(). */
+
+    int buildNode(int first, int count, int depth);
+    void update();
+    void collect(int nodeIndex, vector<int>& found) const;
+    void sortedObjects(vector<int>& found, vector<scene_obj*>& result) const;
+    void addOccluder(scene_obj* obj);
+    void buildBatches();
+    void drawBatches(bool depthTest);
+};
+
+#endif
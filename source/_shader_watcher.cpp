@@ -0,0 +1,140 @@
+#include "_shader_watcher.hpp"
+#include <algorithm>
+#include <chrono>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+shader_watcher::shader_watcher(const string& directory) : directory(directory), running(true) {
+    listener = std::thread(&shader_watcher::listen, this);
+}
+
+shader_watcher::~shader_watcher() {
+    running = false;
+    listener.join();
+}
+
+void shader_watcher::watch(shader_program* program, const char* vertexShaderPath, const char* fragmentShaderPath) {
+    programs.push_back({ program, vertexShaderPath, fragmentShaderPath, program->getVertexSource(), program->getFragmentSource() });
+    std::lock_guard<std::mutex> lock(changesMutex);
+    paths.push_back(vertexShaderPath);
+    paths.push_back(fragmentShaderPath);
+}
+
+void shader_watcher::update() {
+    unordered_map<string, string> sources;
+    {
+        std::lock_guard<std::mutex> lock(changesMutex);
+        sources.swap(changed);
+    }
+    stats.changes += sources.size();
+    for (watched_program& w : programs) {
+        auto vertex = sources.find(w.vertexPath);
+        auto fragment = sources.find(w.fragmentPath);
+        if (vertex != sources.end() || fragment != sources.end()) {
+            if (vertex != sources.end()) {
+                w.vertexSource = vertex->second;
+            }
+            if (fragment != sources.end()) {
+                w.fragmentSource = fragment->second;
+            }
+            w.program->reload(w.vertexSource, w.fragmentSource);
+        }
+        switch (w.program->finishReload()) {
+        case shader_program::RELOAD_SWAPPED:
+            stats.reloads++;
+            cout << "Reloaded " << w.vertexPath << " and " << w.fragmentPath << endl;
+            break;
+        case shader_program::RELOAD_FAILED:
+            stats.failures++;
+            cout << "Kept the previous version of " << w.vertexPath << " and " << w.fragmentPath << endl;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+const shader_watcher::statistics& shader_watcher::getStatistics() const {
+    return stats;
+}
+
+void shader_watcher::fileChanged(const string& path) {
+    {
+        std::lock_guard<std::mutex> lock(changesMutex);
+        if (find(paths.begin(), paths.end(), path) == paths.end()) {
+            return;
+        }
+    }
+    // read here rather than by update(), the render thread only compiles
+    const string source = shader_program::readShader(path.c_str());
+    // a file being replaced can be briefly empty, its next write is reported too
+    if (source.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(changesMutex);
+    changed[path] = source;
+}
+
+#ifdef __linux__
+void shader_watcher::listen() {
+    const int descriptor = inotify_init1(IN_NONBLOCK);
+    if (descriptor < 0) {
+        cout << "Cannot watch the shaders, inotify is not available" << endl;
+        return;
+    }
+    // editors that save to a temporary file and rename it over the shader are reported by IN_MOVED_TO
+    if (inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        cout << "Cannot watch the shaders in " << directory << endl;
+        close(descriptor);
+        return;
+    }
+    alignas(inotify_event) char events[4096];
+    while (running) {
+        // the timeout bounds how long the destructor waits for the thread
+        pollfd request = { descriptor, POLLIN, 0 };
+        if (poll(&request, 1, 100) <= 0) {
+            continue;
+        }
+        const ssize_t length = read(descriptor, events, sizeof(events));
+        for (ssize_t at = 0; at < length; ) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(events + at);
+            if (event->len > 0) {
+                fileChanged(directory + "/" + event->name);
+            }
+            at += sizeof(inotify_event) + event->len;
+        }
+    }
+    close(descriptor);
+}
+#else
+void shader_watcher::listen() {
+    // without inotify the modification times of the watched files are compared
+    unordered_map<string, time_t> times;
+    while (running) {
+        vector<string> watchedPaths;
+        {
+            std::lock_guard<std::mutex> lock(changesMutex);
+            watchedPaths = paths;
+        }
+        for (const string& path : watchedPaths) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) {
+                continue;
+            }
+            auto it = times.find(path);
+            if (it == times.end()) {
+                times[path] = info.st_mtime;
+            }
+            else if (it->second != info.st_mtime) {
+                it->second = info.st_mtime;
+                fileChanged(path);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef _SHADER_WATCHER
+#define _SHADER_WATCHER
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "_graphics.hpp"
+using namespace std;
+
+/**
+ * @brief Reloads shader programs while the application runs when their sources change on disk.
+ *
+ * A background thread waits for the files of a directory to be written, with inotify on Linux and by comparing
+ * their modification times elsewhere, and reads the new sources. update() hands them to the programs at a frame
+ * boundary: every program using a changed file compiles a replacement with shader_program::reload(), which only
+ * replaces it once it links, so a shader with errors keeps the previous version on screen.
+ *
+ * The programs are replaced in place, geometry buffers keep their shader_program and point their vertex arrays at
+ * the new inputs on their next draw.
+ */
+class shader_watcher {
+public:
+    struct statistics {
+        size_t changes = 0;     /**< Writes of watched files. */
+        size_t reloads = 0;     /**< Programs replaced by their new sources. */
+        size_t failures = 0;    /**< New sources that did not link. */
+    };
+
+    /**
+     * @param directory The directory of the shader files, the watched paths are given below it.
+     */
+    shader_watcher(const string& directory = "shaders");
+    ~shader_watcher();
+    shader_watcher(const shader_watcher&) = delete;
+    shader_watcher& operator=(const shader_watcher&) = delete;
+
+    /**
+     * @brief Reloads a program whenever one of its shader files changes.
+     *
+     * @param vertexShaderPath Path of the vertex shader in the watched directory, e.g. "shaders/vertex_shader.glsl".
+     */
+    void watch(shader_program* program, const char* vertexShaderPath, const char* fragmentShaderPath);
+    /**
+     * @brief Starts the reloads of the changed files and swaps in the programs that finished linking.
+     * Call it once per frame on the thread of the GL context, before drawing.
+     */
+    void update();
+    const statistics& getStatistics() const;
+
+private:
+    struct watched_program {
+        shader_program* program;
+        string vertexPath;
+        string fragmentPath;
+        string vertexSource;    /**< The latest sources, which a reload still compiling may not have swapped in yet. */
+        string fragmentSource;
+    };
+
+    string directory;
+    vector<watched_program> programs;
+    statistics stats;
+
+    std::thread listener;
+    std::atomic<bool> running;
+    std::mutex changesMutex;
+    /**
+     * @brief The sources of the files written since the last update() by path, filled by the listener.
+     */
+    unordered_map<string, string> changed;
+    /**
+     * @brief The paths of the watched files, read by the listener.
+     */
+    vector<string> paths;
+
+    /**
+     * @brief The loop of the listener thread, until running is cleared.
+     */
+    void listen();
+    /**
+     * @brief Reads a written file and queues its source for update(), if it is watched.
+     */
+    void fileChanged(const string& path);
+};
+
+#endif
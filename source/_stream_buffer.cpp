@@ -0,0 +1,126 @@
+#include "_stream_buffer.hpp"
+#include "_gl_state.hpp"
+#include <algorithm>
+#include <cstring>
+
+const int stream_buffer::REGIONS;
+const size_t stream_buffer::ALIGNMENT;
+
+stream_buffer::stream_buffer(mode m) : streamMode(m) {}
+
+stream_buffer::~stream_buffer() {
+    deleteFences();
+    if (name) {
+        gl_state::delete_buffers(1, &name);
+    }
+}
+
+void stream_buffer::setMode(mode m) {
+    if (m == streamMode) {
+        return;
+    }
+    // the next write starts over in a new storage in either mode
+    deleteFences();
+    regionSize = 0;
+    streamMode = m;
+}
+
+stream_buffer::mode stream_buffer::getMode() const {
+    return streamMode;
+}
+
+void stream_buffer::waitRegion(int r) {
+    if (!fences[r]) {
+        return;
+    }
+    GLenum status = glClientWaitSync(fences[r], 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        stats.waits++;
+        do {
+            status = glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fences[r]);
+    fences[r] = nullptr;
+}
+
+void stream_buffer::deleteFences() {
+    for (GLsync& f : fences) {
+        if (f) {
+            glDeleteSync(f);
+            f = nullptr;
+        }
+    }
+}
+
+void stream_buffer::orphan(size_t capacity, size_t offset, const void* data, size_t size) {
+    stats.orphans++;
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+}
+
+size_t stream_buffer::write(const void* data, size_t size) {
+    if (!name) {
+        glGenBuffers(1, &name);
+    }
+    stats.writes++;
+    stats.bytes += size;
+    gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, name);
+    if (streamMode == MODE_ORPHAN) {
+        orphan(size, 0, data, size);
+        currentOffset = 0;
+        return currentOffset;
+    }
+
+    if (size > regionSize) {
+        // the old storage stays alive for the pending draws, so its fences are not needed any more
+        deleteFences();
+        regionSize = std::max(2 * regionSize, (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+        region = 0;
+        currentOffset = 0;
+        orphan(REGIONS * regionSize, 0, data, size);
+        return currentOffset;
+    }
+    region = (region + 1) % REGIONS;
+    waitRegion(region);
+    currentOffset = region * regionSize;
+    if (size == 0) {
+        return currentOffset;
+    }
+    void* mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, currentOffset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!mapped) {
+        deleteFences();
+        orphan(REGIONS * regionSize, currentOffset, data, size);
+        return currentOffset;
+    }
+    memcpy(mapped, data, size);
+    // the contents of a mapping can be lost, e.g. on a mode switch of the display
+    if (!glUnmapBuffer(GL_COPY_WRITE_BUFFER)) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, currentOffset, size, data);
+    }
+    return currentOffset;
+}
+
+void stream_buffer::fence() {
+    if (streamMode != MODE_RING || !name) {
+        return;
+    }
+    // the new fence also covers the draws of the previous one
+    if (fences[region]) {
+        glDeleteSync(fences[region]);
+    }
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+GLuint stream_buffer::buffer() const {
+    return name;
+}
+
+size_t stream_buffer::offset() const {
+    return currentOffset;
+}
+
+stream_buffer::statistics stream_buffer::getStatistics() const {
+    return stats;
+}
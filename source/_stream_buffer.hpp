@@ -0,0 +1,94 @@
+#ifndef _STREAM_BUFFER
+#define _STREAM_BUFFER
+#include <cstddef>
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
+
+/**
+ * @brief A GL buffer rewritten every frame without waiting for the draws still reading its previous contents.
+ *
+ * In MODE_RING the buffer is split in REGIONS regions used in turn: write() maps the next region unsynchronised
+ * with glMapBufferRange, which never blocks, and fence() puts a glFenceSync after the draws reading it. A region is
+ * only waited on when the GPU is more than REGIONS - 1 writes behind. In MODE_ORPHAN write() gives the storage
+ * back with glBufferData(nullptr) and fills a new one, the driver keeps the old storage alive for the pending draws.
+ * The ring falls back to orphaning when a region cannot be mapped.
+ *
+ * Every write() replaces the whole contents, the data moves to another offset of the buffer each time.
+ */
+class stream_buffer {
+public:
+    enum mode {
+        MODE_RING,      /**< Unsynchronised writes to fenced regions used in turn. */
+        MODE_ORPHAN,    /**< A new storage for every write. */
+    };
+
+    /**
+     * @brief The number of regions of the ring, enough for the frame being recorded and two in flight.
+     */
+    static const int REGIONS = 3;
+    /**
+     * @brief Every region starts at a multiple of this.
+     */
+    static const size_t ALIGNMENT = 256;
+
+    struct statistics {
+        size_t writes = 0;
+        size_t bytes = 0;
+        size_t waits = 0;       /**< Writes that had to wait for the GPU to release their region. */
+        size_t orphans = 0;     /**< Writes that orphaned the storage, every write in MODE_ORPHAN. */
+    };
+
+    stream_buffer(mode m = MODE_RING);
+    ~stream_buffer();
+    stream_buffer(const stream_buffer&) = delete;
+    stream_buffer& operator=(const stream_buffer&) = delete;
+
+    /**
+     * @brief Changes how the next writes reach the buffer.
+     */
+    void setMode(mode m);
+    mode getMode() const;
+
+    /**
+     * @brief Replaces the contents with size bytes of data.
+     *
+     * @return The offset of the data in buffer().
+     */
+    size_t write(const void* data, size_t size);
+    /**
+     * @brief Marks the data of the last write() as read by the commands issued so far, call it after drawing from it.
+     */
+    void fence();
+
+    GLuint buffer() const;
+    /**
+     * @brief Returns the offset of the data of the last write().
+     */
+    size_t offset() const;
+    statistics getStatistics() const;
+
+private:
+    mode streamMode;
+    GLuint name = 0;
+    size_t regionSize = 0;
+    int region = 0;
+    size_t currentOffset = 0;
+    GLsync fences[REGIONS] = {};
+    statistics stats;
+
+    /**
+     * @brief Blocks until the draws reading a region are done.
+     */
+    void waitRegion(int r);
+    void deleteFences();
+    /**
+     * @brief Replaces the storage by a new one of capacity bytes and writes size bytes of data at offset.
+     */
+    void orphan(size_t capacity, size_t offset, const void* data, size_t size);
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include "_uniform_buffer.hpp"
+#include "_gl_state.hpp"
+#include <cstring>
+
+uniform_buffer::uniform_buffer() {}
+
+uniform_buffer::~uniform_buffer() {
+    if (name) {
+        gl_state::delete_buffers(1, &name);
+    }
+}
+
+bool uniform_buffer::update(const void* data, size_t size) {
+    if (name && size == contents.size() && memcmp(contents.data(), data, size) == 0) {
+        return false;
+    }
+    if (!name) {
+        glGenBuffers(1, &name);
+    }
+    gl_state::bind_buffer(GL_UNIFORM_BUFFER, name);
+    if (size != contents.size()) {
+        glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+    }
+    else {
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    }
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    contents.assign(bytes, bytes + size);
+    uploads++;
+    return true;
+}
+
+void uniform_buffer::bind(GLuint index) const {
+    gl_state::bind_buffer_base(GL_UNIFORM_BUFFER, index, name);
+}
+
+GLuint uniform_buffer::buffer() const {
+    return name;
+}
+
+size_t uniform_buffer::getUploads() const {
+    return uploads;
+}
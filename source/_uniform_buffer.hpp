@@ -0,0 +1,52 @@
+#ifndef _UNIFORM_BUFFER
+#define _UNIFORM_BUFFER
+#include <cstddef>
+#include <vector>
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
+using namespace std;
+
+/**
+ * @brief A GL buffer holding one uniform block, only uploaded when its contents change.
+ *
+ * The last uploaded bytes are kept so that update() with the same block is a compare instead of a driver call.
+ * Blocks must be laid out with the std140 rules of the shader, with their padding zeroed so that equal blocks
+ * compare equal.
+ */
+class uniform_buffer {
+public:
+    uniform_buffer();
+    ~uniform_buffer();
+    uniform_buffer(const uniform_buffer&) = delete;
+    uniform_buffer& operator=(const uniform_buffer&) = delete;
+
+    /**
+     * @brief Uploads a block if it differs from the last upload.
+     *
+     * @return Whether the block was uploaded.
+     */
+    bool update(const void* data, size_t size);
+    template <typename T>
+    bool update(const T& block) { return update(&block, sizeof(T)); }
+    /**
+     * @brief Binds the buffer to a uniform block binding point.
+     */
+    void bind(GLuint index) const;
+
+    GLuint buffer() const;
+    /**
+     * @brief Returns the number of updates that reached the driver.
+     */
+    size_t getUploads() const;
+
+private:
+    GLuint name = 0;
+    vector<unsigned char> contents;
+    size_t uploads = 0;
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include "_vertex_format.hpp"
+#include <glm/gtc/quaternion.hpp>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+namespace vertex_format {
+
+    vertex_layout vertex_layout::packed() {
+        vertex_layout layout;
+        layout.position = POSITION_HALF;
+        layout.color = COLOR_RGBA8;
+        layout.normal = NORMAL_OCTAHEDRAL;
+        layout.uv = UV_UNORM16;
+        layout.interleaved = true;
+        return layout;
+    }
+
+    attribute_desc vertex_layout::describe(attribute a) const {
+        switch (a) {
+        case ATTRIB_POSITION:
+            // half positions are padded to keep the following attributes 4 byte aligned
+            return position == POSITION_HALF
+                ? attribute_desc { 3, GL_HALF_FLOAT, GL_FALSE, 4 * sizeof(uint16_t) }
+                : attribute_desc { 3, GL_FLOAT, GL_FALSE, sizeof(vec3) };
+        case ATTRIB_COLOR:
+            return color == COLOR_RGBA8
+                ? attribute_desc { 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 * sizeof(uint8_t) }
+                : attribute_desc { 3, GL_FLOAT, GL_FALSE, sizeof(vec3) };
+        case ATTRIB_NORMAL:
+            if (normal == NORMAL_OCTAHEDRAL) return attribute_desc { 2, GL_SHORT, GL_TRUE, 2 * sizeof(int16_t) };
+            if (normal == NORMAL_INT_2_10_10_10) return attribute_desc { 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(uint32_t) };
+            return attribute_desc { 3, GL_FLOAT, GL_FALSE, sizeof(vec3) };
+        case ATTRIB_UV:
+            return uv == UV_UNORM16
+                ? attribute_desc { 2, GL_UNSIGNED_SHORT, GL_TRUE, 2 * sizeof(uint16_t) }
+                : attribute_desc { 2, GL_FLOAT, GL_FALSE, sizeof(vec2) };
+        default:
+            return attribute_desc { 0, GL_FLOAT, GL_FALSE, 0 };
+        }
+    }
+
+    GLsizei vertex_layout::offset(attribute a) const {
+        GLsizei offset = 0;
+        for (int i = 0; i < a; i++) {
+            offset += describe(static_cast<attribute>(i)).bytes;
+        }
+        return offset;
+    }
+
+    GLsizei vertex_layout::stride(bool uvs) const {
+        return offset(uvs ? ATTRIB_COUNT : ATTRIB_UV);
+    }
+
+    int vertex_layout::normalEncoding() const {
+        return normal == NORMAL_OCTAHEDRAL ? NORMAL_ENCODING_OCTAHEDRAL : NORMAL_ENCODING_NONE;
+    }
+
+    const char* attribute_name(attribute a) {
+        static const char* names[ATTRIB_COUNT] = { "vPos", "vColor", "vNormal", "vTexCoord" };
+        return a < ATTRIB_COUNT ? names[a] : nullptr;
+    }
+
+    unsigned short float_to_half(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        const uint32_t sign = (bits >> 16) & 0x8000;
+        const uint32_t exponent = (bits >> 23) & 0xFF;
+        uint32_t mantissa = bits & 0x7FFFFF;
+
+        if (exponent == 0xFF) {
+            // infinity, NaN keeps a mantissa bit set
+            return static_cast<unsigned short>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+        }
+        const int halfExponent = static_cast<int>(exponent) - 127 + 15;
+        if (halfExponent >= 0x1F) {
+            return static_cast<unsigned short>(sign | 0x7C00);
+        }
+        if (halfExponent <= 0) {
+            // subnormal half, or zero if even rounding cannot reach the smallest subnormal
+            if (halfExponent < -10) {
+                return static_cast<unsigned short>(sign);
+            }
+            mantissa |= 0x800000;
+            const int shift = 14 - halfExponent;
+            uint32_t half = mantissa >> shift;
+            const uint32_t rest = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (half & 1))) half++;
+            return static_cast<unsigned short>(sign | half);
+        }
+        uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+        const uint32_t rest = mantissa & 0x1FFF;
+        // a carry out of the mantissa correctly rounds up to the next exponent
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+        return static_cast<unsigned short>(sign | half);
+    }
+
+    vec2 oct_encode(vec3 normal) {
+        const float l1 = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+        if (l1 == 0.0f) {
+            return vec2(0.0f);
+        }
+        vec2 p = vec2(normal.x, normal.y) / l1;
+        if (normal.z < 0.0f) {
+            // fold the lower hemisphere over the diagonals
+            const vec2 folded = vec2(1.0f - fabsf(p.y), 1.0f - fabsf(p.x));
+            p = vec2(p.x >= 0.0f ? folded.x : -folded.x, p.y >= 0.0f ? folded.y : -folded.y);
+        }
+        return p;
+    }
+
+    static int snorm(float value, int maxValue) {
+        return static_cast<int>(roundf(clamp(value, -1.0f, 1.0f) * maxValue));
+    }
+
+    static unsigned int unorm(float value, unsigned int maxValue) {
+        return static_cast<unsigned int>(roundf(clamp(value, 0.0f, 1.0f) * maxValue));
+    }
+
+    unsigned int pack_snorm_2_10_10_10(vec3 value) {
+        const unsigned int x = static_cast<unsigned int>(snorm(value.x, 511)) & 0x3FF;
+        const unsigned int y = static_cast<unsigned int>(snorm(value.y, 511)) & 0x3FF;
+        const unsigned int z = static_cast<unsigned int>(snorm(value.z, 511)) & 0x3FF;
+        return x | (y << 10) | (z << 20);
+    }
+
+    /**
+     * @brief Writes one attribute value at dst in the format of the layout, dst must hold describe(a).bytes.
+     */
+    static void write_attribute(const vertex_layout& layout, attribute a, const float* value, unsigned char* dst) {
+        switch (a) {
+        case ATTRIB_POSITION:
+            if (layout.position == POSITION_HALF) {
+                const uint16_t half[4] = { float_to_half(value[0]), float_to_half(value[1]), float_to_half(value[2]), 0 };
+                memcpy(dst, half, sizeof(half));
+                return;
+            }
+            break;
+        case ATTRIB_COLOR:
+            if (layout.color == COLOR_RGBA8) {
+                const uint8_t rgba[4] = {
+                    static_cast<uint8_t>(unorm(value[0], 255)),
+                    static_cast<uint8_t>(unorm(value[1], 255)),
+                    static_cast<uint8_t>(unorm(value[2], 255)),
+                    255
+                };
+                memcpy(dst, rgba, sizeof(rgba));
+                return;
+            }
+            break;
+        case ATTRIB_NORMAL:
+            if (layout.normal == NORMAL_OCTAHEDRAL) {
+                const vec2 oct = oct_encode(vec3(value[0], value[1], value[2]));
+                const int16_t packed[2] = { static_cast<int16_t>(snorm(oct.x, 32767)), static_cast<int16_t>(snorm(oct.y, 32767)) };
+                memcpy(dst, packed, sizeof(packed));
+                return;
+            }
+            if (layout.normal == NORMAL_INT_2_10_10_10) {
+                const uint32_t packed = pack_snorm_2_10_10_10(vec3(value[0], value[1], value[2]));
+                memcpy(dst, &packed, sizeof(packed));
+                return;
+            }
+            break;
+        case ATTRIB_UV:
+            if (layout.uv == UV_UNORM16) {
+                const uint16_t packed[2] = { static_cast<uint16_t>(unorm(value[0], 65535)), static_cast<uint16_t>(unorm(value[1], 65535)) };
+                memcpy(dst, packed, sizeof(packed));
+                return;
+            }
+            break;
+        default:
+            return;
+        }
+        // float formats
+        memcpy(dst, value, layout.describe(a).bytes);
+    }
+
+    vector<unsigned char> pack_stream(const vertex_layout& layout, attribute a, const vector<vec3>& values) {
+        const GLsizei bytes = layout.describe(a).bytes;
+        vector<unsigned char> data(values.size() * bytes);
+        for (size_t i = 0; i < values.size(); i++) {
+            write_attribute(layout, a, &values[i].x, data.data() + i * bytes);
+        }
+        return data;
+    }
+
+    vector<unsigned char> pack_stream(const vertex_layout& layout, const vector<vec2>& uvs) {
+        const GLsizei bytes = layout.describe(ATTRIB_UV).bytes;
+        vector<unsigned char> data(uvs.size() * bytes);
+        for (size_t i = 0; i < uvs.size(); i++) {
+            write_attribute(layout, ATTRIB_UV, &uvs[i].x, data.data() + i * bytes);
+        }
+        return data;
+    }
+
+    vector<unsigned char> pack_interleaved(
+        const vertex_layout& layout,
+        const vector<vec3>& positions,
+        const vector<vec3>& colors,
+        const vector<vec3>& normals,
+        const vector<vec2>* uvs
+    ) {
+        const size_t n = positions.size();
+        const GLsizei stride = layout.stride(uvs != nullptr);
+        const GLsizei colorOffset = layout.offset(ATTRIB_COLOR);
+        const GLsizei normalOffset = layout.offset(ATTRIB_NORMAL);
+        const GLsizei uvOffset = layout.offset(ATTRIB_UV);
+        const vec3 zero(0.0f);
+
+        vector<unsigned char> data(n * stride);
+        for (size_t i = 0; i < n; i++) {
+            unsigned char* vertex = data.data() + i * stride;
+            write_attribute(layout, ATTRIB_POSITION, &positions[i].x, vertex);
+            write_attribute(layout, ATTRIB_COLOR, i < colors.size() ? &colors[i].x : &zero.x, vertex + colorOffset);
+            write_attribute(layout, ATTRIB_NORMAL, i < normals.size() ? &normals[i].x : &zero.x, vertex + normalOffset);
+            if (uvs) {
+                write_attribute(layout, ATTRIB_UV, i < uvs->size() ? &(*uvs)[i].x : &zero.x, vertex + uvOffset);
+            }
+        }
+        return data;
+    }
+
+    // formats ordered from the most compact to the most general
+    static int generality(instance_format format) {
+        switch (format) {
+        case INSTANCE_TRANSLATION: return 0;
+        case INSTANCE_TRANSLATION_SCALE_YAW: return 1;
+        case INSTANCE_TRANSLATION_QUAT_SCALE: return 2;
+        default: return 3;
+        }
+    }
+
+    instance_format most_general(instance_format a, instance_format b) {
+        return generality(a) >= generality(b) ? a : b;
+    }
+
+    instance_format detect_instance_format(const mat4& matrix, float tolerance) {
+        if (fabsf(matrix[0][3]) > tolerance || fabsf(matrix[1][3]) > tolerance || fabsf(matrix[2][3]) > tolerance || fabsf(matrix[3][3] - 1.0f) > tolerance) {
+            return INSTANCE_MAT4;
+        }
+        const mat3 basis(matrix);
+        const float scale = length(basis[0]);
+        if (scale <= tolerance) {
+            return INSTANCE_MAT4;
+        }
+        // a uniformly scaled rotation: orthonormal columns after removing the scale, and no mirroring
+        const mat3 rotation(basis[0] / scale, basis[1] / scale, basis[2] / scale);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                if (fabsf(dot(rotation[i], rotation[j]) - (i == j ? 1.0f : 0.0f)) > tolerance) {
+                    return INSTANCE_MAT4;
+                }
+            }
+        }
+        if (determinant(rotation) < 0.0f) {
+            return INSTANCE_MAT4;
+        }
+        const float eps = tolerance * scale;
+        bool identity = true;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                identity = identity && fabsf(basis[i][j] - (i == j ? 1.0f : 0.0f)) <= tolerance;
+            }
+        }
+        if (identity) {
+            return INSTANCE_TRANSLATION;
+        }
+        // a rotation around y keeps the y axis and moves x and z in the xz plane
+        if (fabsf(basis[0][1]) <= eps && fabsf(basis[2][1]) <= eps && fabsf(basis[1][0]) <= eps && fabsf(basis[1][2]) <= eps) {
+            return INSTANCE_TRANSLATION_SCALE_YAW;
+        }
+        return INSTANCE_TRANSLATION_QUAT_SCALE;
+    }
+
+    instance_format detect_instance_format(const vector<mat4>& matrices, size_t start, size_t end) {
+        instance_format format = INSTANCE_TRANSLATION;
+        for (size_t i = start; i < end && format != INSTANCE_MAT4; i++) {
+            format = most_general(format, detect_instance_format(matrices[i]));
+        }
+        return format;
+    }
+
+    GLsizei instance_stride(instance_format format) {
+        switch (format) {
+        case INSTANCE_TRANSLATION: return 3 * sizeof(float);
+        case INSTANCE_TRANSLATION_SCALE_YAW: return 5 * sizeof(float);
+        case INSTANCE_TRANSLATION_QUAT_SCALE: return 8 * sizeof(float);
+        default: return sizeof(mat4);
+        }
+    }
+
+    GLint instance_column_size(instance_format format, int column) {
+        switch (format) {
+        case INSTANCE_TRANSLATION: return column == 0 ? 3 : 0;
+        case INSTANCE_TRANSLATION_SCALE_YAW: return column == 0 ? 4 : column == 1 ? 1 : 0;
+        case INSTANCE_TRANSLATION_QUAT_SCALE: return column < 2 ? 4 : 0;
+        default: return 4;
+        }
+    }
+
+    void pack_instances(instance_format format, const mat4* matrices, size_t count, unsigned char* dst) {
+        const GLsizei stride = instance_stride(format);
+        for (size_t i = 0; i < count; i++, dst += stride) {
+            const mat4& matrix = matrices[i];
+            const float scale = length(vec3(matrix[0]));
+            // translation.xyz, then scale and the rotation
+            float values[8] = { matrix[3][0], matrix[3][1], matrix[3][2], scale };
+            switch (format) {
+            case INSTANCE_TRANSLATION:
+                break;
+            case INSTANCE_TRANSLATION_SCALE_YAW:
+                // first column of the y rotation is (cos, 0, -sin)
+                values[4] = atan2f(-matrix[0][2], matrix[0][0]);
+                break;
+            case INSTANCE_TRANSLATION_QUAT_SCALE: {
+                const quat rotation = quat_cast(mat3(vec3(matrix[0]) / scale, vec3(matrix[1]) / scale, vec3(matrix[2]) / scale));
+                values[4] = rotation.x;
+                values[5] = rotation.y;
+                values[6] = rotation.z;
+                values[7] = rotation.w;
+                break;
+            }
+            default:
+                memcpy(dst, &matrix[0][0], sizeof(mat4));
+                continue;
+            }
+            memcpy(dst, values, stride);
+        }
+    }
+
+    void pack_instances(instance_format format, const mat4* matrices, const unsigned int* indices, size_t count, unsigned char* dst) {
+        const GLsizei stride = instance_stride(format);
+        for (size_t i = 0; i < count; i++) {
+            pack_instances(format, matrices + indices[i], 1, dst + i * stride);
+        }
+    }
+}
@@ -0,0 +1,196 @@
+#ifndef _VERTEX_FORMAT
+#define _VERTEX_FORMAT
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
+#include <vector>
+#include <glm/glm.hpp>
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief Vertex layouts of geometry_buffer and the packing of the vertex attributes into GPU formats.
+ *
+ * The CPU side always keeps full float vec3 / vec2 attributes, the layout only decides how they are stored
+ * in the vertex buffers: as separate streams or interleaved in one, and in full or packed precision.
+ * Packed attributes are read back by the GL as normalized integers or half floats, only octahedral
+ * normals need an explicit decode in the vertex shader (uniform normalEncoding).
+ */
+namespace vertex_format {
+
+    enum attribute {
+        ATTRIB_POSITION,
+        ATTRIB_COLOR,
+        ATTRIB_NORMAL,
+        ATTRIB_UV,
+        ATTRIB_COUNT
+    };
+
+    enum position_format {
+        POSITION_FLOAT,     /**< 3 x float, 12 bytes. */
+        POSITION_HALF       /**< 3 x half float padded to 8 bytes, ~3 significant digits. */
+    };
+
+    enum color_format {
+        COLOR_FLOAT,        /**< 3 x float, 12 bytes. */
+        COLOR_RGBA8         /**< 4 x unorm8, 4 bytes, colors are clamped to [0, 1]. */
+    };
+
+    enum normal_format {
+        NORMAL_FLOAT,           /**< 3 x float, 12 bytes. */
+        NORMAL_OCTAHEDRAL,      /**< 2 x snorm16 octahedral mapping, 4 bytes, decoded in the vertex shader. */
+        NORMAL_INT_2_10_10_10   /**< 3 x snorm10 + 2 unused bits, 4 bytes. */
+    };
+
+    enum uv_format {
+        UV_FLOAT,           /**< 2 x float, 8 bytes. */
+        UV_UNORM16          /**< 2 x unorm16, 4 bytes, texture coordinates are clamped to [0, 1]. */
+    };
+
+    /**
+     * @brief Values of the uniform normalEncoding of the vertex shaders.
+     */
+    const int NORMAL_ENCODING_NONE = 0;
+    const int NORMAL_ENCODING_OCTAHEDRAL = 1;
+
+    /**
+     * @brief The arguments of glVertexAttribPointer for one attribute.
+     */
+    struct attribute_desc {
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLsizei bytes;      /**< Bytes used by the attribute in a vertex, including padding. */
+    };
+
+    /**
+     * @brief The storage format of the vertex attributes of a geometry_buffer.
+     *
+     * The default layout stores every attribute as floats in its own buffer.
+     */
+    struct vertex_layout {
+        position_format position = POSITION_FLOAT;
+        color_format color = COLOR_FLOAT;
+        normal_format normal = NORMAL_FLOAT;
+        uv_format uv = UV_FLOAT;
+        bool interleaved = false;   /**< Store all attributes of a vertex next to each other in a single buffer. */
+
+        /**
+         * @brief Returns the interleaved layout with every attribute packed: 20 bytes per vertex with texture
+         * coordinates and 16 without, instead of 44 and 36.
+         */
+        static vertex_layout packed();
+
+        attribute_desc describe(attribute a) const;
+        /**
+         * @brief Returns the offset of an attribute in an interleaved vertex.
+         */
+        GLsizei offset(attribute a) const;
+        /**
+         * @brief Returns the size of an interleaved vertex.
+         *
+         * @param uvs Whether the vertices have texture coordinates.
+         */
+        GLsizei stride(bool uvs) const;
+        /**
+         * @brief Returns the value of the uniform normalEncoding matching the normal format.
+         */
+        int normalEncoding() const;
+    };
+
+    /**
+     * @brief Returns the name of the vertex shader input of an attribute.
+     */
+    const char* attribute_name(attribute a);
+
+    /**
+     * @brief Converts a float to IEEE 754 half precision, rounding to nearest even.
+     */
+    unsigned short float_to_half(float value);
+    /**
+     * @brief Maps a unit vector to the octahedron unfolded on [-1, 1]^2.
+     */
+    vec2 oct_encode(vec3 normal);
+    /**
+     * @brief Packs a vector with components in [-1, 1] as GL_INT_2_10_10_10_REV.
+     */
+    unsigned int pack_snorm_2_10_10_10(vec3 value);
+
+    /**
+     * @brief Packs one attribute stream into a tightly packed buffer in the format of the layout.
+     *
+     * @param a The attribute, one of position, color or normal.
+     * @param values The attribute values of every vertex.
+     */
+    vector<unsigned char> pack_stream(const vertex_layout& layout, attribute a, const vector<vec3>& values);
+    /**
+     * @brief Packs the texture coordinates into a tightly packed buffer in the format of the layout.
+     */
+    vector<unsigned char> pack_stream(const vertex_layout& layout, const vector<vec2>& uvs);
+    /**
+     * @brief Packs all attributes of every vertex into a single interleaved buffer.
+     *
+     * Missing colors, normals or texture coordinates (streams shorter than positions) are written as zero.
+     *
+     * @param uvs The texture coordinates, may be null if the vertices have none.
+     */
+    vector<unsigned char> pack_interleaved(
+        const vertex_layout& layout,
+        const vector<vec3>& positions,
+        const vector<vec3>& colors,
+        const vector<vec3>& normals,
+        const vector<vec2>* uvs
+    );
+
+    /**
+     * @brief Per instance transform formats of instanced_geometry_buffer.
+     *
+     * The values are those of the uniform instanceFormat of the instanced vertex shaders, the compact formats
+     * are stored in the first columns of the instanceTransform attribute and expanded to a matrix in the shader.
+     */
+    enum instance_format {
+        INSTANCE_AUTO = -1,                     /**< Pick the most compact format representing every matrix. */
+        INSTANCE_MAT4 = 0,                      /**< Full matrix, 64 bytes. */
+        INSTANCE_TRANSLATION = 1,               /**< Translation only, 12 bytes. */
+        INSTANCE_TRANSLATION_SCALE_YAW = 2,     /**< Translation, uniform scale and rotation around y, 20 bytes. */
+        INSTANCE_TRANSLATION_QUAT_SCALE = 3     /**< Translation, uniform scale and rotation quaternion, 32 bytes. */
+    };
+
+    /**
+     * @brief Returns the more general of two instance formats, the one able to represent both.
+     */
+    instance_format most_general(instance_format a, instance_format b);
+    /**
+     * @brief Returns the most compact format representing the matrix, up to a relative tolerance.
+     */
+    instance_format detect_instance_format(const mat4& matrix, float tolerance = 1e-4f);
+    /**
+     * @brief Returns the most compact format representing every matrix in [start, end).
+     */
+    instance_format detect_instance_format(const vector<mat4>& matrices, size_t start, size_t end);
+    /**
+     * @brief Returns the size in bytes of one instance.
+     */
+    GLsizei instance_stride(instance_format format);
+    /**
+     * @brief Returns the number of floats stored in a column of the instanceTransform attribute, 0 if the column is unused.
+     */
+    GLint instance_column_size(instance_format format, int column);
+    /**
+     * @brief Converts matrices to an instance format.
+     *
+     * @param dst Destination of count * instance_stride(format) bytes.
+     */
+    void pack_instances(instance_format format, const mat4* matrices, size_t count, unsigned char* dst);
+    /**
+     * @brief Converts the matrices matrices[indices[i]] to an instance format.
+     *
+     * @param dst Destination of count * instance_stride(format) bytes.
+     */
+    void pack_instances(instance_format format, const mat4* matrices, const unsigned int* indices, size_t count, unsigned char* dst);
+}
+
+#endif